@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+
+#include "bench.h"
+
+/* a case runs at least this long and this often, after a warm up run */
+#define BENCH_MIN_NS		(200 * 1000000ull)
+#define BENCH_MIN_RUNS		3
+#define BENCH_MAX_RUNS		100000
+
+struct bench_result {
+	char name[64];
+	size_t bytes;
+	unsigned int runs;
+	uint64_t best_ns, mean_ns;
+	uint64_t baseline_ns;	/* 0 without one */
+};
+
+struct bench {
+	struct bench_result results[BENCH_MAX_CASES];
+	int count;
+	struct bench_result baseline[BENCH_MAX_CASES];
+	int baselines;
+};
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* the name and the best time of the results in an earlier report */
+static int bench_load_baseline(struct bench *b, const char *file)
+{
+	char line[512];
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		fprintf(stderr, "no bench baseline %s: %s\n", file,
+			strerror(errno));
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), fp) &&
+	       b->baselines < BENCH_MAX_CASES) {
+		struct bench_result *r = &b->baseline[b->baselines];
+		char *name = strstr(line, "\"name\":\"");
+		char *best = strstr(line, "\"best_ns\":");
+		unsigned long long ns;
+
+		if (!name || !best ||
+		    sscanf(name + 8, "%63[^\"]", r->name) != 1 ||
+		    sscanf(best + 10, "%llu", &ns) != 1)
+			continue;
+
+		r->best_ns = ns;
+		b->baselines++;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+struct bench *bench_create(const char *baseline)
+{
+	struct bench *b = calloc(1, sizeof(*b));
+
+	if (!b)
+		return NULL;
+
+	if (baseline && bench_load_baseline(b, baseline)) {
+		free(b);
+		return NULL;
+	}
+
+	return b;
+}
+
+void bench_destroy(struct bench *b)
+{
+	free(b);
+}
+
+int bench_run(struct bench *b, const char *name, size_t bytes,
+	      bench_fn_t fn, void *data)
+{
+	struct bench_result *r;
+	uint64_t start, t, total = 0;
+	int i, ret;
+
+	if (b->count == BENCH_MAX_CASES)
+		return -ENOSPC;
+
+	r = &b->results[b->count];
+	memset(r, 0, sizeof(*r));
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->bytes = bytes;
+
+	ret = fn(data);
+	if (ret) {
+		fprintf(stderr, "bench %s failed: %s\n", name, strerror(-ret));
+		return ret;
+	}
+
+	while (r->runs < BENCH_MIN_RUNS ||
+	       (total < BENCH_MIN_NS && r->runs < BENCH_MAX_RUNS)) {
+		start = bench_now();
+		ret = fn(data);
+		t = bench_now() - start;
+		if (ret) {
+			fprintf(stderr, "bench %s failed: %s\n", name,
+				strerror(-ret));
+			return ret;
+		}
+
+		if (!r->runs || t < r->best_ns)
+			r->best_ns = t;
+		total += t;
+		r->runs++;
+	}
+	r->mean_ns = total / r->runs;
+
+	for (i = 0; i < b->baselines; i++)
+		if (!strcmp(b->baseline[i].name, r->name))
+			r->baseline_ns = b->baseline[i].best_ns;
+
+	fprintf(stderr, "%-40s %10.3f ms", r->name, r->best_ns / 1000000.0);
+	if (bytes)
+		fprintf(stderr, " %9.1f MB/s", bytes * 1000.0 / r->best_ns);
+	if (r->baseline_ns)
+		fprintf(stderr, " %+6.1f%%", (double)r->best_ns * 100 /
+			r->baseline_ns - 100);
+	fprintf(stderr, "\n");
+
+	b->count++;
+
+	return 0;
+}
+
+int bench_report(struct bench *b, const char *file)
+{
+	int i, regressions = 0;
+	FILE *fp;
+
+	fp = fopen(file, "w");
+	if (!fp) {
+		fprintf(stderr, "Error file %s\n", file);
+		perror("- error");
+		return -errno;
+	}
+
+	fprintf(fp, "{\"version\":1,\"tolerance\":%.2f,\"results\":[\n",
+		BENCH_TOLERANCE);
+
+	for (i = 0; i < b->count; i++) {
+		struct bench_result *r = &b->results[i];
+
+		fprintf(fp,
+			"{\"name\":\"%s\",\"bytes\":%zu,\"runs\":%u,\"best_ns\":%llu,\"mean_ns\":%llu,\"mbps\":%.1f",
+			r->name, r->bytes, r->runs,
+			(unsigned long long)r->best_ns,
+			(unsigned long long)r->mean_ns,
+			r->bytes ? r->bytes * 1000.0 / r->best_ns : 0.0);
+
+		if (r->baseline_ns) {
+			double change = (double)r->best_ns / r->baseline_ns - 1;
+			bool regression = change > BENCH_TOLERANCE;
+
+			fprintf(fp,
+				",\"baseline_ns\":%llu,\"change\":%.3f,\"regression\":%s",
+				(unsigned long long)r->baseline_ns, change,
+				regression ? "true" : "false");
+
+			if (regression) {
+				fprintf(stderr, "regression %s: %.3f ms, baseline %.3f ms\n",
+					r->name, r->best_ns / 1000000.0,
+					r->baseline_ns / 1000000.0);
+				regressions++;
+			}
+		}
+
+		fprintf(fp, "}%s\n", i + 1 < b->count ? "," : "");
+	}
+
+	fprintf(fp, "]}\n");
+	fclose(fp);
+
+	fprintf(stderr, "%d cases to %s, %d regressions\n", b->count, file,
+		regressions);
+
+	return regressions;
+}
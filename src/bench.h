@@ -0,0 +1,32 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Times cases and reports them as json, one result a line:
+ *   {"name":"copy/1920x1080/A8R8G8B8","bytes":..,"runs":..,
+ *    "best_ns":..,"mean_ns":..,"mbps":..[,"baseline_ns":..,
+ *    "change":..,"regression":..]}
+ * A baseline is an earlier report, a case slower than its best by more
+ * than the tolerance is a regression.
+ */
+#define BENCH_MAX_CASES		512
+#define BENCH_TOLERANCE		0.20
+
+struct bench;
+
+/* returns 0 or a negative errno, which stops the case */
+typedef int (*bench_fn_t)(void *data);
+
+struct bench *bench_create(const char *baseline);
+void bench_destroy(struct bench *b);
+
+/* runs 'fn' for a while, 'bytes' it moves a run gives the throughput */
+int bench_run(struct bench *b, const char *name, size_t bytes,
+	      bench_fn_t fn, void *data);
+/* writes the report to 'file', returns the number of regressions */
+int bench_report(struct bench *b, const char *file);
+
+#endif
@@ -30,8 +30,12 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
 
 #include <drm.h>
 #include <drm_fourcc.h>
@@ -46,8 +50,38 @@ struct bo {
 	size_t offset;
 	size_t pitch;
 	unsigned handle;
+	/* udmabuf: the pixels live in a memfd, -1 for a dumb buffer */
+	int memfd;
+	int dmabuf;
 };
 
+/* from linux/udmabuf.h and linux/dma-buf.h, older sdk headers lack them */
+struct bo_udmabuf_create {
+	uint32_t memfd;
+	uint32_t flags;
+	uint64_t offset;
+	uint64_t size;
+};
+#define BO_UDMABUF_FLAGS_CLOEXEC	0x01
+#define BO_UDMABUF_CREATE	_IOW('u', 0x42, struct bo_udmabuf_create)
+
+struct bo_dma_buf_sync {
+	uint64_t flags;
+};
+#define BO_DMA_BUF_SYNC_WRITE	(2 << 0)
+#define BO_DMA_BUF_SYNC_START	(0 << 2)
+#define BO_DMA_BUF_SYNC_END	(1 << 2)
+#define BO_DMA_BUF_IOCTL_SYNC	_IOW('b', 0, struct bo_dma_buf_sync)
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC		0x0001U
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		(1024 + 9)
+#define F_SEAL_SHRINK		0x0002
+#endif
+
 /**
  * Static (compile-time) assertion.
  * Basically, use COND to dimension an array.  If COND is false/zero the
@@ -235,6 +269,8 @@ struct bo *bo_create_dumb(int fd, unsigned int width, unsigned int height,
 	bo->handle = arg.handle;
 	bo->size = arg.size;
 	bo->pitch = arg.pitch;
+	bo->memfd = -1;
+	bo->dmabuf = -1;
 
 	fprintf(stdout, "bo fd.%d, %d x %d, %dbpp -> pitch:%d size:%d\n",
 		bo->fd, width, height, bpp, (int)bo->pitch, (int)bo->size);
@@ -250,6 +286,18 @@ int bo_map(struct bo *bo, void **out)
 	memset(&arg, 0, sizeof(arg));
 	arg.handle = bo->handle;
 
+	if (bo->memfd >= 0) {
+		map = mmap(0, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   bo->memfd, 0);
+		if (map == MAP_FAILED)
+			return -EINVAL;
+
+		bo->ptr = map;
+		*out = map;
+
+		return 0;
+	}
+
 	ret = drmIoctl(bo->fd, DRM_IOCTL_MODE_MAP_DUMB, &arg);
 	if (ret)
 		return ret;
@@ -289,3 +337,135 @@ void bo_destroy_dumb(struct bo *bo)
 
 	free(bo);
 }
+
+/*
+ * A buffer of shmem pages imported as a dma-buf, the display scans out the
+ * memfd pages. The lines are tightly packed as they are in a capture file.
+ */
+struct bo *bo_create_udmabuf(int fd, unsigned int width, unsigned int height,
+			     unsigned int bpp)
+{
+	struct bo_udmabuf_create create;
+	long page = sysconf(_SC_PAGESIZE);
+	struct bo *bo;
+	int dev;
+
+	bo = calloc(1, sizeof(*bo));
+	if (bo == NULL) {
+		fprintf(stderr, "failed to allocate buffer object\n");
+		return NULL;
+	}
+
+	bo->fd = fd;
+	bo->pitch = width * bpp / 8;
+	bo->size = (bo->pitch * height + page - 1) & ~(page - 1);
+	bo->dmabuf = -1;
+
+	bo->memfd = syscall(SYS_memfd_create, "capture-display",
+			    MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (bo->memfd < 0)
+		goto __exit_udmabuf;
+
+	/* udmabuf pins the pages, the memfd must not shrink under it */
+	if (ftruncate(bo->memfd, bo->size) ||
+	    fcntl(bo->memfd, F_ADD_SEALS, F_SEAL_SHRINK))
+		goto __exit_udmabuf;
+
+	dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (dev < 0)
+		goto __exit_udmabuf;
+
+	memset(&create, 0, sizeof(create));
+	create.memfd = bo->memfd;
+	create.flags = BO_UDMABUF_FLAGS_CLOEXEC;
+	create.size = bo->size;
+
+	bo->dmabuf = ioctl(dev, BO_UDMABUF_CREATE, &create);
+	close(dev);
+	if (bo->dmabuf < 0)
+		goto __exit_udmabuf;
+
+	if (drmPrimeFDToHandle(fd, bo->dmabuf, &bo->handle))
+		goto __exit_udmabuf;
+
+	fprintf(stdout, "bo fd.%d, %d x %d, %dbpp -> udmabuf pitch:%d size:%d\n",
+		bo->fd, width, height, bpp, (int)bo->pitch, (int)bo->size);
+
+	return bo;
+
+__exit_udmabuf:
+	fprintf(stderr, "failed to create udmabuf: %s\n", strerror(errno));
+
+	if (bo->dmabuf >= 0)
+		close(bo->dmabuf);
+	if (bo->memfd >= 0)
+		close(bo->memfd);
+	free(bo);
+
+	return NULL;
+}
+
+/*
+ * Fills a udmabuf with 'size' bytes of 'fd' at 'offset' in the kernel,
+ * the pixels are never copied through the user space.
+ */
+int bo_load_fd(struct bo *bo, int fd, off_t offset, size_t size)
+{
+	struct bo_dma_buf_sync sync;
+	ssize_t ret = 0;
+
+	if (bo->memfd < 0 || size > bo->size)
+		return -EINVAL;
+
+	sync.flags = BO_DMA_BUF_SYNC_START | BO_DMA_BUF_SYNC_WRITE;
+	ioctl(bo->dmabuf, BO_DMA_BUF_IOCTL_SYNC, &sync);
+
+	if (lseek(bo->memfd, 0, SEEK_SET) < 0)
+		ret = -1;
+
+	while (ret >= 0 && size) {
+		ret = sendfile(bo->memfd, fd, &offset, size);
+		if (ret <= 0)
+			break;
+		size -= ret;
+	}
+
+	/* flush the cpu caches for the display */
+	sync.flags = BO_DMA_BUF_SYNC_END | BO_DMA_BUF_SYNC_WRITE;
+	ioctl(bo->dmabuf, BO_DMA_BUF_IOCTL_SYNC, &sync);
+
+	if (size) {
+		fprintf(stderr, "Reading error: %s\n",
+			ret ? strerror(errno) : "end of file");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+int bo_is_udmabuf(const struct bo *bo)
+{
+	return bo->memfd >= 0;
+}
+
+void bo_destroy(struct bo *bo)
+{
+	struct drm_gem_close arg;
+
+	bo_unmap(bo);
+
+	if (bo->memfd < 0) {
+		bo_destroy_dumb(bo);
+		return;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	arg.handle = bo->handle;
+	if (drmIoctl(bo->fd, DRM_IOCTL_GEM_CLOSE, &arg))
+		fprintf(stderr, "failed to close buffer handle: %s\n",
+			strerror(errno));
+
+	close(bo->dmabuf);
+	close(bo->memfd);
+	free(bo);
+}
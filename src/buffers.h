@@ -27,11 +27,18 @@
 #ifndef __DRM_BUFFERS_H__
 #define __DRM_BUFFERS_H__
 
+#include <sys/types.h>
+
 struct bo;
 
 struct bo *bo_create_dumb(int fd, unsigned int width, unsigned int height,
 			  unsigned int bpp);
 void bo_destroy_dumb(struct bo *bo);
+struct bo *bo_create_udmabuf(int fd, unsigned int width, unsigned int height,
+			     unsigned int bpp);
+int bo_load_fd(struct bo *bo, int fd, off_t offset, size_t size);
+int bo_is_udmabuf(const struct bo *bo);
+void bo_destroy(struct bo *bo);
 int bo_map(struct bo *bo, void **out);
 void bo_unmap(struct bo *bo);
 
@@ -0,0 +1,610 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "capture.h"
+#include "copypool.h"
+#include "stream.h"
+#include "kms.h"
+#include "buffers.h"
+#include "image.h"
+#include "iomap.h"
+#include "timeline.h"
+#include "io.h"
+
+/* the frame buffers a module shows, the front and back of every layer */
+#define CAPTURE_MAPS		8
+
+/* a plane mapped on a capture, kept for the next ones */
+struct capture_map {
+	uint32_t addr;
+	size_t size;
+	void *mem, *mapped;
+	unsigned int used;	/* the capture of its last use */
+};
+
+/* a framebuffer a frame is replayed from */
+struct capture_fb {
+	struct bo *bo;
+	unsigned int fb_id, fourcc, width, height;
+	unsigned int handles[4], pitches[4], offsets[4];
+	void *planes[3];
+};
+
+struct capture_module {
+	int module;
+	unsigned int refs;
+	void *mapped;
+	size_t size;		/* of a mapping of its own */
+	/* the frames, captured from the threads of a process in turns */
+	pthread_mutex_t maps_lock;
+	struct capture_map maps[CAPTURE_MAPS];
+	unsigned int captures;
+	/* the replays through drm, a front and a back buffer a layer */
+	struct device dev;
+	unsigned int crtc_id, plane_ids[mlc_layer_unknown];
+	struct capture_fb fbs[mlc_layer_unknown][2];
+	int fronts[mlc_layer_unknown];	/* on the plane, -1 is none */
+};
+
+/* a module is mapped once, its handle shared by every open */
+static struct capture_module *capture_modules[NUMBER_OF_MLC_MODULE];
+static pthread_mutex_t capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void capture_replay_close(struct capture_module *m);
+
+int capture_init(const char *backend)
+{
+	return backend ? iomem_open(backend) : 0;
+}
+
+void capture_exit(void)
+{
+	iomem_close();
+}
+
+struct capture_module *capture_open(int module)
+{
+	struct capture_module *m;
+	const void *addr;
+	void *mem;
+	int i;
+
+	addr = hw_reg_get_base(module);
+	if (!addr) {
+		fprintf(stderr, "no module.%d\n", module);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&capture_lock);
+
+	m = capture_modules[module];
+	if (m) {
+		m->refs++;
+		goto __exit_open;
+	}
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		goto __exit_open;
+
+	m->module = module;
+	m->refs = 1;
+	m->dev.fd = -1;
+	pthread_mutex_init(&m->maps_lock, NULL);
+	for (i = 0; i < mlc_layer_unknown; i++)
+		m->fronts[i] = -1;
+
+	/* mapped by the caller, it stays its mapping */
+	if (!hw_reg_get_mem(module)) {
+		m->size = hw_reg_get_length(module);
+		mem = iomem_map(addr, m->size, &m->mapped);
+		if (!mem) {
+			fprintf(stderr, "Fail, module %d, map %p\n",
+				module, addr);
+			free(m);
+			m = NULL;
+			goto __exit_open;
+		}
+		hw_reg_set_base(module, mem);
+	}
+
+	capture_modules[module] = m;
+
+__exit_open:
+	pthread_mutex_unlock(&capture_lock);
+
+	return m;
+}
+
+void capture_close(struct capture_module *m)
+{
+	int i;
+
+	if (!m)
+		return;
+
+	pthread_mutex_lock(&capture_lock);
+
+	if (--m->refs) {
+		pthread_mutex_unlock(&capture_lock);
+		return;
+	}
+
+	capture_modules[m->module] = NULL;
+	capture_replay_close(m);
+	for (i = 0; i < CAPTURE_MAPS; i++)
+		iomem_free(m->maps[i].mapped, m->maps[i].size);
+	pthread_mutex_destroy(&m->maps_lock);
+	if (m->mapped) {
+		iomem_free(m->mapped, m->size);
+		hw_reg_set_base(m->module, NULL);
+	}
+
+	pthread_mutex_unlock(&capture_lock);
+
+	free(m);
+}
+
+int capture_snapshot(struct capture_module *m, struct mlc_reg *reg,
+		     struct mlc_snapshot *stat)
+{
+	uint64_t ts = timeline_begin();
+	int ret;
+
+	ret = hw_reg_snapshot(m->module, reg, stat);
+	timeline_end("capture", "snapshot", ts);
+
+	return ret;
+}
+
+int capture_frame_layout(const struct mlc_reg *reg, enum mlc_layer layer,
+			 struct capture_frame *f)
+{
+	int height, i;
+
+	memset(f, 0, sizeof(*f));
+	f->layer = layer;
+
+	switch (layer) {
+	case mlc_layer_video: {
+		const struct mlcyuvlayer *r = &reg->yuv;
+		unsigned int format = r->mlccontrol & _maskbit(16, 3);
+		int div = format == mlc_yuvfmt_420 ||
+			  format == mlc_yuvfmt_420_cbcr ? 2 : 1;
+
+		/* the lines the scaler reads */
+		height = _getbits(r->mlctopbottom, 0, 11) -
+			 _getbits(r->mlctopbottom, 16, 11) + 1;
+		height = _getbits(r->mlcvscale, 0, 23) * height /
+			 MLC_YUV_SCALE_CONSTANT;
+
+		f->strides[0] = r->mlcvstride;
+		f->sizes[0] = (size_t)r->mlcvstride * height;
+		f->addrs[0] = r->mlcaddress;
+		f->planes = 1;
+		if (format == mlc_yuvfmt_yuyv)
+			break;
+
+		f->strides[1] = r->mlcvstridecb;
+		f->sizes[1] = (size_t)r->mlcvstridecb * (height / div);
+		f->addrs[1] = r->mlcaddresscb;
+		f->planes = 2;
+		/* the cb and cr pairs interleaved in the cb plane */
+		if (format == mlc_yuvfmt_420_cbcr ||
+		    format == mlc_yuvfmt_422_cbcr)
+			break;
+
+		f->strides[2] = r->mlcvstridecr;
+		f->sizes[2] = (size_t)r->mlcvstridecr * (height / div);
+		f->addrs[2] = r->mlcaddresscr;
+		f->planes = 3;
+		break;
+	}
+	case mlc_layer_rgb0:
+	case mlc_layer_rgb1: {
+		const struct mlcrgblayer *r = &reg->rgb[layer];
+
+		height = _getbits(r->mlctopbottom, 0, 11) -
+			 _getbits(r->mlctopbottom, 16, 11) + 1;
+		f->strides[0] = r->mlcvstride;
+		f->sizes[0] = (size_t)r->mlcvstride * height;
+		f->addrs[0] = r->mlcaddress;
+		f->planes = 1;
+		break;
+	}
+	case mlc_layer_unknown:
+	default:
+		return -EINVAL;
+	}
+
+	for (i = 0; i < f->planes; i++)
+		f->size += f->sizes[i];
+
+	return f->planes;
+}
+
+/*
+ * The mapping of a plane, of an earlier capture when it has one. A new
+ * one takes the place of the least recently used.
+ */
+static void *capture_map_plane(struct capture_module *m, uint32_t addr,
+			       size_t size)
+{
+	struct capture_map *map, *lru = &m->maps[0];
+	int i;
+
+	for (i = 0; i < CAPTURE_MAPS; i++) {
+		map = &m->maps[i];
+		if (map->mem && map->addr == addr && map->size >= size) {
+			map->used = m->captures;
+			return map->mem;
+		}
+		if (lru->mem && (!map->mem || map->used < lru->used))
+			lru = map;
+	}
+
+	iomem_free(lru->mapped, lru->size);
+	memset(lru, 0, sizeof(*lru));
+
+	lru->mem = iomem_map((void *)(size_t)addr, size, &lru->mapped);
+	if (!lru->mem)
+		return NULL;
+	lru->addr = addr;
+	lru->size = size;
+	lru->used = m->captures;
+
+	return lru->mem;
+}
+
+ssize_t capture_layer(struct capture_module *m,
+		      const struct capture_frame *f, struct copypool *pool,
+		      void *buf, size_t size)
+{
+	ssize_t ret = f->size;
+	uint64_t ts;
+	void *mem;
+	int i;
+
+	if (size < f->size)
+		return -ENOSPC;
+
+	pthread_mutex_lock(&m->maps_lock);
+	m->captures++;
+
+	for (i = 0; i < f->planes; i++) {
+		/* a layer of no size has nothing to map */
+		if (!f->sizes[i])
+			continue;
+
+		ts = timeline_begin();
+		mem = capture_map_plane(m, f->addrs[i], f->sizes[i]);
+		timeline_end("capture", "map", ts);
+		if (!mem) {
+			fprintf(stderr, "Fail, map 0x%x\n", f->addrs[i]);
+			ret = -EINVAL;
+			break;
+		}
+
+		ts = timeline_begin();
+		if (pool && f->strides[i])
+			copypool_copy(pool, buf, mem, f->strides[i],
+				      f->sizes[i] / f->strides[i]);
+		else
+			memcpy(buf, mem, f->sizes[i]);
+		timeline_end("capture", "copy", ts);
+
+		buf += f->sizes[i];
+	}
+
+	pthread_mutex_unlock(&m->maps_lock);
+
+	return ret;
+}
+
+ssize_t capture_layer_stream(struct capture_module *m,
+			     const struct capture_frame *f, struct stream *s,
+			     int fd)
+{
+	int i, ret;
+
+	for (i = 0; i < f->planes; i++) {
+		ret = stream_plane(s, fd, f->addrs[i], f->sizes[i]);
+		if (ret)
+			return ret;
+	}
+
+	return f->size;
+}
+
+int capture_frame_fourcc(const struct mlc_reg *reg, enum mlc_layer layer,
+			 unsigned int *fourcc)
+{
+	unsigned int format, bpp;
+
+	if (layer == mlc_layer_video) {
+		format = reg->yuv.mlccontrol & _maskbit(16, 3);
+
+		switch (format) {
+		case mlc_yuvfmt_420:
+			*fourcc = DRM_FORMAT_YUV420;
+			return 0;
+		case mlc_yuvfmt_422:
+			*fourcc = DRM_FORMAT_YUV422;
+			return 0;
+		case mlc_yuvfmt_444:
+			*fourcc = DRM_FORMAT_YUV444;
+			return 0;
+		case mlc_yuvfmt_yuyv:
+			*fourcc = DRM_FORMAT_YUYV;
+			return 0;
+		default:
+			fprintf(stderr, "Failed, not support 0x%x format\n",
+				format);
+			return -EINVAL;
+		}
+	}
+
+	if (layer != mlc_layer_rgb0 && layer != mlc_layer_rgb1)
+		return -EINVAL;
+
+	format = reg->rgb[layer].mlccontrol & _maskbit(16, 16);
+	bpp = reg->rgb[layer].mlchstride * 8;
+
+	switch (format) {
+	case mlc_rgbfmt_x1r5g5b5:
+		*fourcc = DRM_FORMAT_XRGB1555;
+		break;
+	case mlc_rgbfmt_x1b5g5r5:
+		*fourcc = DRM_FORMAT_XBGR1555;
+		break;
+	case mlc_rgbfmt_r5g6b5:
+		*fourcc = DRM_FORMAT_RGB565;
+		break;
+	case mlc_rgbfmt_b5g6r5:
+		*fourcc = DRM_FORMAT_BGR565;
+		break;
+	case mlc_rgbfmt_r8g8b8:
+	case mlc_rgbfmt_x8r8g8b8:
+		*fourcc = (bpp == 24) ? DRM_FORMAT_RGB888 : DRM_FORMAT_XRGB8888;
+		break;
+	case mlc_rgbfmt_b8g8r8:
+	case mlc_rgbfmt_x8b8g8r8:
+		*fourcc = (bpp == 24) ? DRM_FORMAT_BGR888 : DRM_FORMAT_XBGR8888;
+		break;
+	case mlc_rgbfmt_a8r8g8b8:
+		*fourcc = DRM_FORMAT_ARGB8888;
+		break;
+	case mlc_rgbfmt_a8b8g8r8:
+		*fourcc = DRM_FORMAT_ABGR8888;
+		break;
+	default:
+		fprintf(stderr, "Failed, not support 0x%x format %dbpp\n",
+			format, bpp);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* the drm device of the replays of a module, opened on the first one */
+static int capture_replay_open(struct capture_module *m)
+{
+	struct device *dev = &m->dev;
+	struct crtc *crtc;
+	int i, n;
+
+	if (dev->resources)
+		return 0;
+
+	dev->fd = drm_open(NULL, CAPTURE_DRM_DRIVER);
+	if (dev->fd < 0)
+		return -ENODEV;
+
+	dev->resources = drm_get_resources(dev);
+	crtc = dev->resources ? drm_crtc(dev, m->module) : NULL;
+	if (!crtc || !dev->resources->plane_res)
+		goto __exit_open;
+
+	m->crtc_id = crtc->crtc->crtc_id;
+
+	/* the layer's plane, as capture-display replays it */
+	for (i = 0, n = 0; i < (int)dev->resources->plane_res->count_planes;
+	     i++) {
+		struct plane *plane = drm_plane(dev, i);
+
+		if (!plane)
+			goto __exit_open;
+		if (!(plane->plane->possible_crtcs & (1 << m->module)))
+			continue;
+		if (n < mlc_layer_unknown)
+			m->plane_ids[n++] = plane->plane->plane_id;
+	}
+
+	return 0;
+
+__exit_open:
+	fprintf(stderr, "no crtc and planes of module.%d\n", m->module);
+	capture_replay_close(m);
+
+	return -ENODEV;
+}
+
+static void capture_replay_fb_free(struct capture_module *m,
+				   struct capture_fb *fb)
+{
+	if (fb->fb_id)
+		drmModeRmFB(m->dev.fd, fb->fb_id);
+	if (fb->bo)
+		bo_destroy(fb->bo);
+	memset(fb, 0, sizeof(*fb));
+}
+
+static void capture_replay_close(struct capture_module *m)
+{
+	int i, n;
+
+	if (m->dev.fd < 0)
+		return;
+
+	/* the planes off the screen before their framebuffers are gone */
+	for (i = 0; i < mlc_layer_unknown; i++) {
+		if (m->fronts[i] >= 0)
+			drmModeSetPlane(m->dev.fd, m->plane_ids[i], m->crtc_id,
+					0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+		m->fronts[i] = -1;
+		for (n = 0; n < 2; n++)
+			capture_replay_fb_free(m, &m->fbs[i][n]);
+	}
+
+	if (m->dev.resources)
+		drm_free_resources(m->dev.resources);
+	m->dev.resources = NULL;
+	drm_close(m->dev.fd);
+	m->dev.fd = -1;
+}
+
+/* the back framebuffer of the layer, of the frame's format and size */
+static struct capture_fb *capture_replay_fb(struct capture_module *m,
+					    enum mlc_layer layer,
+					    unsigned int fourcc,
+					    unsigned int width,
+					    unsigned int height)
+{
+	struct capture_fb *fb = &m->fbs[layer][m->fronts[layer] == 0];
+	uint64_t ts;
+
+	if (fb->bo && fb->fourcc == fourcc && fb->width == width &&
+	    fb->height == height)
+		return fb;
+
+	capture_replay_fb_free(m, fb);
+
+	fb->bo = util_bo_create(m->dev.fd, UTIL_BO_DUMB, fourcc, width,
+				height, fb->handles, fb->pitches, fb->offsets,
+				fb->planes);
+	if (!fb->bo)
+		return NULL;
+
+	ts = timeline_begin();
+	if (drmModeAddFB2(m->dev.fd, width, height, fourcc, fb->handles,
+			  fb->pitches, fb->offsets, &fb->fb_id, 0)) {
+		fprintf(stderr, "failed to add fb: %s\n", strerror(errno));
+		capture_replay_fb_free(m, fb);
+		return NULL;
+	}
+	timeline_end("drm", "fb add", ts);
+
+	fb->fourcc = fourcc;
+	fb->width = width;
+	fb->height = height;
+
+	return fb;
+}
+
+int capture_replay(struct capture_module *m, const struct mlc_reg *reg,
+		   const struct capture_frame *f, const void *buf,
+		   size_t size)
+{
+	unsigned int fourcc, src_w, src_h, crtc_w, crtc_h, rows, len;
+	enum mlc_layer layer = f->layer;
+	struct capture_fb *fb;
+	int crtc_x, crtc_y, i, ret;
+	uint64_t ts;
+
+	if (size < f->size || !f->sizes[0] || !f->strides[0])
+		return -EINVAL;
+
+	ret = capture_frame_fourcc(reg, layer, &fourcc);
+	if (ret)
+		return ret;
+
+	/* the source is of the stride for the aligned image */
+	if (layer == mlc_layer_video) {
+		const struct mlcyuvlayer *r = &reg->yuv;
+
+		crtc_x = _getbits(r->mlcleftright, 16, 12);
+		crtc_y = _getbits(r->mlctopbottom, 16, 12);
+		crtc_w = _getbits(r->mlcleftright, 0, 11) -
+			 _getbits(r->mlcleftright, 16, 11) + 1;
+		crtc_h = _getbits(r->mlctopbottom, 0, 11) -
+			 _getbits(r->mlctopbottom, 16, 11) + 1;
+		src_w = r->mlcvstride / (fourcc == DRM_FORMAT_YUYV ? 2 : 1);
+		src_h = f->sizes[0] / f->strides[0];
+	} else {
+		const struct mlcrgblayer *r = &reg->rgb[layer];
+
+		if (!r->mlchstride)
+			return -EINVAL;
+		crtc_x = _getbits(r->mlcleftright, 16, 12);
+		crtc_y = _getbits(r->mlctopbottom, 16, 12);
+		src_w = r->mlcvstride / r->mlchstride;
+		src_h = f->sizes[0] / f->strides[0];
+		crtc_w = src_w;
+		crtc_h = src_h;
+	}
+
+	pthread_mutex_lock(&capture_lock);
+
+	ret = capture_replay_open(m);
+	if (ret)
+		goto __exit_replay;
+
+	if (!m->plane_ids[layer]) {
+		fprintf(stderr, "no plane of layer %d on module.%d\n",
+			layer, m->module);
+		ret = -ENODEV;
+		goto __exit_replay;
+	}
+
+	fb = capture_replay_fb(m, layer, fourcc, src_w, src_h);
+	if (!fb) {
+		ret = -ENOMEM;
+		goto __exit_replay;
+	}
+
+	/* the rows of each plane to the pitch of the framebuffer */
+	ts = timeline_begin();
+	for (i = 0; i < f->planes; i++) {
+		const void *src = buf;
+		unsigned int y;
+
+		buf += f->sizes[i];
+		if (!f->strides[i] || !fb->planes[i])
+			continue;
+
+		rows = f->sizes[i] / f->strides[i];
+		len = f->strides[i] < fb->pitches[i] ? f->strides[i] :
+		      fb->pitches[i];
+		for (y = 0; y < rows; y++, src += f->strides[i])
+			memcpy(fb->planes[i] + (size_t)fb->pitches[i] * y,
+			       src, len);
+	}
+	timeline_end("replay", "copy", ts);
+
+	/* note src coords (last 4 args) are in Q16 format */
+	ts = timeline_begin();
+	ret = drmModeSetPlane(m->dev.fd, m->plane_ids[layer], m->crtc_id,
+			      fb->fb_id, 0, crtc_x, crtc_y, crtc_w, crtc_h,
+			      0, 0, src_w << 16, src_h << 16);
+	timeline_end("drm", "plane set", ts);
+	if (ret) {
+		ret = -errno;
+		fprintf(stderr, "failed to set plane: %s\n", strerror(errno));
+		goto __exit_replay;
+	}
+
+	m->fronts[layer] = fb - m->fbs[layer];
+
+__exit_replay:
+	pthread_mutex_unlock(&capture_lock);
+
+	return ret;
+}
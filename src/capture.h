@@ -0,0 +1,79 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mlc.h"
+
+/*
+ * libcapturedisplay: captures and replays the mlc layers in memory, for
+ * a process to keep a module open rather than run capture-display for
+ * every frame. Errors are negative errno values.
+ */
+struct capture_module;
+struct copypool;
+struct stream;
+
+/* the planes of a layer's frame, one after the other in a buffer */
+struct capture_frame {
+	enum mlc_layer layer;
+	int planes;
+	size_t sizes[3];
+	unsigned int strides[3];
+	uint32_t addrs[3];
+	size_t size;		/* of all the planes */
+};
+
+/* the io backend as capture-display -B, NULL is the physical memory */
+int capture_init(const char *backend);
+void capture_exit(void);
+
+/*
+ * Maps the registers of a module. The handle of a module is shared and
+ * counted, the last close unmaps it. A module the caller mapped itself
+ * stays mapped.
+ */
+struct capture_module *capture_open(int module);
+void capture_close(struct capture_module *m);
+
+/* the registers with a layout no update was half way through */
+int capture_snapshot(struct capture_module *m, struct mlc_reg *reg,
+		     struct mlc_snapshot *stat);
+
+/* the frame 'layer' shows in 'reg', returns its plane count */
+int capture_frame_layout(const struct mlc_reg *reg, enum mlc_layer layer,
+			 struct capture_frame *f);
+
+/*
+ * Copies the frame to 'buf', in bands of rows on the threads of 'pool'
+ * or NULL on the calling one. Returns the bytes copied. The planes stay
+ * mapped for the next captures until the last close, the captures of a
+ * module from several threads take turns.
+ */
+ssize_t capture_layer(struct capture_module *m,
+		      const struct capture_frame *f, struct copypool *pool,
+		      void *buf, size_t size);
+/* writes the frame to 'fd' through the chunk of 's', returns the bytes */
+ssize_t capture_layer_stream(struct capture_module *m,
+			     const struct capture_frame *f, struct stream *s,
+			     int fd);
+
+/* the drm fourcc of the format of 'layer' in 'reg' */
+int capture_frame_fourcc(const struct mlc_reg *reg, enum mlc_layer layer,
+			 unsigned int *fourcc);
+
+/*
+ * Replays a frame from memory on the DRM plane of the layer, at the place
+ * and in the layout of 'reg'. The frame is copied to a dumb buffer of the
+ * driver CAPTURE_DRM_DRIVER, the one the plane shows is kept until the
+ * next replay of the layer or the last close.
+ */
+#define CAPTURE_DRM_DRIVER	"nexell"
+
+int capture_replay(struct capture_module *m, const struct mlc_reg *reg,
+		   const struct capture_frame *f, const void *buf,
+		   size_t size);
+
+#endif
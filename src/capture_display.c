@@ -1,45 +1,81 @@
+#define _GNU_SOURCE
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <sys/signal.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <drm_fourcc.h>
 
 #include "kms.h"
+#include "buffers.h"
 #include "format.h"
 #include "image.h"
+#include "prefetch.h"
+#include "evloop.h"
+#include "regtrace.h"
+#include "iosim.h"
+#include "status.h"
+#include "bench.h"
+#include "perf.h"
+#include "flipmon.h"
+#include "timeline.h"
+#include "ticker.h"
+#include "copypool.h"
+#include "stream.h"
+#include "compare.h"
+#include "watchdog.h"
+#include "capture.h"
 
 #include "io.h"
 #include "iomap.h"
 #include "mlc.h"
 
-#define DRM_MODULE_NAME "nexell"
-
 struct raw_header {
 	char sign[4];
 	int module, layer;
 	unsigned int dummy;
 	/* offset 0x10 */
 	struct mlc_reg mlc;     /* 986 byte */
+	/* multi-frame capture, 0 is a single frame */
+	unsigned int frames;
+	unsigned int frame_rate;	/* frames per 1000 seconds */
 };
 #define RAW_HEADER_SIZE  (1024)
 #define RAW_HEADER_SIGN  { 'M', 'L', 'C', '\n' }
 
+#define FRAME_POOL_SIZE	4
+
+struct frame_buffer {
+	struct bo *bo;
+	unsigned int fb_id;
+	unsigned int handles[4], pitches[4], offsets[4];
+	void *planes[3];
+};
+
 struct plane_opt {
 	unsigned int plane_id;  /* the id of plane to use */
 	unsigned int crtc_id;  /* the id of CRTC to bind to */
 	unsigned int fb_id;
 	struct bo *bo;
+	enum util_bo_type bo_type;
 	unsigned int fourcc;
 
 	/* source rect */
@@ -51,17 +87,62 @@ struct plane_opt {
 	uint32_t connector_id;
 	uint32_t encoder_id;
 	int mode_index;
+	/* requested mode, 0 is any */
+	unsigned int mode_w, mode_h, mode_hz;
+	unsigned int disp_w, disp_h;
+	bool modeset;		/* the mode is to be set */
+
+	/* the plane can't scale, the captured image is scaled on the cpu */
+	bool sw_scale;
+	unsigned int image_w, image_h;
+	void *scratch;
+	void *scratch_planes[3];
+	unsigned int scratch_pitches[4];
 
 	struct util_image_info image;
+	struct frame_buffer pool[FRAME_POOL_SIZE];
+};
+
+struct replay_opt {
+	unsigned int frames;	/* frames in the file */
+	size_t frame_size;
+	int fd;
+	double rate;		/* frames per second, 0 is the recorded rate */
+	double speed;
+	unsigned int start;	/* seek frame */
+	unsigned int loops;	/* 0 is infinite */
+	unsigned int duration;	/* msec on screen, 0 is until quit */
+	const char *control;	/* control socket path */
+	int stop;		/* an eventfd which quits, or -1 */
 };
 
 enum op_mode {
 	op_mode_print,
 	op_mode_capture,
 	op_mode_update,
+	op_mode_trace,
+	op_mode_monitor,
+	op_mode_daemon,
+	op_mode_batch,
+	op_mode_watchdog,
 };
 
 #define FLAG_GAMMAN_OFF (1)
+#define FLAG_ATOMIC	(2)
+#define FLAG_UDMABUF	(4)
+
+/* the stages perf counts */
+enum {
+	perf_stage_capture,	/* a frame from the device to the file */
+	perf_stage_load,	/* a frame from the file to a buffer */
+	perf_stage_convert,	/* the cpu scaling of a frame */
+};
+
+static const char * const perf_stages[] = {
+	[perf_stage_capture] = "capture",
+	[perf_stage_load] = "load",
+	[perf_stage_convert] = "convert",
+};
 
 struct op_arg {
 	int module;
@@ -73,44 +154,48 @@ struct op_arg {
 	FILE *fp;
 	enum op_mode mode;
 	unsigned int flags;
+	unsigned int frames;	/* capture frames */
+	/* periodic capture */
+	unsigned int every;	/* msec */
+	int rt_prio;		/* SCHED_FIFO priority, 0 is none */
+	int cpu;		/* cpu to run on, -1 is any */
+	bool mlock;
+	/* layer captures of one module to restore at once */
+	char *files[mlc_layer_unknown];
+	int nr_files;
+	const char *driver;
+	const char *backend;	/* register and memory backend */
+	enum status_format status;	/* print as json or binary */
+	/* benchmark results and the baseline they compare to */
+	const char *bench;
+	const char *bench_baseline;
+	struct perf *perf;	/* counters of the hot loops */
+	/* row bands copied on threads, the frame staged before its write */
+	unsigned int threads;
+	struct copypool *pool;
+	void *staging;
+	size_t staging_size;
+	struct stream *stream;	/* capture through a fixed chunk */
+	/* register trace */
+	const char *trace_regs;
+	unsigned int trace_rate;
+	unsigned int monitor;	/* flip rate report msec */
+	/* frozen display msec and the check period */
+	unsigned int watchdog, watchdog_check;
+	const char *daemon;	/* request socket path */
+	const char *batch;	/* script of operations, - is stdin */
 	struct plane_opt plane;
+	struct replay_opt replay;
 };
 
-struct format_name {
-	unsigned int format;
-	const char *name;
-};
+static uint64_t time_us(void)
+{
+	struct timespec ts;
 
-static const struct format_name mlc_format_name[] = {
-	/* rgb */
-	{ mlc_rgbfmt_r5g6b5, "R5G6B5" },
-	{ mlc_rgbfmt_b5g6r5, "B5G6R5" },
-	{ mlc_rgbfmt_x1r5g5b5, "X1R5G5B5" },
-	{ mlc_rgbfmt_x1b5g5r5, "X1B5G5R5" },
-	{ mlc_rgbfmt_x4r4g4b4, "X4R4G4B4" },
-	{ mlc_rgbfmt_x4b4g4r4, "X4B4G4R4" },
-	{ mlc_rgbfmt_x8r3g3b2, "X8R3G3B2" },
-	{ mlc_rgbfmt_x8b3g3r2, "X8B3G3R2" },
-	{ mlc_rgbfmt_a1r5g5b5, "A1R5G5B5" },
-	{ mlc_rgbfmt_a1b5g5r5, "A1B5G5R5" },
-	{ mlc_rgbfmt_a4r4g4b4, "A4R4G4B4" },
-	{ mlc_rgbfmt_a4b4g4r4, "A4B4G4R4" },
-	{ mlc_rgbfmt_a8r3g3b2, "A8R3G3B2" },
-	{ mlc_rgbfmt_a8b3g3r2, "A8B3G3R2" },
-	{ mlc_rgbfmt_r8g8b8, "R8G8B8"   },
-	{ mlc_rgbfmt_b8g8r8, "B8G8R8"   },
-	{ mlc_rgbfmt_x8r8g8b8, "X8R8G8B8" },
-	{ mlc_rgbfmt_x8b8g8r8, "X8B8G8R8" },
-	{ mlc_rgbfmt_a8r8g8b8, "A8R8G8B8" },
-	{ mlc_rgbfmt_a8b8g8r8, "A8B8G8R8" },
-	/* video */
-	{ mlc_yuvfmt_420, "YUV420"   },
-	{ mlc_yuvfmt_422, "YUV422"   },
-	{ mlc_yuvfmt_444, "YUV444"   },
-	{ mlc_yuvfmt_yuyv, "YUYV"     },
-};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-static const char *hw_format_name(unsigned int format, int bpp);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
 static void print_mlc_rgb(int module, int layer, struct mlcrgblayer *r)
 {
@@ -301,139 +386,111 @@ static void print_mlc(int module, struct mlc_reg *r)
 		_getbits(r->mlcgammacont,  0, 1) ? "ON" : "OFF");
 }
 
-static const char *hw_format_name(unsigned int format, int bpp)
+/*
+ * The display mode to replay on: the requested size and refresh rate, in
+ * the current size of an active connector or its preferred mode first.
+ * Without a request an active connector keeps its current mode.
+ */
+static int select_mode(struct plane_opt *p, struct connector *connector,
+		       struct crtc *crtc)
 {
-	int i;
+	drmModeConnector *c = connector->connector;
+	drmModeModeInfo *cur = &crtc->crtc->mode;
+	bool active = p->encoder_id && crtc->crtc->mode_valid;
+	drmModeModeInfo *mode;
+	int i, score, best = -1, found = -1;
+
+	if (active && !p->mode_w && !p->mode_hz) {
+		p->modeset = false;
+		p->disp_w = cur->hdisplay;
+		p->disp_h = cur->vdisplay;
+		return 0;
+	}
 
-	if (bpp == 32) {
-		if (format == mlc_rgbfmt_r8g8b8)
-			format = mlc_rgbfmt_x8r8g8b8;
+	for (i = 0; i < c->count_modes; i++) {
+		mode = &c->modes[i];
 
-		if (format == mlc_rgbfmt_r8g8b8)
-			format = mlc_rgbfmt_x8r8g8b8;
-	}
+		if (p->mode_w && (mode->hdisplay != p->mode_w ||
+				  mode->vdisplay != p->mode_h))
+			continue;
+		if (p->mode_hz && mode->vrefresh != p->mode_hz)
+			continue;
 
-	for (i = 0; i < (int)ARRAY_SIZE(mlc_format_name); i++)
-		if (format == mlc_format_name[i].format)
-			return mlc_format_name[i].name;
+		score = !!(mode->type & DRM_MODE_TYPE_PREFERRED);
+		if (active && mode->hdisplay == cur->hdisplay &&
+		    mode->vdisplay == cur->vdisplay)
+			score += 2;
 
-	return NULL;
-}
+		if (score > best) {
+			best = score;
+			found = i;
+		}
+	}
 
-static int format_convert_rgb(unsigned int format,
-			      unsigned int bpp, unsigned int *fourcc)
-{
-	switch (format) {
-	case mlc_rgbfmt_x1r5g5b5:
-		*fourcc = DRM_FORMAT_XRGB1555;
-		break;
-	case mlc_rgbfmt_x1b5g5r5:
-		*fourcc = DRM_FORMAT_XBGR1555;
-		break;
-	case mlc_rgbfmt_r5g6b5:
-		*fourcc = DRM_FORMAT_RGB565;
-		break;
-	case mlc_rgbfmt_b5g6r5:
-		*fourcc = DRM_FORMAT_BGR565;
-		break;
-	case mlc_rgbfmt_r8g8b8:
-	case mlc_rgbfmt_x8r8g8b8:
-		*fourcc = (bpp == 24) ? DRM_FORMAT_RGB888 : DRM_FORMAT_XRGB8888;
-		break;
-	case mlc_rgbfmt_b8g8r8:
-	case mlc_rgbfmt_x8b8g8r8:
-		*fourcc = (bpp == 24) ? DRM_FORMAT_BGR888 : DRM_FORMAT_XBGR8888;
-		break;
-	case mlc_rgbfmt_a8r8g8b8:
-		*fourcc = DRM_FORMAT_ARGB8888;
-		break;
-	case mlc_rgbfmt_a8b8g8r8:
-		*fourcc = DRM_FORMAT_ABGR8888;
-		break;
-	default:
-		fprintf(stderr, "Failed, not support 0x%x format %dbpp\n",
-			format, bpp);
+	if (found < 0) {
+		fprintf(stderr, "no mode %ux%u@%u on connector.%d\n",
+			p->mode_w, p->mode_h, p->mode_hz, c->connector_id);
 		return -EINVAL;
 	}
 
-	return 0;
-}
+	mode = &c->modes[found];
+	p->mode_index = found;
+	p->disp_w = mode->hdisplay;
+	p->disp_h = mode->vdisplay;
+	p->modeset = !active || mode->hdisplay != cur->hdisplay ||
+		     mode->vdisplay != cur->vdisplay ||
+		     mode->vrefresh != cur->vrefresh;
+
+	fprintf(stdout, "mode.%d %s %ux%u@%u%s\n", found, mode->name,
+		mode->hdisplay, mode->vdisplay, mode->vrefresh,
+		p->modeset ? ", set" : "");
 
-static unsigned int format_convert_yuv(unsigned int format,
-				       unsigned int *fourcc)
-{
-	switch (format) {
-	case mlc_yuvfmt_420:
-		*fourcc = DRM_FORMAT_YUV420;
-		break;
-	case mlc_yuvfmt_422:
-		*fourcc = DRM_FORMAT_YUV422;
-		break;
-	case mlc_yuvfmt_444:
-		*fourcc = DRM_FORMAT_YUV444;
-		break;
-	case mlc_yuvfmt_yuyv:
-		*fourcc = DRM_FORMAT_YUYV;
-		break;
-	default:
-		fprintf(stderr, "Failed, not support 0x%x format\n", format);
-		return -EINVAL;
-	}
 	return 0;
 }
 
 static int get_drm_ids(struct op_arg *op, struct device *dev)
 {
 	struct plane_opt *p = &op->plane;
+	struct connector *connector;
+	struct crtc *crtc;
 	int counts = 0;
 	int i;
 
 	p->mode_index = 0;
 
 	/* connector id */
-	for (i = 0; i < (int)dev->resources->res->count_connectors; i++) {
-		drmModeConnector *connector = dev->resources->connectors[i].connector;
-		if (i == op->module) {
-			if (!connector)
-				return -EINVAL;
-
-			p->connector_id = connector->connector_id;
-			p->encoder_id = connector->encoder_id;
-			break;
-		}
+	connector = drm_connector(dev, op->module);
+	if (!connector)
+		return -EINVAL;
 
-	}
+	p->connector_id = connector->connector->connector_id;
+	p->encoder_id = connector->connector->encoder_id;
 
 	/* crtc id */
-	for (i = 0; i < dev->resources->res->count_crtcs; i++) {
-		struct crtc *_crtc = &dev->resources->crtcs[i];
-		drmModeCrtc *crtc = _crtc->crtc;
+	crtc = drm_crtc(dev, op->module);
+	if (!crtc)
+		return -EINVAL;
 
-		if (i == op->module) {
-			if (!crtc)
-				return -EINVAL;
+	p->crtc_id = crtc->crtc->crtc_id;
 
-			p->crtc_id = crtc->crtc_id;
-			break;
-		}
-	}
+	if (select_mode(p, connector, crtc))
+		return -EINVAL;
 
 	if (!dev->resources->plane_res)
 		return -EINVAL;
 
-	/* plane id */
+	/* plane id, the planes are fetched up to the layer's one */
 	for (i = 0; i < (int)dev->resources->plane_res->count_planes; i++) {
-		struct plane *_plane = &dev->resources->planes[i];
-		drmModePlane *plane = _plane->plane;
+		struct plane *plane = drm_plane(dev, i);
+
+		if (!plane)
+			return -EINVAL;
 
-		if (!(plane->possible_crtcs & (1 << op->module)))
+		if (!(plane->plane->possible_crtcs & (1 << op->module)))
 			continue;
 
 		if (counts == (int)op->layer) {
-			if (!plane)
-				return -EINVAL;
-
-			p->plane_id = plane->plane_id;
+			p->plane_id = plane->plane->plane_id;
 			break;
 		}
 		counts++;
@@ -454,7 +511,6 @@ static int format_to_fourcc(struct op_arg *op, struct raw_header *header)
 		format = r->mlccontrol & _maskbit(16, 3);
 		op->hw_format = format;
 		op->bpp = 8;
-		format_convert_yuv(format, &p->fourcc);
 	} else {
 		struct mlcrgblayer *r = &header->mlc.rgb[op->layer];
 
@@ -462,8 +518,8 @@ static int format_to_fourcc(struct op_arg *op, struct raw_header *header)
 		bpp = r->mlchstride * 8;
 		op->hw_format = format;
 		op->bpp = bpp;
-		format_convert_rgb(format, bpp, &p->fourcc);
 	}
+	capture_frame_fourcc(&header->mlc, op->layer, &p->fourcc);
 
 	return 0;
 }
@@ -517,44 +573,90 @@ static int set_plane_rect(struct op_arg *op, struct raw_header *header)
 	return 0;
 }
 
-static int set_mlc_property(struct op_arg *op, struct mlc_reg *reg)
+/* the layer keeps its place and share of the screen on another mode */
+static void map_plane_rect(struct op_arg *op, struct raw_header *header)
 {
-	struct mlc_reg *r = (struct mlc_reg *)op->mem;
-	int i;
+	struct plane_opt *p = &op->plane;
+	unsigned int sw, sh;
+
+	/* no screen size in the capture */
+	if (!header->mlc.mlcscreensize || !p->disp_w || !p->disp_h)
+		return;
+
+	sw = _getbits(header->mlc.mlcscreensize, 0, 12) + 1;
+	sh = _getbits(header->mlc.mlcscreensize, 16, 12) + 1;
+	if (sw == p->disp_w && sh == p->disp_h)
+		return;
+
+	p->crtc_x = p->crtc_x * (int)p->disp_w / (int)sw;
+	p->crtc_y = p->crtc_y * (int)p->disp_h / (int)sh;
+	p->crtc_w = p->crtc_w * p->disp_w / sw;
+	p->crtc_h = p->crtc_h * p->disp_h / sh;
+	if (!p->crtc_w)
+		p->crtc_w = 1;
+	if (!p->crtc_h)
+		p->crtc_h = 1;
+
+	fprintf(stdout, "screen %u x %u -> %u x %u, crtc %d,%d, %u x %u\n",
+		sw, sh, p->disp_w, p->disp_h,
+		p->crtc_x, p->crtc_y, p->crtc_w, p->crtc_h);
+}
 
+/* module wide : priority, background and gamma */
+static void set_mlc_top(struct op_arg *op, struct mlc_reg *reg,
+			struct mlc_writes *w)
+{
 	/* top : priority */
-	writel_bits(reg->mlccontrolt, &r->mlccontrolt, 8, 2);
-	writel(reg->mlcbgcolor, &r->mlcbgcolor);
-
-	/* rgb0/1 : blend, invcolor, tpcolor */
-	for (i = 0; i < 2; i++) {
-		if (!readl_bits(&r->rgb[i].mlccontrol, 5, 1))
-			continue;
-		writel_bits(reg->rgb[i].mlccontrol, &r->rgb[i].mlccontrol, 0, 7);
-		writel(reg->rgb[i].mlctpcolor, &r->rgb[i].mlctpcolor);
-		writel(reg->rgb[i].mlcinvcolor, &r->rgb[i].mlcinvcolor);
-		writel_bits(1, &r->rgb[i].mlccontrol, 4, 1);
-	}
-
-	/* video : blend */
-	if (readl_bits(&r->yuv.mlccontrol, 5, 1)) {
-		writel_bits(reg->yuv.mlccontrol, &r->yuv.mlccontrol, 2, 1);
-		writel(reg->yuv.mlcinvcolor, &r->yuv.mlcinvcolor);
-		writel(reg->yuv.mlcluenh, &r->yuv.mlcluenh);
-		writel(reg->yuv.mlcchenh[0], &r->yuv.mlcchenh[0]);
-		writel(reg->yuv.mlcchenh[1], &r->yuv.mlcchenh[1]);
-		writel(reg->yuv.mlcchenh[2], &r->yuv.mlcchenh[2]);
-		writel(reg->yuv.mlcchenh[3], &r->yuv.mlcchenh[3]);
-		writel_bits(1, &r->yuv.mlccontrol, 4, 1);
-	}
+	hw_reg_write(w, MLC_REG(mlccontrolt), reg->mlccontrolt, 8, 2);
+	hw_reg_write(w, MLC_REG(mlcbgcolor), reg->mlcbgcolor, 0, 32);
 
 	/* gamma */
 	if (op->flags & FLAG_GAMMAN_OFF) {
-		writel(0, &r->mlcgammacont);
-		writel_bits(1, &r->mlccontrolt, 3, 1);
+		hw_reg_write(w, MLC_REG(mlcgammacont), 0, 0, 32);
+		hw_reg_dirty(w, MLC_REG(mlccontrolt), 3);
 	}
+}
 
-	return 0;
+/* per layer : blend, invcolor, tpcolor of an enabled layer */
+static void set_mlc_layer(struct op_arg *op, struct mlc_reg *reg,
+			  enum mlc_layer layer, struct mlc_writes *w)
+{
+	/* the module the writes are applied to */
+	struct mlc_reg *r = hw_reg_get_mem(op->module);
+	int i = layer;
+
+	if (!r)
+		return;
+
+	switch (layer) {
+	case mlc_layer_rgb0:
+	case mlc_layer_rgb1:
+		if (!readl_bits(&r->rgb[i].mlccontrol, 5, 1))
+			break;
+		hw_reg_write(w, MLC_REG(rgb[i].mlccontrol),
+			     reg->rgb[i].mlccontrol, 0, 7);
+		hw_reg_write(w, MLC_REG(rgb[i].mlctpcolor),
+			     reg->rgb[i].mlctpcolor, 0, 32);
+		hw_reg_write(w, MLC_REG(rgb[i].mlcinvcolor),
+			     reg->rgb[i].mlcinvcolor, 0, 32);
+		hw_reg_dirty(w, MLC_REG(rgb[i].mlccontrol), 4);
+		break;
+	case mlc_layer_video:
+		if (!readl_bits(&r->yuv.mlccontrol, 5, 1))
+			break;
+		hw_reg_write(w, MLC_REG(yuv.mlccontrol),
+			     reg->yuv.mlccontrol, 2, 1);
+		hw_reg_write(w, MLC_REG(yuv.mlcinvcolor),
+			     reg->yuv.mlcinvcolor, 0, 32);
+		hw_reg_write(w, MLC_REG(yuv.mlcluenh), reg->yuv.mlcluenh, 0, 32);
+		for (i = 0; i < 4; i++)
+			hw_reg_write(w, MLC_REG(yuv.mlcchenh[i]),
+				     reg->yuv.mlcchenh[i], 0, 32);
+		hw_reg_dirty(w, MLC_REG(yuv.mlccontrol), 4);
+		break;
+	case mlc_layer_unknown:
+		break;
+	}
 }
 
 static int set_plane_image(struct op_arg *op, struct raw_header *header)
@@ -592,7 +694,7 @@ static int drm_set_crtc(struct device *dev, struct plane_opt *p,
 	drmModeModeInfo *mode = find_crtc_and_mode(dev,
 						   p->connector_id, p->mode_index, 0);
 
-	if (p->encoder_id == 0) {
+	if (p->modeset) {
 		fprintf(stdout, "set crtc.%d. connector.%d\n",
 			crtc->crtc->crtc_id, p->connector_id);
 
@@ -609,17 +711,351 @@ static int drm_set_crtc(struct device *dev, struct plane_opt *p,
 	return 0;
 }
 
+static int drm_atomic_add_plane(struct device *dev, struct plane_opt *p,
+				unsigned int fb_id, bool full)
+{
+	int ret = 0;
+
+	ret |= drm_atomic_add_property(dev, p->plane_id, "FB_ID", fb_id);
+	if (!full)
+		return ret;
+
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "CRTC_ID", p->crtc_id);
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "SRC_X", p->src_x << 16);
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "SRC_Y", p->src_y << 16);
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "SRC_W", p->src_w << 16);
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "SRC_H", p->src_h << 16);
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "CRTC_X", p->crtc_x);
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "CRTC_Y", p->crtc_y);
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "CRTC_W", p->crtc_w);
+	ret |= drm_atomic_add_property(dev, p->plane_id,
+				       "CRTC_H", p->crtc_h);
+
+	return ret;
+}
+
+/* a new request with the planes, and the mode when it is to be set */
+static int drm_atomic_request(struct device *dev, struct plane_opt **planes,
+			      const unsigned int *fb_ids, int count, bool full,
+			      uint32_t *blob_id, uint32_t *flags)
+{
+	struct plane_opt *p = planes[0];
+	drmModeModeInfo *mode;
+	int i, ret = 0;
+
+	dev->req = drmModeAtomicAlloc();
+	if (!dev->req)
+		return -ENOMEM;
+
+	if (full && p->modeset) {
+		mode = find_crtc_and_mode(dev, p->connector_id,
+					  p->mode_index, 0);
+		if (!mode)
+			return -EINVAL;
+
+		ret = drmModeCreatePropertyBlob(dev->fd, mode, sizeof(*mode),
+						blob_id);
+		if (ret) {
+			fprintf(stderr, "failed to create mode blob: %s\n",
+				strerror(errno));
+			return ret;
+		}
+
+		ret |= drm_atomic_add_property(dev, p->connector_id,
+					       "CRTC_ID", p->crtc_id);
+		ret |= drm_atomic_add_property(dev, p->crtc_id,
+					       "MODE_ID", *blob_id);
+		ret |= drm_atomic_add_property(dev, p->crtc_id, "ACTIVE", 1);
+		*flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	for (i = 0; i < count; i++)
+		ret |= drm_atomic_add_plane(dev, planes[i], fb_ids[i], full);
+
+	if (ret < 0) {
+		fprintf(stderr, "failed to add atomic properties\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+static void drm_atomic_release(struct device *dev, uint32_t blob_id)
+{
+	if (blob_id)
+		drmModeDestroyPropertyBlob(dev->fd, blob_id);
+
+	drmModeAtomicFree(dev->req);
+	dev->req = NULL;
+}
+
+/* whether the full state of the planes would be taken, nothing is changed */
+static int drm_atomic_test(struct device *dev, struct plane_opt **planes,
+			   const unsigned int *fb_ids, int count)
+{
+	uint32_t blob_id = 0;
+	uint32_t flags = DRM_MODE_ATOMIC_TEST_ONLY;
+	int ret;
+
+	ret = drm_atomic_request(dev, planes, fb_ids, count, true,
+				 &blob_id, &flags);
+	if (!ret)
+		ret = drmModeAtomicCommit(dev->fd, dev->req, flags, NULL);
+
+	drm_atomic_release(dev, blob_id);
+
+	return ret;
+}
+
+/*
+ * Commit the state of the planes of one CRTC in one atomic request. The
+ * full state (and the mode, when it is to be set) is validated with a
+ * test-only commit first; a flip only changes the framebuffers. The
+ * commit is nonblocking when an out-fence or an event can track its
+ * completion.
+ */
+static int drm_atomic_planes(struct device *dev, struct plane_opt **planes,
+			     const unsigned int *fb_ids, int count, bool full,
+			     int *fence, void *event)
+{
+	struct plane_opt *p = planes[0];
+	uint32_t blob_id = 0;
+	uint32_t flags = 0;
+	int ret;
+
+	ret = drm_atomic_request(dev, planes, fb_ids, count, full,
+				 &blob_id, &flags);
+	if (ret)
+		goto __exit_atomic;
+
+	if (full) {
+		ret = drmModeAtomicCommit(dev->fd, dev->req,
+					  flags | DRM_MODE_ATOMIC_TEST_ONLY,
+					  NULL);
+		if (ret) {
+			fprintf(stderr, "atomic test commit failed: %s\n",
+				strerror(errno));
+			goto __exit_atomic;
+		}
+	}
+
+	if (fence) {
+		*fence = -1;
+		if (drm_atomic_add_property(dev, p->crtc_id, "OUT_FENCE_PTR",
+					    (uint64_t)(uintptr_t)fence) < 0)
+			fence = NULL;
+	}
+
+	if (fence || event)
+		flags |= DRM_MODE_ATOMIC_NONBLOCK;
+	if (event)
+		flags |= DRM_MODE_PAGE_FLIP_EVENT;
+
+	ret = drmModeAtomicCommit(dev->fd, dev->req, flags, event);
+	if (ret)
+		fprintf(stderr, "atomic commit failed: %s\n", strerror(errno));
+
+__exit_atomic:
+	drm_atomic_release(dev, blob_id);
+
+	return ret;
+}
+
+static int drm_atomic_plane(struct device *dev, struct plane_opt *p,
+			    unsigned int fb_id, bool full, int *fence,
+			    void *event)
+{
+	return drm_atomic_planes(dev, &p, &fb_id, 1, full, fence, event);
+}
+
+static int drm_wait_fence(int fence, int timeout)
+{
+	struct pollfd fds = { .fd = fence, .events = POLLIN };
+	int ret;
+
+	if (fence < 0)
+		return 0;
+
+	ret = poll(&fds, 1, timeout);
+	close(fence);
+
+	return ret == 1 ? 0 : -ETIMEDOUT;
+}
+
+/*
+ * Whether the plane takes the source to the crtc rect in hardware, tried
+ * in an atomic test with a blank framebuffer. Legacy kms has no test but
+ * a real set plane, which would flash the blank one on the display, so
+ * its planes are taken not to scale.
+ */
+static bool drm_plane_scales(struct device *dev, struct plane_opt *p)
+{
+	unsigned int handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	void *planes[3];
+	unsigned int fb_id = 0;
+	struct bo *bo;
+	int ret;
+
+	if (p->src_w == p->crtc_w && p->src_h == p->crtc_h)
+		return true;
+
+	if (!p->plane_id)
+		return true;
+	if (!dev->use_atomic)
+		return false;
+
+	bo = util_bo_create(dev->fd, UTIL_BO_DUMB, p->fourcc,
+			    p->src_w, p->src_h, handles, pitches, offsets,
+			    planes);
+	if (!bo)
+		return true;
+
+	ret = drmModeAddFB2(dev->fd, p->src_w, p->src_h, p->fourcc,
+			    handles, pitches, offsets, &fb_id, 0);
+	if (ret)
+		goto __exit_scales;
+
+	ret = drm_atomic_test(dev, &p, &fb_id, 1);
+
+	drmModeRmFB(dev->fd, fb_id);
+
+__exit_scales:
+	bo_destroy(bo);
+
+	return !ret;
+}
+
+/* the captured image is scaled to the source size from the scratch */
+static int plane_load_scaled(struct plane_opt *p, struct perf *perf,
+			     int fd, off_t offset,
+			     void *planes[3], unsigned int pitches[4])
+{
+	int ret;
+
+	perf_begin(perf, perf_stage_load);
+	ret = util_load_image_fd(fd, p->fourcc, p->scratch_planes,
+				 p->image_w, p->image_h, p->scratch_pitches,
+				 offset);
+	perf_end(perf, perf_stage_load);
+	if (ret)
+		return ret;
+
+	perf_begin(perf, perf_stage_convert);
+	ret = util_scale_image(p->fourcc,
+			       p->scratch_planes, p->scratch_pitches,
+			       p->image_w, p->image_h,
+			       planes, pitches, p->src_w, p->src_h);
+	perf_end(perf, perf_stage_convert);
+
+	return ret;
+}
+
+static struct bo *plane_bo_create_scaled(struct device *dev,
+					 struct plane_opt *p,
+					 unsigned int handles[4],
+					 unsigned int pitches[4],
+					 unsigned int offsets[4])
+{
+	void *planes[3] = { 0, };
+	struct bo *bo;
+	int fd, ret;
+
+	fd = open(p->image.file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error file %s\n", p->image.file);
+		return NULL;
+	}
+
+	p->scratch = util_image_alloc(p->fourcc, p->image_w, p->image_h,
+				      p->scratch_planes, p->scratch_pitches);
+	bo = util_bo_create(dev->fd, UTIL_BO_DUMB, p->fourcc,
+			    p->src_w, p->src_h, handles, pitches, offsets,
+			    planes);
+	ret = p->scratch && bo ?
+	      plane_load_scaled(p, NULL, fd, p->image.offset,
+				planes, pitches) :
+	      -ENOMEM;
+	if (ret) {
+		fprintf(stderr, "failed to scale %s\n", p->image.file);
+		if (bo)
+			bo_destroy(bo);
+		bo = NULL;
+	} else {
+		bo_unmap(bo);
+	}
+
+	free(p->scratch);
+	p->scratch = NULL;
+	close(fd);
+
+	return bo;
+}
+
+/* loads the image to a new framebuffer, the frame pool has already its own */
+static int drm_plane_fb(struct device *dev, struct plane_opt *p)
+{
+	unsigned int handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	uint64_t ts;
+	int ret;
+
+	if (p->fb_id)
+		return 0;
+
+	if (p->sw_scale)
+		p->bo = plane_bo_create_scaled(dev, p, handles, pitches,
+					       offsets);
+	else
+		p->bo = util_bo_create_image(dev->fd, p->bo_type, p->fourcc,
+					     p->src_w, p->src_h, handles,
+					     pitches, offsets, &p->image);
+	if (p->bo == NULL)
+		goto __exit_fb;
+
+	/* just use single plane format for now.. */
+	ts = timeline_begin();
+	ret = drmModeAddFB2(dev->fd, p->src_w, p->src_h, p->fourcc,
+			    handles, pitches, offsets, &p->fb_id, 0);
+	timeline_end("drm", "fb add", ts);
+	if (ret) {
+		fprintf(stderr, "failed to add fb: %s\n", strerror(errno));
+		bo_destroy(p->bo);
+		p->bo = NULL;
+		p->fb_id = 0;
+		goto __exit_fb;
+	}
+
+	return 0;
+
+__exit_fb:
+	/* the driver can't scan out a udmabuf, copy to a dumb buffer */
+	if (p->bo_type == UTIL_BO_UDMABUF) {
+		fprintf(stderr, "no zero copy, fall back to dumb buffer\n");
+		p->bo_type = UTIL_BO_DUMB;
+		return drm_plane_fb(dev, p);
+	}
+
+	return -1;
+}
+
 static int drm_set_plane(struct device *dev, struct plane_opt *p)
 {
 	drmModePlane *ovr = NULL;
-	unsigned int handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	struct plane *plane;
 	unsigned int plane_id;
-	struct bo *plane_bo;
 	unsigned int plane_flags = 0;
 	int crtc_x, crtc_y, crtc_w, crtc_h;
 	struct crtc *crtc = NULL;
 	unsigned int pipe;
 	unsigned int i;
+	uint64_t ts;
 	int ret;
 
 	/* Find an unused plane which can be connected to our CRTC. Find the
@@ -627,7 +1063,7 @@ static int drm_set_plane(struct device *dev, struct plane_opt *p)
 	 */
 	for (i = 0; i < (unsigned int)dev->resources->res->count_crtcs; i++)
 		if (p->crtc_id == dev->resources->res->crtcs[i]) {
-			crtc = &dev->resources->crtcs[i];
+			crtc = drm_crtc(dev, i);
 			pipe = i;
 			break;
 		}
@@ -640,13 +1076,15 @@ static int drm_set_plane(struct device *dev, struct plane_opt *p)
 	plane_id = p->plane_id;
 
 	for (i = 0; i < dev->resources->plane_res->count_planes; i++) {
-		ovr = dev->resources->planes[i].plane;
-		if (!ovr)
+		if (plane_id && plane_id != dev->resources->plane_res->planes[i])
 			continue;
 
-		if (plane_id && (plane_id != ovr->plane_id))
+		plane = drm_plane(dev, i);
+		if (!plane)
 			continue;
 
+		ovr = plane->plane;
+
 		if (!drm_format_support(ovr, p->fourcc))
 			continue;
 
@@ -667,20 +1105,9 @@ static int drm_set_plane(struct device *dev, struct plane_opt *p)
 		p->src_x, p->src_y, p->src_w, p->src_h,
 		util_format_name(p->fourcc), plane_id);
 
-	plane_bo = util_bo_create_image(dev->fd, p->fourcc, p->src_w, p->src_h,
-					handles,
-					pitches, offsets, &p->image);
-	if (plane_bo == NULL)
-		return -1;
-
-	p->bo = plane_bo;
-
-	/* just use single plane format for now.. */
-	if (drmModeAddFB2(dev->fd, p->src_w, p->src_h, p->fourcc,
-			  handles, pitches, offsets, &p->fb_id, plane_flags)) {
-		fprintf(stderr, "failed to add fb: %s\n", strerror(errno));
-		return -1;
-	}
+	ret = drm_plane_fb(dev, p);
+	if (ret)
+		return ret;
 
 	crtc_x = p->crtc_x;
 	crtc_y = p->crtc_y;
@@ -691,6 +1118,30 @@ static int drm_set_plane(struct device *dev, struct plane_opt *p)
 	       crtc_x, crtc_y, crtc_w, crtc_h,
 	       p->src_x, p->src_y, p->src_w, p->src_h);
 
+	if (dev->use_atomic) {
+		uint64_t start = time_us();
+		int fence = -1;
+
+		p->plane_id = plane_id;
+		ts = timeline_begin();
+		ret = drm_atomic_plane(dev, p, p->fb_id, true, &fence, NULL);
+		timeline_end("drm", "plane set", ts);
+		if (ret)
+			return -1;
+
+		/* the layer must be on before the mlc properties */
+		ret = drm_wait_fence(fence, 1000);
+		if (ret)
+			fprintf(stderr, "atomic commit fence timeout\n");
+		else
+			fprintf(stdout, "atomic commit done %dus\n",
+				(int)(time_us() - start));
+
+		ovr->crtc_id = crtc->crtc->crtc_id;
+
+		return 0;
+	}
+
 	ret = drm_set_crtc(dev, p, crtc);
 	if (ret) {
 		fprintf(stderr, "failed to set crt !!!\n");
@@ -698,102 +1149,86 @@ static int drm_set_plane(struct device *dev, struct plane_opt *p)
 	}
 
 	/* note src coords (last 4 args) are in Q16 format */
-	if (drmModeSetPlane(dev->fd, plane_id, crtc->crtc->crtc_id, p->fb_id,
-			    plane_flags, crtc_x, crtc_y, crtc_w, crtc_h,
-			    0, 0, p->src_w << 16, p->src_h << 16)) {
+	ts = timeline_begin();
+	ret = drmModeSetPlane(dev->fd, plane_id, crtc->crtc->crtc_id, p->fb_id,
+			      plane_flags, crtc_x, crtc_y, crtc_w, crtc_h,
+			      0, 0, p->src_w << 16, p->src_h << 16);
+	timeline_end("drm", "plane set", ts);
+	if (ret) {
 		fprintf(stderr, "failed to enable plane: %s\n",
 			strerror(errno));
 		return -1;
 	}
 
 	ovr->crtc_id = crtc->crtc->crtc_id;
+	p->plane_id = plane_id;
 
 	return 0;
 }
 
 static void drm_clear_plane(struct device *dev, struct plane_opt *p)
 {
+	int ret = 0;
+
+	/* take the plane off the screen before its framebuffer is gone */
+	if (p->plane_id && dev->use_atomic) {
+		dev->req = drmModeAtomicAlloc();
+		if (dev->req) {
+			ret |= drm_atomic_add_property(dev, p->plane_id,
+						       "FB_ID", 0);
+			ret |= drm_atomic_add_property(dev, p->plane_id,
+						       "CRTC_ID", 0);
+			if (ret >= 0)
+				ret = drmModeAtomicCommit(dev->fd, dev->req,
+							  0, NULL);
+			drmModeAtomicFree(dev->req);
+			dev->req = NULL;
+		}
+	} else if (p->plane_id) {
+		ret = drmModeSetPlane(dev->fd, p->plane_id, p->crtc_id,
+				      0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	}
+
+	/* a primary plane may not be disabled, removing the fb does */
+	if (ret)
+		fprintf(stderr, "plane.%d is not disabled: %s\n",
+			p->plane_id, strerror(errno));
+
 	if (p->fb_id)
 		drmModeRmFB(dev->fd, p->fb_id);
 
 	if (p->bo)
-		bo_destroy_dumb(p->bo);
+		bo_destroy(p->bo);
 }
 
-static int raw_capture_rgb(struct op_arg *op, struct mlcrgblayer *reg)
+static void raw_print_rgb(struct op_arg *op, const struct mlcrgblayer *reg,
+			  const struct capture_frame *f)
 {
-	FILE *fp = op->fp;
-	const char *mode = op->mode == op_mode_capture ? "ab" : "rb";
-	void *addr, *mem, *mapped = NULL;
-	int x, y, width, height, linestride, size;
-	unsigned int format;
-	int bpp, i;
-
-	if ((fp == NULL) || (reg == NULL))
-		return -EINVAL;
-
-	fp = fopen(op->file, mode);
+	unsigned int format = reg->mlccontrol & _maskbit(16, 16);
+	int x, y, width, height, bpp;
 
-	addr = (void *)reg->mlcaddress;
-	format = reg->mlccontrol & _maskbit(16, 16);
 	width = _getbits(reg->mlcleftright, 0, 11) -
 		_getbits(reg->mlcleftright, 16, 11) + 1;
 	height = _getbits(reg->mlctopbottom, 0, 11) -
 		 _getbits(reg->mlctopbottom, 16, 11) + 1;
 	x = _getbits(reg->mlcleftright, 16, 12);
 	y = _getbits(reg->mlctopbottom, 16, 12);
-
-	linestride = reg->mlcvstride;
-	size = linestride * height;
 	bpp = reg->mlchstride * 8;
 
 	fprintf(stdout,
 		"get mlc.%d, rgb.%d %s(0x%x), %d,%d, %d x %d, line: %d, size: %dbyte\n",
 		op->module, op->layer, hw_format_name(format, bpp),
-		format, x, y, width, height, linestride, size);
-
-	mem = iomem_map(addr, size, mapped);
-	if (mem == NULL) {
-		fprintf(stderr, "Fail, module %d, map %p\n",
-			op->module, addr);
-		goto __exit_rgb;
-	}
-
-	fprintf(stdout, "- map %p -> %p %dbyte\n", addr, mem, size);
-
-	for (i = 0; i < height; i++) {
-		fwrite(mem, 1, linestride, fp);
-		mem += linestride;
-	}
-
-__exit_rgb:
-	iomem_free(mapped, size);
-	fclose(fp);
-
-	return 0;
+		format, x, y, width, height, reg->mlcvstride, (int)f->size);
 }
 
-static int raw_caputre_yuv(struct op_arg *op, struct mlcyuvlayer *reg)
+static void raw_print_yuv(struct op_arg *op, const struct mlcyuvlayer *reg,
+			  const struct capture_frame *f)
 {
-	FILE *fp = op->fp;
-	void *addr, *mem[3] = { NULL, }, *mapped[3] = { NULL, };
-	int x, y, width, height, stride, size[3] = { 0, };
-	unsigned int format;
-	int div = 1, i, ret;
-
-	if ((fp == NULL) || (reg == NULL))
-		return -EINVAL;
+	unsigned int format = reg->mlccontrol & _maskbit(16, 3);
+	int x, y, width, height, i;
 
-	fp = fopen(op->file, "ab");
-
-	format = reg->mlccontrol & _maskbit(16, 3);
 	/* Note. get width with stride for the aligned image */
-#if 0
-	width = _getbits(reg->mlcleftright, 0, 11) -
-		_getbits(reg->mlcleftright, 16, 11) + 1;
-#endif
-	div = format == mlc_yuvfmt_yuyv ? 2 : 1;
-	width = reg->mlcvstride / div;
+	width = reg->mlcvstride / (format == mlc_yuvfmt_yuyv ? 2 : 1);
 	/* Note. get width with scale factor */
 	height = _getbits(reg->mlctopbottom, 0, 11) - _getbits(reg->mlctopbottom, 16, 11) + 1;
 	height = _getbits(reg->mlcvscale, 0, 23) * height / MLC_YUV_SCALE_CONSTANT;
@@ -813,61 +1248,88 @@ static int raw_caputre_yuv(struct op_arg *op, struct mlcyuvlayer *reg)
 		_getbits(reg->mlchscale, 0, 23),
 		_getbits(reg->mlcvscale, 0, 23));
 
-	for (i = 0, div = 1; i < 3; i++, div = 1) {
-		int n;
-
-		if (i == 0) {
-			addr = (void *)reg->mlcaddress;
-			stride = reg->mlcvstride;
-		} else if (i == 1) {
-			addr = (void *)reg->mlcaddresscb;
-			stride = reg->mlcvstridecb;
-			if (format == mlc_yuvfmt_420)
-				div = 2;
-		} else {
-			addr = (void *)reg->mlcaddresscr;
-			stride = reg->mlcvstridecr;
-			if (format == mlc_yuvfmt_420)
-				div = 2;
-		}
-		size[i] = stride * (height / div);
-
+	for (i = 0; i < f->planes; i++)
 		fprintf(stdout, "[%d] line %d x height %d (%dbyte)\n",
-			i, stride, height / div, size[i]);
+			i, f->strides[i],
+			f->strides[i] ? (int)(f->sizes[i] / f->strides[i]) : 0,
+			(int)f->sizes[i]);
+}
 
-		mem[i] = iomem_map(addr, size[i], mapped[i]);
-		if (mem[i] == NULL) {
-			fprintf(stderr, "Fail, module %d, map %p\n",
-				op->module, addr);
-			ret = -EINVAL;
-			goto __exit;
-		}
-		fprintf(stdout, "- map %p -> %p %dbyte\n", addr, mem[i],
-			size[i]);
+static int raw_write(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
 
-		for (n = 0; n < (height / div); n++) {
-			fwrite(mem[i], 1, stride, fp);
-			mem[i] += stride;
-		}
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		buf += n;
+		len -= n;
+	}
 
-		if (format == mlc_yuvfmt_yuyv)
-			goto __exit;
+	return 0;
+}
+
+/*
+ * A frame of the layer to the end of the capture, copied by the capture
+ * library on the copy threads, or streamed through its chunk.
+ */
+static int raw_capture_frame(struct op_arg *op, struct capture_module *m,
+			     int fd, const struct mlc_reg *reg)
+{
+	struct capture_frame f;
+	void *staging;
+	ssize_t n;
+	uint64_t ts;
+	int ret;
+
+	ret = capture_frame_layout(reg, op->layer, &f);
+	if (ret < 0)
+		return ret;
+
+	if (op->layer == mlc_layer_video)
+		raw_print_yuv(op, &reg->yuv, &f);
+	else
+		raw_print_rgb(op, &reg->rgb[op->layer], &f);
+
+	if (f.size > op->staging_size && !op->stream) {
+		staging = realloc(op->staging, f.size);
+		if (!staging)
+			return -ENOMEM;
+		op->staging = staging;
+		op->staging_size = f.size;
 	}
 
-__exit:
-	for (i = 0; i < 3; i++)
-		iomem_free(mapped[i], size[i]);
+	perf_begin(op->perf, perf_stage_capture);
 
-	fclose(fp);
+	if (op->stream) {
+		n = capture_layer_stream(m, &f, op->stream, fd);
+	} else {
+		n = capture_layer(m, &f, op->pool, op->staging,
+				  op->staging_size);
+		if (n > 0) {
+			ts = timeline_begin();
+			ret = raw_write(fd, op->staging, n);
+			timeline_end("capture", "write", ts);
+			if (ret)
+				n = ret;
+		}
+	}
 
-	return ret;
+	perf_end(op->perf, perf_stage_capture);
+
+	return n < 0 ? n : 0;
 }
 
 static int raw_image_header(struct op_arg *op, struct raw_header *header)
 {
 	const char sign[4] = RAW_HEADER_SIGN;
 	const char *mode = op->mode == op_mode_capture ? "wb" : "rb";
+	struct mlc_snapshot stat;
 	FILE *fp = NULL;
+	uint64_t ts;
 
 	fp = fopen(op->file, mode);
 	if (!fp) {
@@ -884,134 +1346,2695 @@ static int raw_image_header(struct op_arg *op, struct raw_header *header)
 		header->sign[2] = sign[2];
 		header->sign[3] = sign[3];
 
-		header->module = op->module;
-		header->layer = op->layer;
+		header->module = op->module;
+		header->layer = op->layer;
+
+		ts = timeline_begin();
+		if (hw_reg_snapshot(op->module, &header->mlc, &stat))
+			fprintf(stderr, "mlc.%d layout still changing\n",
+				op->module);
+		timeline_end("capture", "snapshot", ts);
+		fprintf(stdout, "register snapshot %u reads, %d retries, %lldns\n",
+			stat.reads, stat.retries, stat.ns);
+
+		ts = timeline_begin();
+		fwrite((void *)header, 1, RAW_HEADER_SIZE, fp);
+		timeline_end("capture", "header", ts);
+	} else {
+		fread((void *)header, 1, RAW_HEADER_SIZE, fp);
+		if (strncmp(header->sign, sign, 4)) {
+			fprintf(stderr, "Not found signature !!!\n");
+			return -EINVAL;
+		}
+		op->module = header->module;
+		op->layer = header->layer;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static int raw_image_header_update(struct op_arg *op,
+				   struct raw_header *header)
+{
+	FILE *fp;
+
+	fp = fopen(op->file, "r+b");
+	if (!fp) {
+		fprintf(stderr, "Error file %s\n", op->file);
+		perror("- error");
+		return -errno;
+	}
+
+	fwrite((void *)header, 1, RAW_HEADER_SIZE, fp);
+	fclose(fp);
+
+	return 0;
+}
+
+/* a multi-frame capture needs the same layout on every frame */
+static bool raw_same_layout(struct op_arg *op, struct mlc_reg *a,
+			    struct mlc_reg *b)
+{
+	if (op->layer == mlc_layer_video)
+		return a->yuv.mlcleftright == b->yuv.mlcleftright &&
+		       a->yuv.mlctopbottom == b->yuv.mlctopbottom &&
+		       a->yuv.mlccontrol == b->yuv.mlccontrol &&
+		       a->yuv.mlcvstride == b->yuv.mlcvstride &&
+		       a->yuv.mlcvstridecb == b->yuv.mlcvstridecb &&
+		       a->yuv.mlcvstridecr == b->yuv.mlcvstridecr &&
+		       a->yuv.mlcvscale == b->yuv.mlcvscale;
+
+	return a->rgb[op->layer].mlcleftright == b->rgb[op->layer].mlcleftright &&
+	       a->rgb[op->layer].mlctopbottom == b->rgb[op->layer].mlctopbottom &&
+	       a->rgb[op->layer].mlccontrol == b->rgb[op->layer].mlccontrol &&
+	       a->rgb[op->layer].mlchstride == b->rgb[op->layer].mlchstride &&
+	       a->rgb[op->layer].mlcvstride == b->rgb[op->layer].mlcvstride;
+}
+
+static int capture_device(struct op_arg *op)
+{
+	struct raw_header *header;
+	struct mlc_reg reg;
+	struct mlc_snapshot stat;
+	unsigned int frames = op->frames ? op->frames : 1;
+	struct ticker *ticker = NULL;
+	uint64_t start = 0, last = 0;
+	long long snapshot_max = 0;
+	struct capture_module *m;
+	struct capture_frame f;
+	unsigned int n, rate = 0, unstable = 0;
+	int fd = -1, ret, err;
+
+	if (op->every) {
+		/* -n frames, for -t msec or until a signal */
+		if (!op->frames)
+			frames = op->replay.duration ?
+				 op->replay.duration / op->every : UINT_MAX;
+		if (!frames)
+			frames = 1;
+
+		/* not real time, the deadlines would not mean much */
+		if (op->rt_prio || op->cpu >= 0 || op->mlock) {
+			ret = ticker_realtime(op->rt_prio, op->cpu, op->mlock);
+			if (ret) {
+				fprintf(stderr, "Fail, no real time capture\n");
+				return ret;
+			}
+		}
+
+		ticker = ticker_create((uint64_t)op->every * 1000000ull);
+		if (!ticker)
+			return -EINVAL;
+	}
+
+	m = capture_open(op->module);
+	header = (struct raw_header *)malloc(RAW_HEADER_SIZE);
+	if (!m || !header) {
+		fprintf(stderr, "memory allocation failed\n");
+		ret = -ENOMEM;
+		goto __exit_capture;
+	}
+	memset(header, 0, RAW_HEADER_SIZE);
+
+	ret = raw_image_header(op, header);
+	if (ret)
+		goto __exit_capture;
+
+	reg = header->mlc;
+
+	fd = open(op->file, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd < 0) {
+		ret = -errno;
+		fprintf(stderr, "Error file %s: %s\n", op->file,
+			strerror(errno));
+		goto __exit_capture;
+	}
+
+	for (n = 0; n < frames; n++) {
+		if (ticker) {
+			/* a signal ends the capture with the frames so far */
+			ret = ticker_wait(ticker);
+			if (ret) {
+				if (ret == -EINTR)
+					ret = 0;
+				break;
+			}
+		}
+
+		if (n) {
+			if (capture_snapshot(m, &reg, &stat))
+				unstable++;
+			if (stat.ns > snapshot_max)
+				snapshot_max = stat.ns;
+			if (!raw_same_layout(op, &header->mlc, &reg)) {
+				fprintf(stderr,
+					"layer layout changed, stop at frame %u\n", n);
+				break;
+			}
+		}
+
+		last = time_us();
+		if (!n)
+			start = last;
+
+		ret = raw_capture_frame(op, m, fd, &reg);
+		if (ret)
+			break;
+	}
+
+	/* the part of a failed frame goes, the full ones stay */
+	if (ret && capture_frame_layout(&header->mlc, op->layer, &f) >= 0 &&
+	    ftruncate(fd, RAW_HEADER_SIZE + (off_t)n * f.size))
+		fprintf(stderr, "Fail, %s keeps a partial frame: %s\n",
+			op->file, strerror(errno));
+
+	if (n > 1) {
+		if (last > start)
+			rate = (uint64_t)(n - 1) * 1000000000ull /
+			       (last - start);
+		header->frames = n;
+		/* only paced frames have a rate to replay them at */
+		if (ticker)
+			header->frame_rate = rate;
+
+		fprintf(stdout, "captured %u frames, %u.%03u fps\n",
+			header->frames, rate / 1000, rate % 1000);
+		fprintf(stdout,
+			"register snapshot max %lldns, %u with a changing layout\n",
+			snapshot_max, unstable);
+
+		err = raw_image_header_update(op, header);
+		if (!ret)
+			ret = err;
+	}
+	ticker_report(ticker, stdout);
+
+__exit_capture:
+	if (fd >= 0)
+		close(fd);
+	ticker_destroy(ticker);
+	free(header);
+	capture_close(m);
+
+	return ret;
+}
+
+/* the planes of a frame in the capture, returns the plane count */
+static int raw_plane_sizes(struct op_arg *op, struct raw_header *header,
+			   size_t sizes[3], uint32_t addrs[3])
+{
+	struct capture_frame f;
+	int n;
+
+	n = capture_frame_layout(&header->mlc, op->layer, &f);
+	if (n < 0)
+		return 0;
+
+	memcpy(sizes, f.sizes, sizeof(f.sizes));
+	memcpy(addrs, f.addrs, sizeof(f.addrs));
+
+	return n;
+}
+
+static size_t raw_frame_size(struct op_arg *op, struct raw_header *header)
+{
+	struct capture_frame f;
+
+	if (capture_frame_layout(&header->mlc, op->layer, &f) < 0)
+		return 0;
+
+	return f.size;
+}
+
+static int replay_frame_count(struct op_arg *op, struct raw_header *header)
+{
+	struct replay_opt *r = &op->replay;
+	struct stat st;
+
+	r->frame_size = raw_frame_size(op, header);
+	if (!r->frame_size)
+		return -EINVAL;
+
+	if (stat(op->file, &st))
+		return -errno;
+
+	r->frames = header->frames;
+	if (!r->frames)
+		r->frames = (st.st_size - RAW_HEADER_SIZE) / r->frame_size;
+
+	if (!r->frames) {
+		fprintf(stderr, "no frame in %s\n", op->file);
+		return -EINVAL;
+	}
+
+	if (r->start >= r->frames) {
+		fprintf(stderr, "seek frame %u over %u frames\n",
+			r->start, r->frames);
+		return -EINVAL;
+	}
+
+	if (!r->rate)
+		r->rate = header->frame_rate / 1000.0;
+
+	return 0;
+}
+
+static void frame_pool_destroy(struct device *dev, struct plane_opt *p)
+{
+	int i;
+
+	for (i = 0; i < FRAME_POOL_SIZE; i++) {
+		struct frame_buffer *fb = &p->pool[i];
+
+		if (fb->fb_id)
+			drmModeRmFB(dev->fd, fb->fb_id);
+
+		if (fb->bo)
+			bo_destroy(fb->bo);
+
+		memset(fb, 0, sizeof(*fb));
+	}
+
+	free(p->scratch);
+	p->scratch = NULL;
+}
+
+static int frame_pool_create(struct device *dev, struct plane_opt *p)
+{
+	int i;
+
+	/* the loader thread reads the frames to scale in there */
+	if (p->sw_scale) {
+		p->scratch = util_image_alloc(p->fourcc, p->image_w,
+					      p->image_h, p->scratch_planes,
+					      p->scratch_pitches);
+		if (!p->scratch)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < FRAME_POOL_SIZE; i++) {
+		struct frame_buffer *fb = &p->pool[i];
+		uint64_t ts;
+		int ret;
+
+		fb->bo = util_bo_create(dev->fd, p->bo_type, p->fourcc,
+					p->src_w, p->src_h, fb->handles,
+					fb->pitches, fb->offsets, fb->planes);
+		if (!fb->bo)
+			goto __exit_pool;
+
+		ts = timeline_begin();
+		ret = drmModeAddFB2(dev->fd, p->src_w, p->src_h, p->fourcc,
+				    fb->handles, fb->pitches, fb->offsets,
+				    &fb->fb_id, 0);
+		timeline_end("drm", "fb add", ts);
+		if (ret) {
+			fprintf(stderr, "failed to add fb: %s\n",
+				strerror(errno));
+			goto __exit_pool;
+		}
+	}
+
+	return 0;
+
+__exit_pool:
+	frame_pool_destroy(dev, p);
+
+	if (p->bo_type == UTIL_BO_UDMABUF) {
+		fprintf(stderr, "no zero copy, fall back to dumb buffers\n");
+		p->bo_type = UTIL_BO_DUMB;
+		return frame_pool_create(dev, p);
+	}
+
+	return -EINVAL;
+}
+
+static int frame_pool_load(struct op_arg *op, struct frame_buffer *fb,
+			   unsigned int frame)
+{
+	struct replay_opt *r = &op->replay;
+	struct plane_opt *p = &op->plane;
+	off_t offset = p->image.offset + (off_t)frame * r->frame_size;
+	uint64_t ts;
+	int ret;
+
+	/* readahead the following frame while this one is copied */
+	posix_fadvise(r->fd, offset + r->frame_size, r->frame_size,
+		      POSIX_FADV_WILLNEED);
+
+	if (p->sw_scale)
+		return plane_load_scaled(p, op->perf, r->fd, offset,
+					 fb->planes, fb->pitches);
+
+	ts = timeline_begin();
+	perf_begin(op->perf, perf_stage_load);
+	ret = util_load_image_bo(r->fd, fb->bo, p->fourcc, fb->planes,
+				 p->src_w, p->src_h, fb->pitches, offset);
+	perf_end(op->perf, perf_stage_load);
+	timeline_end("replay", "copy", ts);
+
+	return ret;
+}
+
+/* runs on the prefetch thread */
+static int replay_load(void *buffer, int64_t index, void *data)
+{
+	struct op_arg *op = data;
+
+	return frame_pool_load(op, buffer, index % op->replay.frames);
+}
+
+struct replay_state {
+	struct op_arg *op;
+	struct device *dev;
+	unsigned int pipe;
+	bool primary;		/* layer is the crtc's primary plane */
+	unsigned int vblank_us;
+	struct frame_buffer *front, *next;
+	struct prefetch *prefetch;
+	bool pending, paused, quit;
+	/* timeline in frames since the first frame of the first loop */
+	uint64_t base_time, base_frame;
+	int64_t shown, end;
+	uint64_t first_time, last_time;
+	double rate;
+	unsigned int presented, dropped, late;
+	struct evloop *loop;
+	drmEventContext evctx;
+	bool still;		/* a single image, no timeline */
+	bool input;		/* commands on stdin */
+	/* atomic commit to out-fence signal */
+	int fence;
+	uint64_t commit_time;
+	uint64_t latency_min, latency_max, latency_sum;
+	unsigned int latency_count;
+};
+
+static void replay_event_handler(int fd, unsigned int sequence,
+				 unsigned int tv_sec, unsigned int tv_usec,
+				 void *data)
+{
+	struct replay_state *s = data;
+
+	s->last_time = (uint64_t)tv_sec * 1000000 + tv_usec;
+	if (!s->first_time) {
+		s->first_time = s->last_time;
+		s->base_time = s->last_time;
+	}
+
+	timeline_instant("drm", s->next ? "flip" : "vblank", sequence);
+
+	if (s->next) {
+		/* the previous frame is off screen, reuse its buffer */
+		prefetch_put(s->prefetch, s->front);
+		s->front = s->next;
+		s->next = NULL;
+		s->presented++;
+	}
+
+	s->pending = false;
+}
+
+static unsigned int drm_vblank_pipe(unsigned int pipe)
+{
+	if (pipe > 1)
+		return (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) &
+		       DRM_VBLANK_HIGH_CRTC_MASK;
+	else if (pipe == 1)
+		return DRM_VBLANK_SECONDARY;
+
+	return 0;
+}
+
+static int replay_wait_vblank(struct replay_state *s)
+{
+	drmVBlank vbl;
+	int ret;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
+			   drm_vblank_pipe(s->pipe);
+	vbl.request.sequence = 1;
+	vbl.request.signal = (unsigned long)s;
+
+	ret = drmWaitVBlank(s->dev->fd, &vbl);
+	if (ret) {
+		fprintf(stderr, "failed to wait vblank: %s\n",
+			strerror(errno));
+		return ret;
+	}
+
+	s->pending = true;
+
+	return 0;
+}
+
+static void replay_step(struct replay_state *s);
+
+static void replay_fence_signaled(struct replay_state *s)
+{
+	uint64_t latency = time_us() - s->commit_time;
+
+	if (!s->latency_count || latency < s->latency_min)
+		s->latency_min = latency;
+	if (latency > s->latency_max)
+		s->latency_max = latency;
+	s->latency_sum += latency;
+	s->latency_count++;
+
+	evloop_del(s->loop, s->fence);
+	close(s->fence);
+	s->fence = -1;
+}
+
+static void replay_update(struct replay_state *s)
+{
+	if (!s->quit && !s->still && !s->pending && !s->paused)
+		replay_step(s);
+
+	if (s->quit)
+		evloop_quit(s->loop);
+}
+
+static void replay_fence_event(int fd, uint32_t events, void *data)
+{
+	struct replay_state *s = data;
+
+	replay_fence_signaled(s);
+	replay_update(s);
+}
+
+static int replay_present(struct replay_state *s, struct frame_buffer *fb)
+{
+	struct plane_opt *p = &s->op->plane;
+	uint64_t ts = timeline_begin();
+	int ret;
+
+	if (s->dev->use_atomic) {
+		/* the flip event came first, the fence is signaled too */
+		if (s->fence >= 0)
+			replay_fence_signaled(s);
+
+		s->commit_time = time_us();
+		ret = drm_atomic_plane(s->dev, p, fb->fb_id, false,
+				       &s->fence, s);
+		timeline_end("drm", "plane set", ts);
+		if (ret)
+			return ret;
+		if (s->fence >= 0)
+			evloop_add(s->loop, s->fence, EPOLLIN,
+				   replay_fence_event, s);
+		s->pending = true;
+	} else if (s->primary) {
+		ret = drmModePageFlip(s->dev->fd, p->crtc_id, fb->fb_id,
+				      DRM_MODE_PAGE_FLIP_EVENT, s);
+		timeline_end("drm", "plane set", ts);
+		if (ret) {
+			fprintf(stderr, "failed to page flip: %s\n",
+				strerror(errno));
+			return ret;
+		}
+		s->pending = true;
+	} else {
+		/* overlay planes have no legacy flip, latch on next vblank */
+		ret = drmModeSetPlane(s->dev->fd, p->plane_id, p->crtc_id,
+				      fb->fb_id, 0, p->crtc_x, p->crtc_y,
+				      p->crtc_w, p->crtc_h, 0, 0,
+				      p->src_w << 16, p->src_h << 16);
+		timeline_end("drm", "plane set", ts);
+		if (ret) {
+			fprintf(stderr, "failed to set plane: %s\n",
+				strerror(errno));
+			return ret;
+		}
+
+		ret = replay_wait_vblank(s);
+		if (ret)
+			return ret;
+	}
+
+	s->next = fb;
+
+	return 0;
+}
+
+static void replay_rebase(struct replay_state *s, uint64_t frame)
+{
+	s->base_frame = frame;
+	s->base_time = s->last_time;
+}
+
+static void replay_step(struct replay_state *s)
+{
+	struct frame_buffer *fb;
+	int64_t due, index;
+
+	/* the frame which must be on screen at the next vblank */
+	due = s->base_frame + (uint64_t)((s->last_time + s->vblank_us -
+					   s->base_time) * s->rate / 1000000);
+
+	if (due >= s->end) {
+		s->quit = true;
+		return;
+	}
+
+	if (due <= s->shown) {
+		if (replay_wait_vblank(s))
+			s->quit = true;
+		return;
+	}
+
+	fb = prefetch_get(s->prefetch, due, &index);
+	if (!fb) {
+		if (prefetch_error(s->prefetch)) {
+			s->quit = true;
+			return;
+		}
+
+		/* the loader is behind, keep the current frame */
+		s->late++;
+		if (replay_wait_vblank(s))
+			s->quit = true;
+		return;
+	}
+
+	if (index > s->shown + 1)
+		s->dropped += index - s->shown - 1;
+
+	if (replay_present(s, fb)) {
+		prefetch_put(s->prefetch, fb);
+		s->quit = true;
+		return;
+	}
+
+	s->shown = index;
+}
+
+/*
+ * q: quit, p: pause/resume, k <frame>: seek, x <speed>: speed
+ * An empty line quits as the still image does.
+ */
+static int replay_command(struct replay_state *s, char *line)
+{
+	struct replay_opt *r = &s->op->replay;
+	char *arg = line + 1;
+	double speed;
+	unsigned long frame;
+
+	if (line[0] == '\n' || line[0] == 'q') {
+		s->quit = true;
+		return 0;
+	}
+
+	/* a still image has nothing else to control */
+	if (s->still) {
+		fprintf(stderr, "unknown command %s\n", line);
+		return -EINVAL;
+	}
+
+	switch (line[0]) {
+	case 'p':
+		s->paused = !s->paused;
+		/* no event while paused, restart the timeline from now */
+		if (!s->paused)
+			s->last_time = time_us();
+		replay_rebase(s, s->shown);
+		if (!s->paused && !s->pending && replay_wait_vblank(s))
+			s->quit = true;
+		break;
+	case 'k':
+		frame = strtoul(arg, NULL, 10);
+		if (frame >= r->frames) {
+			fprintf(stderr, "seek frame %lu over %u frames\n",
+				frame, r->frames);
+			return -EINVAL;
+		}
+		/* seek in the current loop */
+		frame += s->shown - s->shown % r->frames;
+		replay_rebase(s, frame);
+		s->shown = (int64_t)frame - 1;
+		prefetch_seek(s->prefetch, frame);
+		break;
+	case 'x':
+		speed = strtod(arg, NULL);
+		if (speed <= 0) {
+			fprintf(stderr, "invalid speed %s\n", arg);
+			return -EINVAL;
+		}
+		replay_rebase(s, s->shown);
+		s->rate = (r->rate ? r->rate : 1000000.0 / s->vblank_us) *
+			  speed;
+		break;
+	default:
+		fprintf(stderr, "unknown command %s\n", line);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void replay_drm_event(int fd, uint32_t events, void *data)
+{
+	struct replay_state *s = data;
+
+	drmHandleEvent(fd, &s->evctx);
+	replay_update(s);
+}
+
+static void replay_stdin_line(char *line, int client, void *data)
+{
+	struct replay_state *s = data;
+
+	if (line) {
+		replay_command(s, line);
+	} else {
+		/*
+		 * No controls without stdin. A replay plays to the end,
+		 * a still image left without any way to end quits at once
+		 * as the former getchar() did.
+		 */
+		s->input = false;
+		if (s->still && !s->op->replay.duration &&
+		    !s->op->replay.control)
+			s->quit = true;
+	}
+
+	replay_update(s);
+}
+
+static void replay_control_line(char *line, int client, void *data)
+{
+	struct replay_state *s = data;
+	const char *reply;
+
+	if (!line)
+		return;
+
+	reply = replay_command(s, line) ? "error\n" : "ok\n";
+	if (write(client, reply, strlen(reply)) < 0)
+		fprintf(stderr, "control reply failed: %s\n",
+			strerror(errno));
+
+	replay_update(s);
+}
+
+static void replay_signal_event(int fd, uint32_t signo, void *data)
+{
+	struct replay_state *s = data;
+
+	fprintf(stdout, "%s, stop\n", strsignal(signo));
+	s->quit = true;
+	replay_update(s);
+}
+
+static void replay_timer_event(int fd, uint32_t expirations, void *data)
+{
+	struct replay_state *s = data;
+
+	s->quit = true;
+	replay_update(s);
+}
+
+static void replay_stop_event(int fd, uint32_t events, void *data)
+{
+	struct replay_state *s = data;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0)
+		return;
+
+	s->quit = true;
+	replay_update(s);
+}
+
+/*
+ * Sets up the event sources, before any thread as the signals are
+ * blocked to be read from the signalfd.
+ */
+static int replay_loop_create(struct replay_state *s)
+{
+	static const int signals[] = { SIGINT, SIGTERM };
+	struct replay_opt *r = &s->op->replay;
+	int ret;
+
+	memset(&s->evctx, 0, sizeof(s->evctx));
+	s->evctx.version = 2;
+	s->evctx.vblank_handler = replay_event_handler;
+	s->evctx.page_flip_handler = replay_event_handler;
+
+	s->loop = evloop_create();
+	if (!s->loop)
+		return -ENOMEM;
+
+	ret = evloop_add(s->loop, s->dev->fd, EPOLLIN, replay_drm_event, s);
+	if (ret)
+		goto __exit_loop;
+
+	/* a daemon's replay has its stop eventfd, the daemon the signals */
+	if (r->stop < 0) {
+		ret = evloop_add_signal(s->loop, signals, ARRAY_SIZE(signals),
+					replay_signal_event, s);
+		if (ret < 0)
+			goto __exit_loop;
+	}
+
+	if (r->duration) {
+		ret = evloop_add_timer(s->loop, r->duration, 0,
+				       replay_timer_event, s);
+		if (ret < 0)
+			goto __exit_loop;
+	}
+
+	if (r->control) {
+		ret = evloop_add_server(s->loop, r->control,
+					replay_control_line, s);
+		if (ret < 0)
+			goto __exit_loop;
+	}
+
+	/* a daemon's replay is stopped by the daemon, not by its stdin */
+	if (r->stop >= 0) {
+		ret = evloop_add(s->loop, r->stop, EPOLLIN, replay_stop_event, s);
+		if (ret < 0)
+			goto __exit_loop;
+	} else {
+		s->input = !evloop_add_lines(s->loop, STDIN_FILENO,
+					     replay_stdin_line, s);
+	}
+	if (!s->input && s->still && !r->duration && !r->control &&
+	    r->stop < 0)
+		s->quit = true;
+
+	return 0;
+
+__exit_loop:
+	evloop_destroy(s->loop);
+	s->loop = NULL;
+
+	return ret;
+}
+
+/* the last flip completes before the plane is torn down */
+static void replay_drain(struct replay_state *s)
+{
+	while (s->pending && evloop_dispatch(s->loop, 100) > 0)
+		;
+}
+
+static void replay_loop_destroy(struct replay_state *s)
+{
+	if (s->fence >= 0) {
+		evloop_del(s->loop, s->fence);
+		close(s->fence);
+		s->fence = -1;
+	}
+
+	evloop_destroy(s->loop);
+	s->loop = NULL;
+}
+
+static int replay_run(struct replay_state *s)
+{
+	if (!s->still && replay_wait_vblank(s))
+		return -EINVAL;
+
+	if (s->quit)
+		return 0;
+
+	return evloop_run(s->loop);
+}
+
+static unsigned int drm_crtc_pipe(struct device *dev, uint32_t crtc_id)
+{
+	int i;
+
+	for (i = 0; i < dev->resources->res->count_crtcs; i++)
+		if (crtc_id == dev->resources->res->crtcs[i])
+			return i;
+
+	return 0;
+}
+
+static drmModeModeInfo *drm_pipe_mode(struct device *dev, struct plane_opt *p,
+				      unsigned int pipe)
+{
+	struct crtc *_crtc = drm_crtc(dev, pipe);
+	drmModeCrtc *crtc = _crtc ? _crtc->crtc : NULL;
+
+	if (!p->modeset && crtc && crtc->mode_valid)
+		return &crtc->mode;
+
+	return drm_connector_find_mode(dev, p->connector_id, p->mode_index, 0);
+}
+
+static unsigned int replay_vrefresh(struct device *dev, struct plane_opt *p,
+				    unsigned int pipe)
+{
+	drmModeModeInfo *mode = drm_pipe_mode(dev, p, pipe);
+
+	return mode && mode->vrefresh ? mode->vrefresh : 60;
+}
+
+/* blocks until the next vblank, 'us' is its time */
+static int drm_wait_vblank(struct device *dev, unsigned int pipe,
+			   uint64_t *us)
+{
+	drmVBlank vbl;
+	uint64_t ts = timeline_begin();
+	int ret;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_RELATIVE | drm_vblank_pipe(pipe);
+	vbl.request.sequence = 1;
+
+	ret = drmWaitVBlank(dev->fd, &vbl);
+	timeline_end("drm", "vblank", ts);
+	if (ret) {
+		fprintf(stderr, "failed to wait vblank: %s\n",
+			strerror(errno));
+		return -errno;
+	}
+
+	*us = (uint64_t)vbl.reply.tval_sec * 1000000 + vbl.reply.tval_usec;
+
+	return 0;
+}
+
+/*
+ * The collected writes go in one burst right after a vblank, a scanout
+ * never latches them half applied.
+ */
+static int set_mlc_writes(struct op_arg *op, struct device *dev,
+			  struct mlc_writes *w)
+{
+	struct plane_opt *p = &op->plane;
+	unsigned int pipe = drm_crtc_pipe(dev, p->crtc_id);
+	drmModeModeInfo *mode = drm_pipe_mode(dev, p, pipe);
+	unsigned int queued = w->queued;
+	struct mlc_burst burst;
+	uint64_t vblank = 0, done, blank_us = 0;
+	int ret;
+
+	if (mode && mode->clock)
+		blank_us = (uint64_t)(mode->vtotal - mode->vdisplay) *
+			   mode->htotal * 1000 / mode->clock;
+
+	/* without a vblank the writes still go together */
+	drm_wait_vblank(dev, pipe, &vblank);
+
+	ret = hw_reg_apply(op->module, w, &burst);
+	done = time_us();
+	if (ret) {
+		fprintf(stderr, "failed to write mlc.%d properties: %s\n",
+			op->module, strerror(-ret));
+		return ret;
+	}
+
+	fprintf(stdout, "mlc.%d: %u writes in %u stores, %lldns, done %dus after vblank, blank %dus\n",
+		op->module, queued, burst.writes, burst.ns,
+		vblank ? (int)(done - vblank) : -1, (int)blank_us);
+
+	if (vblank && blank_us && done - vblank > blank_us)
+		fprintf(stderr, "mlc.%d: writes ran past the vertical blanking\n",
+			op->module);
+
+	return 0;
+}
+
+static int set_mlc_property(struct op_arg *op, struct device *dev,
+			    struct mlc_reg *reg)
+{
+	struct mlc_writes w;
+	int i;
+
+	/* not a nexell display */
+	if (!op->mem)
+		return 0;
+
+	memset(&w, 0, sizeof(w));
+
+	set_mlc_top(op, reg, &w);
+	for (i = mlc_layer_rgb0; i < mlc_layer_unknown; i++)
+		set_mlc_layer(op, reg, i, &w);
+
+	return set_mlc_writes(op, dev, &w);
+}
+
+static int update_device_frames(struct op_arg *op, struct device *dev,
+				struct raw_header *header)
+{
+	struct replay_opt *r = &op->replay;
+	struct plane_opt *p = &op->plane;
+	struct property_arg prop;
+	struct replay_state s;
+	void *buffers[FRAME_POOL_SIZE];
+	int64_t index;
+	uint64_t elapsed;
+	int i, ret;
+
+	memset(&s, 0, sizeof(s));
+	s.op = op;
+	s.dev = dev;
+	s.fence = -1;
+
+	s.pipe = drm_crtc_pipe(dev, p->crtc_id);
+
+	r->fd = open(op->file, O_RDONLY);
+	if (r->fd < 0) {
+		fprintf(stderr, "Error file %s\n", op->file);
+		perror("- error");
+		return -errno;
+	}
+	posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	ret = replay_loop_create(&s);
+	if (ret)
+		goto __exit_file;
+
+	ret = frame_pool_create(dev, p);
+	if (ret)
+		goto __exit_loop;
+
+	for (i = 0; i < FRAME_POOL_SIZE; i++)
+		buffers[i] = &p->pool[i];
+
+	s.end = r->loops ? (int64_t)r->frames * r->loops : INT64_MAX;
+	s.prefetch = prefetch_create(buffers, FRAME_POOL_SIZE,
+				     r->start, s.end, replay_load, op);
+	if (!s.prefetch) {
+		ret = -ENOMEM;
+		goto __exit_frames;
+	}
+
+	s.front = prefetch_wait(s.prefetch, &index);
+	if (!s.front) {
+		ret = prefetch_error(s.prefetch);
+		goto __exit_prefetch;
+	}
+
+	p->fb_id = s.front->fb_id;
+	ret = drm_set_plane(dev, p);
+	p->fb_id = 0;
+	if (ret)
+		goto __exit_prefetch;
+
+	set_mlc_property(op, dev, &header->mlc);
+
+	memset(&prop, 0, sizeof(prop));
+	prop.obj_id = p->plane_id;
+	strcpy(prop.name, "type");
+	s.primary = !drm_get_property(dev, &prop) &&
+		    prop.value == DRM_PLANE_TYPE_PRIMARY;
+
+	s.vblank_us = 1000000 / replay_vrefresh(dev, p, s.pipe);
+	s.rate = (r->rate ? r->rate : 1000000.0 / s.vblank_us) * r->speed;
+	s.base_frame = s.shown = r->start;
+
+	fprintf(stdout,
+		"replay %u frames from %u, %.3f fps x %.2f, loops %u, %s\n",
+		r->frames, r->start, s.rate / r->speed, r->speed, r->loops,
+		dev->use_atomic ? "atomic" :
+		s.primary ? "page flip" : "set plane");
+
+	ret = replay_run(&s);
+	replay_drain(&s);
+
+	elapsed = s.last_time - s.first_time;
+	fprintf(stdout,
+		"presented %u frames, dropped %u frames, %u vblanks late, %.3f fps in %.3f sec\n",
+		s.presented, s.dropped, s.late,
+		elapsed ? s.presented * 1000000.0 / elapsed : 0.0,
+		elapsed / 1000000.0);
+	if (s.latency_count)
+		fprintf(stdout, "commit latency min %dus, avg %dus, max %dus\n",
+			(int)s.latency_min,
+			(int)(s.latency_sum / s.latency_count),
+			(int)s.latency_max);
+
+	drm_clear_plane(dev, p);
+
+__exit_prefetch:
+	prefetch_destroy(s.prefetch);
+
+__exit_frames:
+	frame_pool_destroy(dev, p);
+
+__exit_loop:
+	replay_loop_destroy(&s);
+
+__exit_file:
+	close(r->fd);
+
+	return ret;
+}
+
+static int update_device_still(struct op_arg *op, struct device *dev,
+			       struct raw_header *header)
+{
+	struct plane_opt *p = &op->plane;
+	struct replay_state s;
+	int ret;
+
+	memset(&s, 0, sizeof(s));
+	s.op = op;
+	s.dev = dev;
+	s.fence = -1;
+	s.still = true;
+
+	ret = replay_loop_create(&s);
+	if (ret)
+		return ret;
+
+	ret = drm_set_plane(dev, p);
+	if (!ret) {
+		set_mlc_property(op, dev, &header->mlc);
+
+		/* until a quit command, the display duration or a signal */
+		ret = replay_run(&s);
+	}
+
+	drm_clear_plane(dev, p);
+	replay_loop_destroy(&s);
+
+	return ret;
+}
+
+/* falls back to the cpu for a plane without the scaler */
+static void set_plane_scale(struct op_arg *op, struct device *dev)
+{
+	struct plane_opt *p = &op->plane;
+
+	if (drm_plane_scales(dev, p))
+		return;
+
+	fprintf(stdout, "plane.%d can't scale %u x %u to %u x %u, scale on cpu\n",
+		p->plane_id, p->src_w, p->src_h, p->crtc_w, p->crtc_h);
+
+	p->sw_scale = true;
+	p->image_w = p->src_w;
+	p->image_h = p->src_h;
+	p->src_w = p->crtc_w;
+	p->src_h = p->crtc_h;
+	p->bo_type = UTIL_BO_DUMB;
+}
+
+/* reads a layer capture and resolves its layer to the drm plane */
+static int update_layer_setup(struct op_arg *op, struct device *dev,
+			      struct raw_header *header)
+{
+	int ret;
+
+	ret = raw_image_header(op, header);
+	if (ret)
+		return ret;
+
+	ret = get_drm_ids(op, dev);
+	if (ret)
+		return ret;
+
+	fprintf(stdout, "set mlc.%d layer.%d -> crt.%d plane.%d\n",
+		op->module, op->layer,
+		op->plane.crtc_id, op->plane.plane_id);
+
+	ret = format_to_fourcc(op, header);
+	if (ret)
+		return ret;
+
+	ret = set_plane_rect(op, header);
+	if (ret)
+		return ret;
+
+	map_plane_rect(op, header);
+	set_plane_scale(op, dev);
+
+	fprintf(stdout, "src %d,%d, %d x %d %dbpp, %s(0x%x) - %s(0x%x)\n",
+		op->plane.src_x, op->plane.src_y, op->plane.src_w,
+		op->plane.src_h,
+		op->bpp, hw_format_name(op->hw_format, op->bpp),
+		op->hw_format,
+		util_format_name(op->plane.fourcc),
+		op->plane.fourcc);
+
+	ret = set_plane_image(op, header);
+	if (ret)
+		return ret;
+
+	return replay_frame_count(op, header);
+}
+
+/*
+ * Restores every layer capture of one module at once: all planes go in a
+ * single atomic commit (one after the other on legacy kms), then the
+ * module wide mlc properties are written once and each layer's own ones
+ * from its capture.
+ */
+static int update_device_module(struct op_arg *op, struct device *dev)
+{
+	struct raw_header *headers = NULL;
+	struct op_arg *layers = NULL;
+	struct plane_opt *planes[mlc_layer_unknown];
+	unsigned int fb_ids[mlc_layer_unknown];
+	unsigned int mask = 0;
+	struct replay_state s;
+	int i, n = op->nr_files;
+	int ret = 0;
+
+	layers = calloc(n, sizeof(*layers));
+	headers = calloc(n, RAW_HEADER_SIZE);
+	if (!layers || !headers) {
+		fprintf(stderr, "memory allocation failed\n");
+		ret = -ENOMEM;
+		goto __exit_module;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct op_arg *l = &layers[i];
+
+		*l = *op;
+		l->file = op->files[i];
+
+		ret = update_layer_setup(l, dev, &headers[i]);
+		if (ret)
+			goto __exit_module;
+
+		if (l->module != layers[0].module || (mask & (1 << l->layer))) {
+			fprintf(stderr,
+				"%s: mlc.%d layer.%d, expected another layer of mlc.%d\n",
+				l->file, l->module, l->layer, layers[0].module);
+			ret = -EINVAL;
+			goto __exit_module;
+		}
+		mask |= 1 << l->layer;
+
+		if (l->replay.frames > 1)
+			fprintf(stdout, "%s: restore the first of %u frames\n",
+				l->file, l->replay.frames);
+
+		planes[i] = &l->plane;
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.op = op;
+	s.dev = dev;
+	s.fence = -1;
+	s.still = true;
+
+	ret = replay_loop_create(&s);
+	if (ret)
+		goto __exit_module;
+
+	if (dev->use_atomic) {
+		uint64_t start = time_us();
+		int fence = -1;
+
+		for (i = 0; i < n && !ret; i++) {
+			ret = drm_plane_fb(dev, planes[i]);
+			fb_ids[i] = planes[i]->fb_id;
+		}
+
+		if (!ret)
+			ret = drm_atomic_planes(dev, planes, fb_ids, n, true,
+						&fence, NULL);
+		if (!ret && drm_wait_fence(fence, 1000))
+			fprintf(stderr, "atomic commit fence timeout\n");
+		else if (!ret)
+			fprintf(stdout, "atomic commit of %d planes done %dus\n",
+				n, (int)(time_us() - start));
+	} else {
+		for (i = 0; i < n && !ret; i++)
+			ret = drm_set_plane(dev, planes[i]);
+	}
+
+	if (!ret && op->mem) {
+		struct mlc_writes w;
+
+		memset(&w, 0, sizeof(w));
+		set_mlc_top(op, &headers[0].mlc, &w);
+		for (i = 0; i < n; i++)
+			set_mlc_layer(op, &headers[i].mlc, layers[i].layer, &w);
+		set_mlc_writes(op, dev, &w);
+	}
+
+	/* until a quit command, the display duration or a signal */
+	if (!ret)
+		ret = replay_run(&s);
+
+	for (i = 0; i < n; i++)
+		drm_clear_plane(dev, planes[i]);
+
+	replay_loop_destroy(&s);
+
+__exit_module:
+	free(headers);
+	free(layers);
+
+	return ret;
+}
+
+/* the drm device of a replay, a daemon keeps it between replays */
+static int replay_device_open(struct op_arg *op, struct device *dev)
+{
+	memset(dev, 0, sizeof(*dev));
+
+	dev->fd = drm_open(NULL, op->driver);
+	if (dev->fd < 0)
+		return -EINVAL;
+
+	if (op->flags & FLAG_ATOMIC) {
+		if (drmSetClientCap(dev->fd, DRM_CLIENT_CAP_ATOMIC, 1))
+			fprintf(stderr, "no atomic modesetting, use legacy\n");
+		else
+			dev->use_atomic = 1;
+	}
+
+	dev->resources = drm_get_resources(dev);
+	if (!dev->resources) {
+		drm_close(dev->fd);
+		dev->fd = -1;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void replay_device_close(struct device *dev)
+{
+	if (dev->resources)
+		drm_free_resources(dev->resources);
+	dev->resources = NULL;
+
+	if (dev->fd >= 0)
+		drm_close(dev->fd);
+	dev->fd = -1;
+}
+
+static int update_device_replay(struct op_arg *op, struct device *dev)
+{
+	struct raw_header *header = NULL;
+	int ret;
+
+	if (op->flags & FLAG_UDMABUF)
+		op->plane.bo_type = UTIL_BO_UDMABUF;
+
+	if (op->nr_files > 1)
+		return update_device_module(op, dev);
+
+	header = (struct raw_header *)malloc(RAW_HEADER_SIZE);
+	if (!header) {
+		fprintf(stderr, "memory allocation failed\n");
+		return -ENOMEM;
+	}
+	memset(header, 0, RAW_HEADER_SIZE);
+
+	ret = update_layer_setup(op, dev, header);
+	if (ret)
+		goto __exit_update;
+
+	if (op->replay.frames > 1)
+		ret = update_device_frames(op, dev, header);
+	else
+		ret = update_device_still(op, dev, header);
+
+__exit_update:
+	free(header);
+
+	return ret;
+}
+
+static int update_device(struct op_arg *op)
+{
+	struct device dev;
+	int ret;
+
+	ret = replay_device_open(op, &dev);
+	if (ret)
+		return ret;
+
+	ret = update_device_replay(op, &dev);
+	replay_device_close(&dev);
+
+	return ret;
+}
+
+/* opens every module, for what looks at all of them */
+static int map_modules(struct capture_module *modules[])
+{
+	int i;
+
+	for (i = 0; i < hw_reg_get_module_num(); i++) {
+		modules[i] = capture_open(i);
+		if (!modules[i])
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void unmap_modules(struct capture_module *modules[])
+{
+	int i;
+
+	for (i = 0; i < hw_reg_get_module_num(); i++) {
+		capture_close(modules[i]);
+		modules[i] = NULL;
+	}
+}
+
+static int trace_device(struct op_arg *op)
+{
+	struct capture_module *modules[NUMBER_OF_MLC_MODULE] = { NULL, };
+	struct regtrace *t = NULL;
+	char *regs = NULL, *name, *save;
+	int ret;
+
+	ret = map_modules(modules);
+	if (ret)
+		goto __exit_trace;
+
+	t = regtrace_create(op->trace_rate);
+	regs = strdup(op->trace_regs ? op->trace_regs : "mlc0,mlc1");
+	if (!t || !regs) {
+		ret = -EINVAL;
+		goto __exit_trace;
+	}
+
+	for (name = strtok_r(regs, ",", &save); name && !ret;
+	     name = strtok_r(NULL, ",", &save))
+		ret = regtrace_add(t, name);
+
+	if (!ret)
+		ret = regtrace_run(t, op->file, op->replay.duration);
+
+__exit_trace:
+	regtrace_destroy(t);
+	free(regs);
+	unmap_modules(modules);
+
+	return ret;
+}
+
+static int monitor_device(struct op_arg *op)
+{
+	struct capture_module *modules[NUMBER_OF_MLC_MODULE] = { NULL, };
+	int vblank[NUMBER_OF_MLC_MODULE];
+	struct flipmon *m = NULL;
+	struct device dev;
+	int i, ret;
+
+	dev.fd = -1;
+	dev.resources = NULL;
+
+	ret = map_modules(modules);
+	if (ret)
+		goto __exit_monitor;
+
+	/* a simulated device has no vblank to sample on */
+	if (!op->backend || strncmp(op->backend, "sim:", 4))
+		replay_device_open(op, &dev);
+
+	/* the crtc of a module as a replay resolves it */
+	for (i = 0; i < NUMBER_OF_MLC_MODULE; i++) {
+		struct crtc *crtc = dev.fd >= 0 ? drm_crtc(&dev, i) : NULL;
+
+		vblank[i] = crtc ? (int)drm_vblank_pipe(drm_crtc_pipe(&dev,
+						crtc->crtc->crtc_id)) : -1;
+	}
+
+	m = flipmon_create(op->trace_rate, dev.fd, vblank);
+	if (!m) {
+		ret = -EINVAL;
+		goto __exit_monitor;
+	}
+
+	ret = flipmon_run(m, op->monitor, op->replay.duration,
+			  op->status == status_format_json);
+
+__exit_monitor:
+	flipmon_destroy(m);
+	replay_device_close(&dev);
+	unmap_modules(modules);
+
+	return ret;
+}
+
+static int watchdog_device(struct op_arg *op)
+{
+	struct capture_module *modules[NUMBER_OF_MLC_MODULE] = { NULL, };
+	struct watchdog *w;
+	int ret;
+
+	ret = map_modules(modules);
+	if (ret)
+		goto __exit_watchdog;
+
+	w = watchdog_create(op->watchdog, op->watchdog_check);
+	if (!w) {
+		ret = -EINVAL;
+		goto __exit_watchdog;
+	}
+
+	ret = watchdog_run(w, op->replay.control, op->replay.duration,
+			   op->status == status_format_json);
+	watchdog_destroy(w);
+
+__exit_watchdog:
+	unmap_modules(modules);
+
+	return ret;
+}
+
+static int parse_arg(char *arg, struct op_arg *op)
+{
+	char *end;
+
+	op->module = strtoul(arg, &end, 10);
+	if (op->module >= hw_reg_get_module_num()) {
+		fprintf(stderr, "Fail, not support module.%d\n", op->module);
+		return -EINVAL;
+	}
+
+	if (*end != ',')
+		return op->mode == op_mode_print ? 0 : -EINVAL;
+
+	arg = end +  1;
+	op->layer = strtoul(arg, &end, 10);
+	if ((int)op->layer >= hw_reg_get_layer_num(op->module)) {
+		fprintf(stderr, "Fail, not support module.%d - layer.%d\n",
+			op->module, op->layer);
+		return -EINVAL;
+	}
+
+	if (*end != ',')
+		return op->mode == op_mode_print ? 0 : -EINVAL;
+
+	arg = end +  1;
+	op->file = arg;
+
+	return 0;
+}
+
+/* the module of the capture is the one its properties go to */
+static int replay_module(struct op_arg *op)
+{
+	struct raw_header *header;
+	int ret;
+
+	header = malloc(RAW_HEADER_SIZE);
+	if (!header)
+		return -ENOMEM;
+
+	ret = raw_image_header(op, header);
+	free(header);
+	if (ret)
+		return ret > 0 ? -ret : ret;
+
+	op->mem = hw_reg_get_mem(op->module);
+
+	return 0;
+}
+
+/*
+ * The daemon keeps the modules and their frames mapped and the drm device
+ * open between requests, a line each on a unix socket:
+ *   print [json|binary]		the status of the modules
+ *   capture <dev>,<layer> [fd]	a capture file, inline or in a memfd
+ *   replay <file> [<file>..]	replays the captures until a stop
+ *   stop				stops the replay, replies its result
+ *   quit
+ * The reply is "ok [<bytes>] [fd]", the bytes follow it, or "error <why>".
+ * A capture runs and replies on a thread of its own, the loop goes on
+ * with the other clients. A client waits for a reply before its next
+ * request.
+ */
+#define DAEMON_MAX_ARGS		(mlc_layer_unknown + 2)
+#define DAEMON_MAX_CAPTURES	4
+
+struct daemon {
+	struct op_arg *op;	/* the options every request starts from */
+	struct capture_module *modules[NUMBER_OF_MLC_MODULE];
+	struct device dev;	/* opened on the first replay */
+	struct evloop *loop;
+	/* the replay, on a thread of its own */
+	struct op_arg request;
+	pthread_t thread;
+	bool started;
+	int running, result;
+	int stop;		/* eventfd */
+	/* the captures on their threads */
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+	int captures;
+};
+
+/* a capture request, the client a dup the loop can't close under it */
+struct daemon_capture {
+	struct daemon *d;
+	int module;
+	enum mlc_layer layer;
+	bool pass;
+	int client;
+};
+
+static void daemon_reply(int client, int err, size_t len, int fd,
+			 const void *buf)
+{
+	/* the captures reply from their threads, a reply goes whole */
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	char line[64];
+	int ret;
+
+	if (err)
+		snprintf(line, sizeof(line), "error %s\n", strerror(-err));
+	else if (fd >= 0)
+		snprintf(line, sizeof(line), "ok %zu fd\n", len);
+	else if (buf)
+		snprintf(line, sizeof(line), "ok %zu\n", len);
+	else
+		snprintf(line, sizeof(line), "ok\n");
+
+	pthread_mutex_lock(&lock);
+	ret = evloop_send(client, line, strlen(line), fd);
+	if (!ret && buf && fd < 0)
+		ret = evloop_send(client, buf, len, -1);
+	pthread_mutex_unlock(&lock);
+	if (ret)
+		fprintf(stderr, "failed to reply: %s\n", strerror(-ret));
+}
+
+static int daemon_print(struct daemon *d, char **argv, int argc, int client)
+{
+	enum status_format format = status_format_json;
+	char *buf;
+	ssize_t len;
+
+	if (argc > 1 && !strcmp(argv[1], "binary"))
+		format = status_format_binary;
+
+	buf = malloc(STATUS_BUF_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	len = status_get(format, buf, STATUS_BUF_SIZE);
+	if (len >= 0)
+		daemon_reply(client, 0, len, -1, buf);
+	free(buf);
+
+	return len < 0 ? len : 0;
+}
+
+/* the signals go to the daemon's loop, not to its threads */
+static void daemon_block_signals(void)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+/* a capture file: the header with the registers, then the frame */
+static int daemon_capture_frame(struct daemon_capture *c)
+{
+	const char sign[4] = RAW_HEADER_SIGN;
+	struct daemon *d = c->d;
+	struct raw_header *header;
+	struct capture_frame f;
+	void *buf = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int fd = -1, ret;
+
+	header = calloc(1, RAW_HEADER_SIZE);
+	if (!header)
+		return -ENOMEM;
+
+	if (capture_snapshot(d->modules[c->module], &header->mlc, NULL))
+		fprintf(stderr, "mlc.%d layout still changing\n", c->module);
+	memcpy(header->sign, sign, sizeof(sign));
+	header->module = c->module;
+	header->layer = c->layer;
+
+	ret = capture_frame_layout(&header->mlc, c->layer, &f);
+	if (ret <= 0 || !f.size) {
+		ret = -ENODATA;
+		goto __exit_capture;
+	}
+	len = RAW_HEADER_SIZE + f.size;
+
+	/* the client maps the memfd, no byte of the frame goes through us */
+	if (c->pass) {
+		fd = memfd_create("capture", MFD_CLOEXEC);
+		if (fd < 0 || ftruncate(fd, len)) {
+			ret = -errno;
+			goto __exit_capture;
+		}
+		buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fd, 0);
+		if (buf == MAP_FAILED) {
+			buf = NULL;
+			ret = -errno;
+			goto __exit_capture;
+		}
+	} else {
+		buf = malloc(len);
+		if (!buf) {
+			ret = -ENOMEM;
+			goto __exit_capture;
+		}
+	}
+
+	memcpy(buf, header, RAW_HEADER_SIZE);
+	n = capture_layer(d->modules[c->module], &f, d->op->pool,
+			  buf + RAW_HEADER_SIZE, f.size);
+	ret = n < 0 ? n : 0;
+	if (!ret)
+		daemon_reply(c->client, 0, len, fd, buf);
+
+__exit_capture:
+	if (c->pass && buf)
+		munmap(buf, len);
+	else
+		free(buf);
+	if (fd >= 0)
+		close(fd);
+	free(header);
+
+	return ret;
+}
+
+static void *daemon_capture_thread(void *data)
+{
+	struct daemon_capture *c = data;
+	struct daemon *d = c->d;
+	int ret;
+
+	daemon_block_signals();
+
+	ret = daemon_capture_frame(c);
+	if (ret)
+		daemon_reply(c->client, ret, 0, -1, NULL);
+	close(c->client);
+	free(c);
+
+	pthread_mutex_lock(&d->lock);
+	if (!--d->captures)
+		pthread_cond_signal(&d->idle);
+	pthread_mutex_unlock(&d->lock);
+
+	return NULL;
+}
+
+static int daemon_capture(struct daemon *d, char **argv, int argc,
+			  int client)
+{
+	struct daemon_capture *c;
+	pthread_attr_t attr;
+	pthread_t thread;
+	struct op_arg op;
+	int ret;
+
+	memset(&op, 0, sizeof(op));
+	op.mode = op_mode_print;
+	op.layer = mlc_layer_unknown;
+	if (argc < 2 || parse_arg(argv[1], &op) ||
+	    op.layer == mlc_layer_unknown)
+		return -EINVAL;
+
+	pthread_mutex_lock(&d->lock);
+	ret = d->captures < DAEMON_MAX_CAPTURES ? 0 : -EBUSY;
+	if (!ret)
+		d->captures++;
+	pthread_mutex_unlock(&d->lock);
+	if (ret)
+		return ret;
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		ret = -ENOMEM;
+		goto __exit_capture;
+	}
+	c->d = d;
+	c->module = op.module;
+	c->layer = op.layer;
+	c->pass = argc > 2 && !strcmp(argv[2], "fd");
+	c->client = fcntl(client, F_DUPFD_CLOEXEC, 0);
+	if (c->client < 0) {
+		ret = -errno;
+		goto __exit_capture;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = -pthread_create(&thread, &attr, daemon_capture_thread, c);
+	pthread_attr_destroy(&attr);
+	if (!ret)
+		return 0;
+
+__exit_capture:
+	if (c && c->client >= 0)
+		close(c->client);
+	free(c);
+
+	pthread_mutex_lock(&d->lock);
+	d->captures--;
+	pthread_mutex_unlock(&d->lock);
+
+	return ret;
+}
+
+static void *daemon_replay_thread(void *data)
+{
+	struct daemon *d = data;
+
+	daemon_block_signals();
+
+	d->result = update_device_replay(&d->request, &d->dev);
+	__atomic_store_n(&d->running, 0, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/* stops the replay, returns its result */
+static int daemon_join(struct daemon *d)
+{
+	uint64_t count = 1;
+	int i;
+
+	if (!d->started)
+		return 0;
+
+	if (write(d->stop, &count, sizeof(count)) < 0)
+		fprintf(stderr, "failed to stop replay: %s\n",
+			strerror(errno));
+	pthread_join(d->thread, NULL);
+	d->started = false;
+
+	/* a stop after the replay was over is left in the eventfd */
+	if (read(d->stop, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "failed to reset stop: %s\n", strerror(errno));
+
+	for (i = 0; i < d->request.nr_files; i++)
+		free(d->request.files[i]);
+
+	return d->result;
+}
+
+static int daemon_replay(struct daemon *d, char **argv, int argc, int client)
+{
+	struct op_arg *r = &d->request;
+	int i, ret;
+
+	if (argc < 2 || argc - 1 > mlc_layer_unknown)
+		return -EINVAL;
+
+	if (d->started && __atomic_load_n(&d->running, __ATOMIC_ACQUIRE))
+		return -EBUSY;
+	daemon_join(d);
+
+	if (d->dev.fd < 0) {
+		ret = replay_device_open(d->op, &d->dev);
+		if (ret)
+			return ret;
+	}
+
+	*r = *d->op;
+	r->mode = op_mode_update;
+	r->replay.control = NULL;
+	r->replay.stop = d->stop;
+	for (r->nr_files = 0; r->nr_files < argc - 1; r->nr_files++) {
+		r->files[r->nr_files] = strdup(argv[r->nr_files + 1]);
+		if (!r->files[r->nr_files]) {
+			ret = -ENOMEM;
+			goto __exit_replay;
+		}
+	}
+	r->file = r->files[0];
+
+	ret = replay_module(r);
+	if (ret)
+		goto __exit_replay;
+
+	d->running = 1;
+	ret = -pthread_create(&d->thread, NULL, daemon_replay_thread, d);
+	if (ret)
+		goto __exit_replay;
+	d->started = true;
+
+	daemon_reply(client, 0, 0, -1, NULL);
+
+	return 0;
+
+__exit_replay:
+	for (i = 0; i < r->nr_files; i++)
+		free(r->files[i]);
+	r->nr_files = 0;
+
+	return ret;
+}
+
+static void daemon_line(char *line, int client, void *data)
+{
+	struct daemon *d = data;
+	char *argv[DAEMON_MAX_ARGS], *save;
+	int argc = 0, ret = 0;
+
+	/* the client is gone */
+	if (!line)
+		return;
+
+	for (argv[0] = strtok_r(line, " \t\r\n", &save);
+	     argv[argc] && argc < DAEMON_MAX_ARGS - 1;
+	     argv[argc] = strtok_r(NULL, " \t\r\n", &save))
+		argc++;
+
+	if (!argc)
+		return;
+
+	if (!strcmp(argv[0], "print")) {
+		ret = daemon_print(d, argv, argc, client);
+	} else if (!strcmp(argv[0], "capture")) {
+		ret = daemon_capture(d, argv, argc, client);
+	} else if (!strcmp(argv[0], "replay")) {
+		ret = daemon_replay(d, argv, argc, client);
+	} else if (!strcmp(argv[0], "stop")) {
+		ret = daemon_join(d);
+		if (!ret)
+			daemon_reply(client, 0, 0, -1, NULL);
+	} else if (!strcmp(argv[0], "quit")) {
+		daemon_reply(client, 0, 0, -1, NULL);
+		evloop_quit(d->loop);
+	} else {
+		ret = -EINVAL;
+	}
+
+	if (ret)
+		daemon_reply(client, ret < 0 ? ret : -EINVAL, 0, -1, NULL);
+}
+
+static void daemon_signal(int fd, uint32_t signo, void *data)
+{
+	struct daemon *d = data;
+
+	fprintf(stdout, "%s, stop\n", strsignal(signo));
+	evloop_quit(d->loop);
+}
+
+static int daemon_device(struct op_arg *op)
+{
+	static const int signals[] = { SIGINT, SIGTERM };
+	struct daemon d;
+	int ret;
+
+	memset(&d, 0, sizeof(d));
+	d.op = op;
+	d.dev.fd = -1;
+	d.stop = -1;
+	pthread_mutex_init(&d.lock, NULL);
+	pthread_cond_init(&d.idle, NULL);
+
+	ret = map_modules(d.modules);
+	if (ret)
+		goto __exit_daemon;
+
+	d.stop = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	d.loop = evloop_create();
+	if (d.stop < 0 || !d.loop) {
+		ret = -ENOMEM;
+		goto __exit_daemon;
+	}
+
+	/* before the replay threads, they keep the signals blocked */
+	ret = evloop_add_signal(d.loop, signals, ARRAY_SIZE(signals),
+				daemon_signal, &d);
+	if (ret >= 0)
+		ret = evloop_add_server(d.loop, op->daemon, daemon_line, &d);
+	if (ret < 0)
+		goto __exit_daemon;
+
+	fprintf(stdout, "daemon on %s\n", op->daemon);
+	fflush(stdout);
+
+	ret = evloop_run(d.loop);
+
+__exit_daemon:
+	daemon_join(&d);
+	/* the captures are done with the modules before they are unmapped */
+	pthread_mutex_lock(&d.lock);
+	while (d.captures)
+		pthread_cond_wait(&d.idle, &d.lock);
+	pthread_mutex_unlock(&d.lock);
+	replay_device_close(&d.dev);
+	evloop_destroy(d.loop);
+	if (d.stop >= 0)
+		close(d.stop);
+	unmap_modules(d.modules);
+	pthread_cond_destroy(&d.idle);
+	pthread_mutex_destroy(&d.lock);
+
+	return ret;
+}
+
+/* <trace>,<out> */
+static int export_trace(char *arg)
+{
+	char *out = strchr(arg, ',');
+
+	if (!out)
+		return -EINVAL;
+
+	*out++ = '\0';
+
+	return regtrace_export(arg, out);
+}
+
+/* the first frame of a capture, or a BMP by its extension */
+static int compare_load(const char *file, struct compare_image *img)
+{
+	const char sign[4] = RAW_HEADER_SIGN;
+	const char *ext = strrchr(file, '.');
+	struct raw_header *header;
+	struct capture_frame f;
+	void *buf = NULL;
+	FILE *fp;
+	int ret = -EINVAL;
+
+	if (ext && !strcasecmp(ext, ".bmp"))
+		return compare_image_bmp(img, file);
+
+	fp = fopen(file, "rb");
+	if (!fp) {
+		fprintf(stderr, "Error file %s\n", file);
+		perror("- error");
+		return -errno;
+	}
+
+	header = malloc(RAW_HEADER_SIZE);
+	if (!header) {
+		ret = -ENOMEM;
+		goto __exit_load;
+	}
+
+	if (fread(header, 1, RAW_HEADER_SIZE, fp) != RAW_HEADER_SIZE ||
+	    strncmp(header->sign, sign, 4)) {
+		fprintf(stderr, "Not found signature in %s\n", file);
+		goto __exit_load;
+	}
+
+	if (capture_frame_layout(&header->mlc, header->layer, &f) < 0)
+		goto __exit_load;
+
+	buf = malloc(f.size);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto __exit_load;
+	}
+	if (fread(buf, 1, f.size, fp) != f.size) {
+		fprintf(stderr, "Fail, %s is short of a frame\n", file);
+		goto __exit_load;
+	}
+
+	ret = compare_image_layer(img, &header->mlc, header->layer, buf,
+				  f.size);
+
+__exit_load:
+	free(buf);
+	free(header);
+	fclose(fp);
+
+	return ret;
+}
+
+/*
+ * <capture>,<reference>[,<mask.bmp>], returns 0 on an exact match and 1
+ * on a difference.
+ */
+static int compare_files(char *arg)
+{
+	char *ref = strchr(arg, ',');
+	char *mask = NULL;
+	struct compare_image a, b;
+	struct compare_result r;
+	uint8_t *diff = NULL;
+	uint64_t start, load;
+	int ret;
+
+	if (!ref)
+		return -EINVAL;
+	*ref++ = '\0';
+
+	mask = strchr(ref, ',');
+	if (mask)
+		*mask++ = '\0';
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+
+	start = time_us();
+	ret = compare_load(arg, &a);
+	if (!ret)
+		ret = compare_load(ref, &b);
+	if (ret)
+		goto __exit_compare;
+	load = time_us() - start;
+
+	if (mask) {
+		diff = malloc((size_t)a.width * a.height);
+		if (!diff) {
+			ret = -ENOMEM;
+			goto __exit_compare;
+		}
+	}
+
+	start = time_us();
+	ret = compare_images(&a, &b, &r, diff);
+	if (ret)
+		goto __exit_compare;
+
+	fprintf(stdout,
+		"compare %s to %s: %u x %u, %s, %llu pixels differ (%.2f%%), max error %u, psnr %.2fdB, ssim %.5f, %.3fms (load %.3fms)\n",
+		arg, ref, a.width, a.height, r.exact ? "exact" : "differ",
+		(unsigned long long)r.differ,
+		r.differ * 100.0 / ((double)a.width * a.height), r.max_error,
+		r.psnr, r.ssim, (time_us() - start) / 1000.0, load / 1000.0);
+
+	if (mask)
+		ret = compare_write_mask(mask, diff, a.width, a.height);
+	if (!ret)
+		ret = r.exact ? 0 : 1;
+
+__exit_compare:
+	free(diff);
+	compare_image_free(&a);
+	compare_image_free(&b);
+
+	return ret;
+}
+
+/*
+ * A simulated device from a capture: the captured registers at the module
+ * base and every frame at the captured addresses, one frame span apart.
+ */
+static int make_sim(struct op_arg *op, char *arg)
+{
+	const struct iosim_header magic = { .magic = IOSIM_MAGIC };
+	struct iosim_header sh = magic;
+	struct raw_header *header = NULL;
+	struct iosim_region *regions = NULL;
+	char *out = strchr(arg, ',');
+	size_t sizes[3], size, span;
+	uint32_t addrs[3], lo = UINT32_MAX, hi = 0;
+	off_t src = RAW_HEADER_SIZE;
+	void *buf = NULL;
+	int in = -1, fd = -1;
+	int i, n, count, ret = -EINVAL;
+
+	if (!out)
+		return -EINVAL;
+	*out++ = '\0';
+
+	header = calloc(1, RAW_HEADER_SIZE);
+	if (!header)
+		return -ENOMEM;
+
+	op->file = arg;
+	op->mode = op_mode_print;
+	if (raw_image_header(op, header) || replay_frame_count(op, header))
+		goto __exit_sim;
+
+	n = raw_plane_sizes(op, header, sizes, addrs);
+	for (i = 0; i < n; i++) {
+		if (addrs[i] < lo)
+			lo = addrs[i];
+		if (addrs[i] + sizes[i] > hi)
+			hi = addrs[i] + sizes[i];
+	}
+	span = (hi - lo + IO_MMAP_ALIGN - 1) & ~(IO_MMAP_ALIGN - 1);
+
+	if ((uint64_t)hi + (uint64_t)span * op->replay.frames > UINT32_MAX) {
+		fprintf(stderr, "%u frames at 0x%x are over 32bit addresses\n",
+			op->replay.frames, lo);
+		goto __exit_sim;
+	}
+
+	count = 1 + op->replay.frames * n;
+	regions = calloc(count, sizeof(*regions));
+	buf = malloc(hi - lo);
+	if (!regions || !buf) {
+		ret = -ENOMEM;
+		goto __exit_sim;
+	}
+
+	regions[0].phys = (size_t)hw_reg_get_base(op->module);
+	regions[0].size = sizeof(struct mlc_reg);
+	regions[0].module = op->module;
+	regions[0].layer = IOSIM_LAYER_REGS;
+
+	for (i = 1; i < count; i++) {
+		struct iosim_region *r = &regions[i];
+
+		r->module = op->module;
+		r->layer = op->layer;
+		r->frame = (i - 1) / n;
+		r->plane = (i - 1) % n;
+		r->phys = addrs[r->plane] + (uint64_t)span * r->frame;
+		r->size = sizes[r->plane];
+	}
+
+	size = iosim_layout(regions, count);
+	sh.regions = count;
+
+	in = open(arg, O_RDONLY);
+	fd = open(out, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (in < 0 || fd < 0) {
+		fprintf(stderr, "Error file %s\n", in < 0 ? arg : out);
+		perror("- error");
+		ret = -errno;
+		goto __exit_sim;
+	}
+
+	if (ftruncate(fd, size) ||
+	    pwrite(fd, &sh, sizeof(sh), 0) != sizeof(sh) ||
+	    pwrite(fd, regions, count * sizeof(*regions), sizeof(sh)) < 0 ||
+	    pwrite(fd, &header->mlc, sizeof(header->mlc),
+		   regions[0].offset) != sizeof(header->mlc))
+		goto __exit_io;
+
+	for (i = 1; i < count; i++) {
+		struct iosim_region *r = &regions[i];
+
+		if (pread(in, buf, r->size, src) != (ssize_t)r->size ||
+		    pwrite(fd, buf, r->size, r->offset) != (ssize_t)r->size)
+			goto __exit_io;
+		src += r->size;
+	}
+
+	fprintf(stdout, "simulated mlc.%d layer.%d, %u frames 0x%x apart, %zu bytes to %s\n",
+		op->module, op->layer, op->replay.frames, (unsigned int)span,
+		size, out);
+	ret = 0;
+	goto __exit_sim;
+
+__exit_io:
+	fprintf(stderr, "failed to write %s: %s\n", out, strerror(errno));
+	ret = -EIO;
+
+__exit_sim:
+	if (fd >= 0)
+		close(fd);
+	if (in >= 0)
+		close(in);
+	free(buf);
+	free(regions);
+	free(header);
+
+	return ret;
+}
+
+/* all the modules, decoded in one write for the scrapers */
+static int status_device(struct op_arg *op)
+{
+	struct capture_module *modules[NUMBER_OF_MLC_MODULE] = { NULL, };
+	int ret;
+
+	ret = map_modules(modules);
+	if (!ret) {
+		fflush(stdout);
+		ret = status_write(STDOUT_FILENO, op->status);
+	}
+
+	unmap_modules(modules);
+
+	return ret;
+}
+
+#define BENCH_FB_BASE		0x40000000
+
+/* the formats a capture converts to a fourcc */
+static const struct {
+	unsigned int format;
+	int bpp;
+} bench_formats[] = {
+	{ mlc_rgbfmt_r5g6b5, 16 },
+	{ mlc_rgbfmt_b5g6r5, 16 },
+	{ mlc_rgbfmt_x1r5g5b5, 16 },
+	{ mlc_rgbfmt_x1b5g5r5, 16 },
+	{ mlc_rgbfmt_r8g8b8, 24 },
+	{ mlc_rgbfmt_b8g8r8, 24 },
+	{ mlc_rgbfmt_x8r8g8b8, 32 },
+	{ mlc_rgbfmt_x8b8g8r8, 32 },
+	{ mlc_rgbfmt_a8r8g8b8, 32 },
+	{ mlc_rgbfmt_a8b8g8r8, 32 },
+	{ mlc_yuvfmt_420, 8 },
+	{ mlc_yuvfmt_422, 8 },
+	{ mlc_yuvfmt_444, 8 },
+	{ mlc_yuvfmt_yuyv, 16 },
+};
+
+static const struct {
+	unsigned int width, height;
+} bench_sizes[] = {
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+};
+
+struct bench_case {
+	struct op_arg *op;
+	struct raw_header *header;
+	unsigned int width, height;
+	int planes;
+	size_t sizes[3];
+	uint32_t addrs[3];
+	unsigned int strides[3];
+	size_t frame;
+	void *mem[3];		/* the planes on the device */
+	void *mapped[4];
+	size_t mapped_size[4];
+	void *buf;
+	void *image, *image_planes[3];
+	unsigned int pitches[4];
+	void *scaled, *scaled_planes[3];	/* 3/4 of the frame */
+	unsigned int scaled_pitches[4];
+	struct compare_image reference;
+	int fd;
+	char sim[32], capture[32];
+};
+
+/* the layer registers of a packed frame at the frame buffer base */
+static void bench_layout(struct bench_case *c, unsigned int format, int bpp)
+{
+	struct op_arg *op = c->op;
+	struct mlc_reg *r = &c->header->mlc;
+	unsigned int w = c->width, h = c->height;
+	uint32_t addr = BENCH_FB_BASE;
+	int i;
+
+	memset(c->header, 0, RAW_HEADER_SIZE);
+	r->mlccontrolt = 0xc02;
+	r->mlcscreensize = ((h - 1) << 16) | (w - 1);
+
+	if (format & _maskbit(24, 8)) {
+		op->layer = mlc_layer_rgb0;
+		r->rgb[0].mlccontrol = format | BIT(5);
+		r->rgb[0].mlcleftright = w - 1;
+		r->rgb[0].mlctopbottom = h - 1;
+		r->rgb[0].mlchstride = bpp / 8;
+		r->rgb[0].mlcvstride = w * bpp / 8;
+		r->rgb[0].mlcaddress = addr;
+		c->strides[0] = r->rgb[0].mlcvstride;
+	} else {
+		op->layer = mlc_layer_video;
+		r->yuv.mlccontrol = format | BIT(5);
+		r->yuv.mlcleftright = w - 1;
+		r->yuv.mlctopbottom = h - 1;
+		r->yuv.mlchscale = MLC_YUV_SCALE_CONSTANT;
+		r->yuv.mlcvscale = MLC_YUV_SCALE_CONSTANT;
+		r->yuv.mlcvstride = w * bpp / 8;
+		r->yuv.mlcvstridecb = format == mlc_yuvfmt_444 ? w : w / 2;
+		r->yuv.mlcvstridecr = r->yuv.mlcvstridecb;
+		c->strides[0] = r->yuv.mlcvstride;
+		c->strides[1] = r->yuv.mlcvstridecb;
+		c->strides[2] = r->yuv.mlcvstridecr;
+	}
+
+	op->module = 0;
+	c->planes = raw_plane_sizes(op, c->header, c->sizes, c->addrs);
+
+	/* the chroma planes follow page aligned */
+	if (op->layer == mlc_layer_video) {
+		for (i = 0; i < c->planes; i++) {
+			c->addrs[i] = addr;
+			addr += (c->sizes[i] + IO_MMAP_ALIGN - 1) &
+				~(IO_MMAP_ALIGN - 1);
+		}
+		r->yuv.mlcaddress = c->addrs[0];
+		r->yuv.mlcaddresscb = c->addrs[1];
+		r->yuv.mlcaddresscr = c->addrs[2];
+	}
+
+	for (c->frame = 0, i = 0; i < c->planes; i++)
+		c->frame += c->sizes[i];
+}
+
+/* a simulated device with the layout, its planes mapped */
+static int bench_device_open(struct bench_case *c)
+{
+	const struct iosim_header magic = { .magic = IOSIM_MAGIC };
+	struct iosim_header sh = magic;
+	struct iosim_region regions[4];
+	char backend[40];
+	size_t size;
+	int i, fd, count = 1 + c->planes, ret = -EIO;
+
+	memset(regions, 0, sizeof(regions));
+	regions[0].phys = (size_t)hw_reg_get_base(0);
+	regions[0].size = sizeof(struct mlc_reg);
+	regions[0].layer = IOSIM_LAYER_REGS;
+	for (i = 1; i < count; i++) {
+		regions[i].phys = c->addrs[i - 1];
+		regions[i].size = c->sizes[i - 1];
+		regions[i].layer = c->op->layer;
+		regions[i].plane = i - 1;
+	}
+	size = iosim_layout(regions, count);
+	sh.regions = count;
+
+	strcpy(c->sim, "/tmp/bench-sim-XXXXXX");
+	fd = mkstemp(c->sim);
+	if (fd < 0)
+		return -errno;
+
+	if (!ftruncate(fd, size) &&
+	    pwrite(fd, &sh, sizeof(sh), 0) == sizeof(sh) &&
+	    pwrite(fd, regions, count * sizeof(regions[0]), sizeof(sh)) > 0 &&
+	    pwrite(fd, &c->header->mlc, sizeof(c->header->mlc),
+		   regions[0].offset) == sizeof(c->header->mlc))
+		ret = 0;
+	close(fd);
+	if (ret)
+		return ret;
+
+	snprintf(backend, sizeof(backend), "sim:%s", c->sim);
+	ret = iomem_open(backend);
+	if (ret)
+		return ret;
+
+	c->op->mem = iomem_map(hw_reg_get_base(0), regions[0].size,
+			       &c->mapped[0]);
+	if (!c->op->mem)
+		return -ENOMEM;
+	c->mapped_size[0] = regions[0].size;
+	hw_reg_set_base(0, (void *)c->op->mem);
+
+	for (i = 0; i < c->planes; i++) {
+		c->mem[i] = iomem_map((void *)(size_t)c->addrs[i], c->sizes[i],
+				      &c->mapped[i + 1]);
+		if (!c->mem[i])
+			return -ENOMEM;
+		c->mapped_size[i + 1] = c->sizes[i];
+		memset(c->mem[i], 0x5a + i, c->sizes[i]);
+	}
+
+	return 0;
+}
+
+static void bench_device_close(struct bench_case *c)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		iomem_free(c->mapped[i], c->mapped_size[i]);
+		c->mapped[i] = NULL;
+	}
+	hw_reg_set_base(0, NULL);
+	c->op->mem = NULL;
+
+	iomem_close();
+	unlink(c->sim);
+}
+
+/* device memory to memory, line by line like a capture */
+static int bench_copy(void *data)
+{
+	struct bench_case *c = data;
+	void *dst = c->buf;
+	int i;
+
+	for (i = 0; i < c->planes; i++) {
+		void *src = c->mem[i];
+		void *end = src + c->sizes[i];
+
+		for (; src < end; src += c->strides[i], dst += c->strides[i])
+			memcpy(dst, src, c->strides[i]);
+	}
+
+	return 0;
+}
+
+/* the same in bands of lines on the copy threads */
+static int bench_copy_threads(void *data)
+{
+	struct bench_case *c = data;
+	void *dst = c->buf;
+	int i;
+
+	for (i = 0; i < c->planes; i++) {
+		copypool_copy(c->op->pool, dst, c->mem[i], c->strides[i],
+			      c->sizes[i] / c->strides[i]);
+		dst += c->sizes[i];
+	}
+
+	return 0;
+}
+
+/* a header and a frame in lines to a file, like a capture */
+static int bench_write(void *data)
+{
+	const char sign[4] = RAW_HEADER_SIGN;
+	struct bench_case *c = data;
+	void *src = c->buf, *end = c->buf + c->frame;
+	FILE *fp = fopen(c->capture, "wb");
+
+	if (!fp)
+		return -errno;
+
+	memcpy(c->header->sign, sign, sizeof(sign));
+	fwrite(c->header, 1, RAW_HEADER_SIZE, fp);
+
+	for (; src < end; src += c->strides[0])
+		fwrite(src, 1, c->strides[0], fp);
+
+	return fclose(fp) ? -EIO : 0;
+}
+
+/* the whole capture of a frame on the simulated device */
+static int bench_capture(void *data)
+{
+	struct bench_case *c = data;
+
+	c->op->mode = op_mode_capture;
+	c->op->file = c->capture;
+	c->op->frames = 1;
+
+	return capture_device(c->op);
+}
+
+static int bench_load(void *data)
+{
+	struct bench_case *c = data;
+
+	return util_load_image_fd(c->fd, c->op->plane.fourcc, c->image_planes,
+				  c->width, c->height, c->pitches,
+				  RAW_HEADER_SIZE);
+}
 
-		hw_reg_dump(op->module, &header->mlc);
+static int bench_header(void *data)
+{
+	struct bench_case *c = data;
 
-		fwrite((void *)header, 1, RAW_HEADER_SIZE, fp);
-	} else {
-		fread((void *)header, 1, RAW_HEADER_SIZE, fp);
-		if (strncmp(header->sign, sign, 4)) {
-			fprintf(stderr, "Not found signature !!!\n");
-			return -EINVAL;
-		}
-		op->module = header->module;
-		op->layer = header->layer;
-	}
+	c->op->mode = op_mode_print;
+	c->op->file = c->capture;
 
-	fclose(fp);
+	return raw_image_header(c->op, c->header);
+}
 
-	return 0;
+/* the loaded frame scaled on the cpu, as a replay on a smaller mode */
+static int bench_convert(void *data)
+{
+	struct bench_case *c = data;
+
+	return util_scale_image(c->op->plane.fourcc,
+				c->image_planes, c->pitches,
+				c->width, c->height,
+				c->scaled_planes, c->scaled_pitches,
+				c->width * 3 / 4, c->height * 3 / 4);
 }
 
-static int capture_device(struct op_arg *op)
+/* the copied frame converted and compared to a reference, like -C */
+static int bench_compare(void *data)
 {
-	struct raw_header *header;
+	struct bench_case *c = data;
+	struct compare_image img;
+	struct compare_result r;
 	int ret;
 
-	header = (struct raw_header *)malloc(RAW_HEADER_SIZE);
-	if (!header) {
-		fprintf(stderr, "memory allocation failed\n");
-		return -ENOMEM;
-	}
-	memset(header, 0, RAW_HEADER_SIZE);
-
-	ret = raw_image_header(op, header);
+	ret = compare_image_layer(&img, &c->header->mlc, c->op->layer, c->buf,
+				  c->frame);
 	if (ret)
-		goto __exit_capture;
-
-	if (op->layer == mlc_layer_video)
-		raw_caputre_yuv(op, &header->mlc.yuv);
-	else
-		raw_capture_rgb(op, &header->mlc.rgb[op->layer]);
+		return ret;
 
-__exit_capture:
-	free(header);
+	ret = compare_images(&img, &c->reference, &r, NULL);
+	compare_image_free(&img);
 
 	return ret;
 }
 
-static int update_device(struct op_arg *op)
+static int bench_format(struct bench *b, struct bench_case *c,
+			unsigned int format, int bpp)
 {
-	struct raw_header *header = NULL;
-	struct device dev;
-	struct plane_opt *p = &op->plane;
+	const char *fmt = hw_format_name(format, bpp);
+	char name[64];
 	int ret;
 
-	memset(&dev, 0, sizeof(dev));
+	bench_layout(c, format, bpp);
 
-	dev.fd = drm_open(NULL, DRM_MODULE_NAME);
-	if (dev.fd < 0)
-		return -EINVAL;
+	ret = bench_device_open(c);
+	if (ret)
+		goto __exit_format;
 
-	header = (struct raw_header *)malloc(RAW_HEADER_SIZE);
-	if (!header) {
-		fprintf(stderr, "memory allocation failed\n");
-		return -ENOMEM;
+	snprintf(name, sizeof(name), "copy/%ux%u/%s", c->width, c->height, fmt);
+	ret = bench_run(b, name, c->frame, bench_copy, c);
+	if (ret)
+		goto __exit_format;
+
+	if (c->op->pool) {
+		snprintf(name, sizeof(name), "copy-threads/%ux%u/%s",
+			 c->width, c->height, fmt);
+		ret = bench_run(b, name, c->frame, bench_copy_threads, c);
+		if (ret)
+			goto __exit_format;
 	}
-	memset(header, 0, RAW_HEADER_SIZE);
 
-	ret = raw_image_header(op, header);
+	snprintf(name, sizeof(name), "capture/%ux%u/%s", c->width, c->height,
+		 fmt);
+	ret = bench_run(b, name, c->frame, bench_capture, c);
 	if (ret)
-		goto __exit_update;
-
-	dev.resources = drm_get_resources(&dev);
-	if (!dev.resources) {
-		ret = -EINVAL;
-		goto __exit_update;
+		goto __exit_format;
+
+	/* the capture back as the replay loads it */
+	format_to_fourcc(c->op, c->header);
+	c->image = util_image_alloc(c->op->plane.fourcc, c->width, c->height,
+				    c->image_planes, c->pitches);
+	c->fd = open(c->capture, O_RDONLY);
+	if (!c->image || c->fd < 0) {
+		ret = -ENOMEM;
+		goto __exit_format;
 	}
 
-	ret = get_drm_ids(op, &dev);
+	snprintf(name, sizeof(name), "load/%ux%u/%s", c->width, c->height, fmt);
+	ret = bench_run(b, name, c->frame, bench_load, c);
 	if (ret)
-		goto __exit_update;
-
-	fprintf(stdout, "set mlc.%d layer.%d -> crt.%d plane.%d\n",
-		op->module, op->layer,
-		op->plane.crtc_id, op->plane.plane_id);
+		goto __exit_format;
+
+	c->scaled = util_image_alloc(c->op->plane.fourcc, c->width * 3 / 4,
+				     c->height * 3 / 4, c->scaled_planes,
+				     c->scaled_pitches);
+	if (!c->scaled) {
+		ret = -ENOMEM;
+		goto __exit_format;
+	}
 
-	ret = format_to_fourcc(op, header);
+	snprintf(name, sizeof(name), "convert/%ux%u/%s", c->width, c->height,
+		 fmt);
+	ret = bench_run(b, name, c->frame, bench_convert, c);
 	if (ret)
-		goto __exit_update;
+		goto __exit_format;
 
-	ret = set_plane_rect(op, header);
+	/* the device frame copied, against itself */
+	bench_layout(c, format, bpp);
+	bench_copy(c);
+	ret = compare_image_layer(&c->reference, &c->header->mlc,
+				  c->op->layer, c->buf, c->frame);
 	if (ret)
-		goto __exit_update;
+		goto __exit_format;
+
+	snprintf(name, sizeof(name), "compare/%ux%u/%s", c->width, c->height,
+		 fmt);
+	ret = bench_run(b, name, c->frame, bench_compare, c);
+
+__exit_format:
+	if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+	free(c->image);
+	c->image = NULL;
+	free(c->scaled);
+	c->scaled = NULL;
+	compare_image_free(&c->reference);
+	bench_device_close(c);
 
-	fprintf(stdout, "src %d,%d, %d x %d %dbpp, %s(0x%x) - %s(0x%x)\n",
-		op->plane.src_x, op->plane.src_y, op->plane.src_w,
-		op->plane.src_h,
-		op->bpp, hw_format_name(op->hw_format, op->bpp),
-		op->hw_format,
-		util_format_name(op->plane.fourcc),
-		op->plane.fourcc);
+	return ret;
+}
 
-	ret = set_plane_image(op, header);
-	if (ret)
-		goto __exit_update;
+/*
+ * The capture, load and conversion paths on simulated devices of the
+ * common sizes in every format. stdout has the chatter of the capture
+ * path, it is quiet while the cases run.
+ */
+static int bench_device(struct op_arg *op)
+{
+	struct bench_case c;
+	struct bench *b;
+	unsigned int i, n;
+	int out, null, ret = -ENOMEM;
+
+	memset(&c, 0, sizeof(c));
+	c.op = op;
+	c.fd = -1;
+	strcpy(c.capture, "/tmp/bench-capture-XXXXXX");
+
+	b = bench_create(op->bench_baseline);
+	c.header = malloc(RAW_HEADER_SIZE);
+	c.buf = malloc(bench_sizes[ARRAY_SIZE(bench_sizes) - 1].width *
+		       bench_sizes[ARRAY_SIZE(bench_sizes) - 1].height * 4);
+	out = mkstemp(c.capture);
+	if (!b || !c.header || !c.buf || out < 0)
+		goto __exit_bench;
+	close(out);
+
+	fflush(stdout);
+	out = dup(STDOUT_FILENO);
+	null = open("/dev/null", O_WRONLY);
+	if (null >= 0) {
+		dup2(null, STDOUT_FILENO);
+		close(null);
+	}
 
-	drm_set_plane(&dev, p);
+	for (i = 0, ret = 0; i < ARRAY_SIZE(bench_sizes) && !ret; i++) {
+		c.width = bench_sizes[i].width;
+		c.height = bench_sizes[i].height;
 
-	set_mlc_property(op, &header->mlc);
+		for (n = 0; n < ARRAY_SIZE(bench_formats) && !ret; n++)
+			ret = bench_format(b, &c, bench_formats[n].format,
+					   bench_formats[n].bpp);
 
-	/* wait */
-	getchar();
-	drm_clear_plane(&dev, p);
+		if (!ret) {
+			char name[64];
 
-	drm_free_resources(dev.resources);
+			bench_layout(&c, mlc_rgbfmt_x8r8g8b8, 32);
+			snprintf(name, sizeof(name), "write/%ux%u",
+				 c.width, c.height);
+			ret = bench_run(b, name, c.frame, bench_write, &c);
+		}
+	}
 
-__exit_update:
-	if (header)
-		free(header);
+	if (!ret)
+		ret = bench_run(b, "header", RAW_HEADER_SIZE, bench_header, &c);
+
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
 
-	if (dev.fd >= 0)
-		drm_close(dev.fd);
+	if (!ret)
+		ret = bench_report(b, op->bench);
+
+__exit_bench:
+	unlink(c.capture);
+	free(c.buf);
+	free(c.header);
+	bench_destroy(b);
 
 	return ret;
 }
 
 static int print_device(struct op_arg *op)
 {
+	if (op->status != status_format_none)
+		return status_device(op);
+
 	switch (op->layer) {
 	case mlc_layer_rgb0:
 	case mlc_layer_rgb1:
@@ -1057,34 +4080,223 @@ static int parse_file(struct op_arg *op)
 	return 0;
 }
 
-static int parse_arg(char *arg, struct op_arg *op)
+/*
+ * A batch runs the operations of a script in one process, on the same
+ * module mapping and drm device, one a line:
+ *   capture <dev>,<layer>,<file> [<frames>]
+ *   print <dev>[,<layer>]
+ *   info <file>
+ *   compare <capture>,<reference>[,<mask.bmp>]
+ *   replay <file>[,<file>..] [<msec>]
+ *   sleep <msec>
+ *   vblank [<pipe>]
+ * Empty lines and the ones from a '#' are skipped, the first failing
+ * operation stops it, a compare that differs does not fail.
+ */
+#define BATCH_MAX_ARGS		4
+
+struct batch {
+	struct op_arg *op;	/* the options every operation starts from */
+	struct capture_module *modules[NUMBER_OF_MLC_MODULE];
+	struct device dev;	/* opened on the first replay or vblank */
+};
+
+/* the whole script, a replay reads its controls from stdin after it */
+static char *batch_read(const char *file)
 {
-	char *end;
+	FILE *fp = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	char *buf = NULL, *p;
+	size_t len = 0, size = 0, n;
 
-	op->module = strtoul(arg, &end, 10);
-	if (op->module >= hw_reg_get_module_num()) {
-		fprintf(stderr, "Fail, not support module.%d\n", op->module);
-		return -EINVAL;
+	if (!fp) {
+		fprintf(stderr, "Error file %s\n", file);
+		return NULL;
 	}
 
-	if (*end != ',')
-		return op->mode == op_mode_print ? 0 : -EINVAL;
+	do {
+		if (size - len < 4096) {
+			size += 64 * 1024;
+			p = realloc(buf, size);
+			if (!p) {
+				free(buf);
+				buf = NULL;
+				break;
+			}
+			buf = p;
+		}
+		n = fread(buf + len, 1, size - len - 1, fp);
+		len += n;
+		buf[len] = '\0';
+	} while (n);
 
-	arg = end +  1;
-	op->layer = strtoul(arg, &end, 10);
-	if ((int)op->layer >= hw_reg_get_layer_num(op->module)) {
-		fprintf(stderr, "Fail, not support module.%d - layer.%d\n",
-			op->module, op->layer);
+	if (fp != stdin)
+		fclose(fp);
+
+	return buf;
+}
+
+static int batch_drm(struct batch *b)
+{
+	if (b->dev.fd >= 0)
+		return 0;
+
+	return replay_device_open(b->op, &b->dev);
+}
+
+static int batch_replay(struct batch *b, struct op_arg *op, char **argv,
+			int argc)
+{
+	char *file, *save;
+	int ret;
+
+	op->mode = op_mode_update;
+	for (file = strtok_r(argv[1], ",", &save);
+	     file && op->nr_files < mlc_layer_unknown;
+	     file = strtok_r(NULL, ",", &save))
+		op->files[op->nr_files++] = file;
+	op->file = op->files[0];
+	if (argc > 2)
+		op->replay.duration = strtoul(argv[2], NULL, 10);
+
+	ret = batch_drm(b);
+	if (!ret)
+		ret = replay_module(op);
+	if (!ret)
+		ret = update_device_replay(op, &b->dev);
+
+	return ret;
+}
+
+static int batch_op(struct batch *b, char **argv, int argc)
+{
+	struct op_arg op = *b->op;
+	struct timespec ts;
+	uint64_t us;
+	unsigned int msec;
+	int ret;
+
+	op.module = 0;
+	op.layer = mlc_layer_unknown;
+	op.file = NULL;
+	op.fp = NULL;
+	op.nr_files = 0;
+	op.frames = 0;
+
+	if (!strcmp(argv[0], "capture") && argc > 1) {
+		op.mode = op_mode_capture;
+		ret = parse_arg(argv[1], &op);
+		if (ret)
+			return ret;
+		if (argc > 2)
+			op.frames = strtoul(argv[2], NULL, 10);
+		ret = capture_device(&op);
+	} else if (!strcmp(argv[0], "print") && argc > 1) {
+		op.mode = op_mode_print;
+		ret = parse_arg(argv[1], &op);
+		if (!ret)
+			ret = print_device(&op);
+	} else if (!strcmp(argv[0], "compare") && argc > 1) {
+		/* a difference is in its line, the script goes on */
+		ret = compare_files(argv[1]);
+		if (ret > 0)
+			ret = 0;
+	} else if (!strcmp(argv[0], "info") && argc > 1) {
+		op.file = argv[1];
+		ret = parse_file(&op);
+	} else if (!strcmp(argv[0], "replay") && argc > 1) {
+		ret = batch_replay(b, &op, argv, argc);
+	} else if (!strcmp(argv[0], "sleep") && argc > 1) {
+		msec = strtoul(argv[1], NULL, 10);
+		ts.tv_sec = msec / 1000;
+		ts.tv_nsec = (msec % 1000) * 1000000;
+		while (nanosleep(&ts, &ts) && errno == EINTR)
+			;
+		ret = 0;
+	} else if (!strcmp(argv[0], "vblank")) {
+		ret = batch_drm(b);
+		if (!ret)
+			ret = drm_wait_vblank(&b->dev, argc > 1 ?
+					      strtoul(argv[1], NULL, 10) : 0,
+					      &us);
+	} else {
+		ret = -EINVAL;
+	}
+
+	return ret > 0 ? -ret : ret;
+}
+
+static int batch_device(struct op_arg *op)
+{
+	struct batch b;
+	char *script, *line, *next, *argv[BATCH_MAX_ARGS], *save;
+	uint64_t start = time_us();
+	int argc, nr = 0, ops = 0, ret;
+
+	memset(&b, 0, sizeof(b));
+	b.op = op;
+	b.dev.fd = -1;
+
+	script = batch_read(op->batch);
+	if (!script)
 		return -EINVAL;
+
+	ret = map_modules(b.modules);
+
+	for (line = script; line && !ret; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		nr++;
+
+		if (strchr(line, '#'))
+			*strchr(line, '#') = '\0';
+
+		for (argc = 0, argv[0] = strtok_r(line, " \t\r", &save);
+		     argv[argc] && argc < BATCH_MAX_ARGS - 1;
+		     argv[argc] = strtok_r(NULL, " \t\r", &save))
+			argc++;
+		if (!argc)
+			continue;
+
+		ret = batch_op(&b, argv, argc);
+		if (ret)
+			fprintf(stderr, "%s:%d: %s failed, %s\n", op->batch, nr,
+				argv[0], strerror(-ret));
+		ops++;
 	}
 
-	if (*end != ',')
-		return op->mode == op_mode_print ? 0 : -EINVAL;
+	fprintf(stdout, "batch %d operations, %llums\n", ops,
+		(unsigned long long)(time_us() - start) / 1000);
 
-	arg = end +  1;
-	op->file = arg;
+	replay_device_close(&b.dev);
+	unmap_modules(b.modules);
+	free(script);
 
-	return 0;
+	return ret;
+}
+
+/* <w>x<h>[@<hz>] or @<hz> */
+static int parse_mode(const char *arg, struct plane_opt *p)
+{
+	char *end = (char *)arg;
+
+	if (*arg != '@') {
+		p->mode_w = strtoul(arg, &end, 10);
+		if (*end != 'x')
+			return -EINVAL;
+
+		p->mode_h = strtoul(end + 1, &end, 10);
+		if (!p->mode_w || !p->mode_h)
+			return -EINVAL;
+	}
+
+	if (*end == '@') {
+		p->mode_hz = strtoul(end + 1, &end, 10);
+		if (!p->mode_hz)
+			return -EINVAL;
+	}
+
+	return *end ? -EINVAL : 0;
 }
 
 static void usage(char *name)
@@ -1094,23 +4306,137 @@ static void usage(char *name)
 	fprintf(stdout,
 		"\t-c <dev>,<layer>,<file>\tcapture <dev>'s <layer> to <file>\n");
 	fprintf(stdout, "\t-s <file>\t\tstore <file> with header info\n");
+	fprintf(stdout,
+		"\t\t\t\tagain for each layer of the module to restore at once\n");
 	fprintf(stdout,
 		"\t-p <dev>,<layer>\tprint <dev> and <layer>'s hw register\n");
 	fprintf(stdout, "\t-i <file>\t\tprint <file>'s hw register\n");
+	fprintf(stdout,
+		"\t-C <file>,<ref>[,<mask>]\tcompare a capture to a capture or BMP <ref>, a BMP diff <mask>\n");
+	fprintf(stdout,
+		"\t--json, --binary\tprint all the modules decoded, in one write\n");
+	fprintf(stdout,
+		"\t--bench <out>\t\tbenchmark the capture and load paths to json <out>\n");
+	fprintf(stdout,
+		"\t--baseline <file>\tcompare the benchmark to an earlier <out>\n");
+	fprintf(stdout,
+		"\t--perf\t\t\tcount cycles, cache and bus accesses of the capture and load\n");
+	fprintf(stdout,
+		"\t--monitor <msec>\tlayer flip rates every <msec>, a json line with --json\n");
+	fprintf(stdout,
+		"\t--timeline <file>\tchrome trace json of the capture and replay events\n");
+	fprintf(stdout,
+		"\t--watchdog <msec>[,<check>]\texit 1 on a layer unchanged for <msec>, events to -S clients\n");
+	fprintf(stdout,
+		"\t--daemon <path>\t\tserve print, capture and replay requests on <path>\n");
+	fprintf(stdout,
+		"\t--batch <script>\trun the operations of <script>, - is stdin, in one process\n");
 	fprintf(stdout, "\t-g \t\tdisable gamma\n");
+	fprintf(stdout, "\t-a \t\tatomic modesetting for replay\n");
+	fprintf(stdout,
+		"\t-z \t\tzero copy replay from udmabuf, dumb buffer if not\n");
+	fprintf(stdout, "\t-n <count>\t\tcapture <count> frames with -c\n");
+	fprintf(stdout,
+		"\t--every <msec>\t\tcapture a frame every <msec>, -n times, for -t or until a signal\n");
+	fprintf(stdout,
+		"\t--rt <prio>\t\trun the --every capture SCHED_FIFO at <prio>\n");
+	fprintf(stdout, "\t--cpu <cpu>\t\trun the --every capture on <cpu>\n");
+	fprintf(stdout,
+		"\t--mlock\t\t\tlock the memory of the --every capture\n");
+	fprintf(stdout,
+		"\t--threads <n>\t\tcopy the rows of a capture on <n> threads\n");
+	fprintf(stdout,
+		"\t--stream <kb>\t\tcapture through one <kb> chunk, a working set of fixed size\n");
+	fprintf(stdout,
+		"\t-r <fps>\t\treplay frame rate, default is the --every rate or the vblank\n");
+	fprintf(stdout, "\t-x <speed>\t\treplay speed factor\n");
+	fprintf(stdout, "\t-k <frame>\t\tstart replay at <frame>\n");
+	fprintf(stdout,
+		"\t-l <loops>\t\treplay <loops> times, 0 is forever (default 1)\n");
+	fprintf(stdout,
+		"\t-D <driver>\t\tDRM driver for replay (default %s)\n",
+		CAPTURE_DRM_DRIVER);
+	fprintf(stdout,
+		"\t-m <w>x<h>[@<hz>]\tdisplay mode for replay, or just @<hz>\n");
+	fprintf(stdout,
+		"\t-t <msec>\t\tdisplay, trace or monitor for <msec> then quit\n");
+	fprintf(stdout,
+		"\t-S <path>\t\tcontrol socket, takes the stdin controls\n");
+	fprintf(stdout,
+		"\t-T <file>\t\ttrace register changes to <file> until quit\n");
+	fprintf(stdout,
+		"\t-f <regs>\t\tregisters to trace (default mlc0,mlc1)\n");
+	fprintf(stdout,
+		"\t-F <hz>\t\t\ttrace or monitor sample rate without vblank (default 1000, up to 1000000)\n");
+	fprintf(stdout,
+		"\t-e <trace>,<out>\texport <trace> to a .vcd or .csv <out>\n");
+	fprintf(stdout,
+		"\t-B <backend>\t\tmem (default), uio:<dev> or sim:<file>[@<hz>]\n");
+	fprintf(stdout,
+		"\t-M <file>,<sim>\tmake a simulated device of a capture <file>\n");
 	fprintf(stderr, " Info:\n");
 	fprintf(stderr, "\t<dev>\tsupport 0,1\n");
 	fprintf(stderr, "\t<layer>\t0=RGB.0, 1=RGB.1, 2=Video layer\n");
+	fprintf(stderr,
+		"\treplay controls on stdin: q quit, p pause, k <frame> seek, x <speed> speed\n");
+	fprintf(stderr, "\tSIGINT and SIGTERM take the plane down and quit\n");
+	fprintf(stderr,
+		"\t<regs>\tmlc<dev> for its layout or mlc<dev>.<reg>, e.g. mlc0.rgb1.address\n");
+	fprintf(stderr,
+		"\tsim:<file>@<hz> flips the layer through the captured frames\n");
+	fprintf(stderr,
+		"\ton another mode size the layer is scaled to keep its place\n");
 
 	exit(0);
 }
 
+enum {
+	OPT_JSON = 0x100,
+	OPT_BINARY,
+	OPT_BENCH,
+	OPT_BASELINE,
+	OPT_PERF,
+	OPT_MONITOR,
+	OPT_TIMELINE,
+	OPT_DAEMON,
+	OPT_BATCH,
+	OPT_EVERY,
+	OPT_RT,
+	OPT_CPU,
+	OPT_MLOCK,
+	OPT_THREADS,
+	OPT_STREAM,
+	OPT_WATCHDOG,
+};
+
+static const struct option long_options[] = {
+	{ "json", no_argument, NULL, OPT_JSON },
+	{ "binary", no_argument, NULL, OPT_BINARY },
+	{ "bench", required_argument, NULL, OPT_BENCH },
+	{ "baseline", required_argument, NULL, OPT_BASELINE },
+	{ "perf", no_argument, NULL, OPT_PERF },
+	{ "monitor", required_argument, NULL, OPT_MONITOR },
+	{ "timeline", required_argument, NULL, OPT_TIMELINE },
+	{ "daemon", required_argument, NULL, OPT_DAEMON },
+	{ "batch", required_argument, NULL, OPT_BATCH },
+	{ "every", required_argument, NULL, OPT_EVERY },
+	{ "rt", required_argument, NULL, OPT_RT },
+	{ "cpu", required_argument, NULL, OPT_CPU },
+	{ "mlock", no_argument, NULL, OPT_MLOCK },
+	{ "threads", required_argument, NULL, OPT_THREADS },
+	{ "stream", required_argument, NULL, OPT_STREAM },
+	{ "watchdog", required_argument, NULL, OPT_WATCHDOG },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 },
+};
+
 int main(int argc, char **argv)
 {
 	struct op_arg *op = NULL;
 	int opt;
+	char *end;
 	const void *addr;
-	void *mem = NULL;
+	void *mem = NULL, *mapped = NULL;
 	size_t size = 0;
 	int ret = -EINVAL;
 
@@ -1121,8 +4447,16 @@ int main(int argc, char **argv)
 	}
 	memset(op, 0, sizeof(*op));
 	op->layer = mlc_layer_unknown;
-
-	while (-1 != (opt = getopt(argc, argv, "hc:s:p:i:g")))
+	op->driver = CAPTURE_DRM_DRIVER;
+	op->replay.speed = 1;
+	op->replay.loops = 1;
+	op->replay.stop = -1;
+	op->trace_rate = 1000;
+	op->cpu = -1;
+
+	while (-1 != (opt = getopt_long(argc, argv,
+					"hc:s:p:i:C:gazn:r:x:k:l:D:m:t:S:T:f:F:e:B:M:",
+					long_options, NULL)))
 		switch (opt) {
 		case 'c':
 			op->mode = op_mode_capture;
@@ -1130,7 +4464,14 @@ int main(int argc, char **argv)
 			break;
 		case 's':
 			op->mode = op_mode_update;
-			op->file = optarg;
+			if (op->nr_files == mlc_layer_unknown) {
+				fprintf(stderr, "Fail, over %d layers\n",
+					mlc_layer_unknown);
+				ret = -EINVAL;
+				break;
+			}
+			op->files[op->nr_files++] = optarg;
+			op->file = op->files[0];
 			ret = 0;
 			break;
 		case 'p':
@@ -1143,9 +4484,153 @@ int main(int argc, char **argv)
 			if (!ret)
 				return 0;
 			break;
+		case 'C':
+			ret = compare_files(optarg);
+			if (ret >= 0)
+				return ret;
+			break;
 		case 'g':
 			op->flags |= FLAG_GAMMAN_OFF;
 			break;
+		case 'a':
+			op->flags |= FLAG_ATOMIC;
+			break;
+		case 'z':
+			op->flags |= FLAG_UDMABUF;
+			break;
+		case 'n':
+			op->frames = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			op->replay.rate = strtod(optarg, NULL);
+			break;
+		case 'x':
+			op->replay.speed = strtod(optarg, NULL);
+			if (op->replay.speed <= 0)
+				op->replay.speed = 1;
+			break;
+		case 'k':
+			op->replay.start = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			op->replay.loops = strtoul(optarg, NULL, 10);
+			break;
+		case 'D':
+			op->driver = optarg;
+			break;
+		case 'm':
+			if (parse_mode(optarg, &op->plane)) {
+				fprintf(stderr, "Fail, mode %s\n", optarg);
+				ret = -EINVAL;
+				goto __exit;
+			}
+			break;
+		case 't':
+			op->replay.duration = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			op->replay.control = optarg;
+			break;
+		case 'T':
+			op->mode = op_mode_trace;
+			op->file = optarg;
+			ret = 0;
+			break;
+		case 'f':
+			op->trace_regs = optarg;
+			break;
+		case 'F':
+			op->trace_rate = strtoul(optarg, NULL, 10);
+			if (!op->trace_rate)
+				op->trace_rate = 1000;
+			if (op->trace_rate > REGTRACE_MAX_RATE) {
+				fprintf(stderr, "rate %s over %u Hz, at %u\n",
+					optarg, REGTRACE_MAX_RATE,
+					REGTRACE_MAX_RATE);
+				op->trace_rate = REGTRACE_MAX_RATE;
+			}
+			break;
+		case 'e':
+			ret = export_trace(optarg);
+			if (!ret)
+				return 0;
+			break;
+		case 'B':
+			op->backend = optarg;
+			break;
+		case 'M':
+			ret = make_sim(op, optarg);
+			if (!ret)
+				return 0;
+			break;
+		case OPT_JSON:
+			op->status = status_format_json;
+			ret = 0;
+			break;
+		case OPT_BINARY:
+			op->status = status_format_binary;
+			ret = 0;
+			break;
+		case OPT_BENCH:
+			op->bench = optarg;
+			ret = 0;
+			break;
+		case OPT_BASELINE:
+			op->bench_baseline = optarg;
+			break;
+		case OPT_PERF:
+			if (!op->perf)
+				op->perf = perf_create(perf_stages,
+						       ARRAY_SIZE(perf_stages));
+			break;
+		case OPT_MONITOR:
+			op->mode = op_mode_monitor;
+			op->monitor = strtoul(optarg, NULL, 10);
+			ret = 0;
+			break;
+		case OPT_TIMELINE:
+			if (timeline_open(optarg)) {
+				ret = -EINVAL;
+				goto __exit;
+			}
+			break;
+		case OPT_DAEMON:
+			op->mode = op_mode_daemon;
+			op->daemon = optarg;
+			ret = 0;
+			break;
+		case OPT_BATCH:
+			op->mode = op_mode_batch;
+			op->batch = optarg;
+			ret = 0;
+			break;
+		case OPT_EVERY:
+			op->every = strtoul(optarg, NULL, 10);
+			break;
+		case OPT_RT:
+			op->rt_prio = strtol(optarg, NULL, 10);
+			break;
+		case OPT_CPU:
+			op->cpu = strtol(optarg, NULL, 10);
+			break;
+		case OPT_MLOCK:
+			op->mlock = true;
+			break;
+		case OPT_THREADS:
+			op->threads = strtoul(optarg, NULL, 10);
+			break;
+		case OPT_WATCHDOG:
+			op->mode = op_mode_watchdog;
+			op->watchdog = strtoul(optarg, &end, 10);
+			if (*end == ',')
+				op->watchdog_check = strtoul(end + 1, NULL, 10);
+			ret = 0;
+			break;
+		case OPT_STREAM:
+			stream_destroy(op->stream);
+			op->stream = stream_create(strtoul(optarg, NULL, 10) *
+						   1024);
+			break;
 		case 'h':
 			usage(argv[0]);
 			exit(0);
@@ -1158,6 +4643,33 @@ int main(int argc, char **argv)
 		goto __exit;
 	}
 
+	/* the workers keep off the cpu of --cpu */
+	if (op->threads)
+		op->pool = copypool_create(op->threads, op->cpu);
+
+	/* on simulated devices of its own */
+	if (op->bench) {
+		ret = bench_device(op);
+		goto __exit;
+	}
+
+	/* replay on an other display such as vkms has no mlc registers */
+	if (op->mode == op_mode_update && strcmp(op->driver, CAPTURE_DRM_DRIVER)) {
+		ret = update_device(op);
+		goto __exit;
+	}
+
+	ret = capture_init(op->backend);
+	if (ret)
+		goto __exit;
+
+	/* a replay maps the module of its capture, not the -m one */
+	if (op->mode == op_mode_update) {
+		ret = replay_module(op);
+		if (ret)
+			goto __exit;
+	}
+
 	addr = hw_reg_get_base(op->module);
 	if (addr == NULL) {
 		fprintf(stderr, "Fail, not support module.%d\n", op->module);
@@ -1166,7 +4678,7 @@ int main(int argc, char **argv)
 	}
 	size = hw_reg_get_length(op->module);
 
-	mem = iomem_map(addr, size, NULL);
+	mem = iomem_map(addr, size, &mapped);
 	if (mem == NULL) {
 		fprintf(stderr, "Fail, module %d, map %p\n",
 			op->module, addr);
@@ -1178,7 +4690,10 @@ int main(int argc, char **argv)
 	op->addr = addr;
 	op->mem = mem;
 
-	fprintf(stdout, "reg mlc %p -> %p %dbyte\n", addr, mem, (int)size);
+	if (op->status == status_format_none && !op->monitor &&
+	    op->mode != op_mode_daemon)
+		fprintf(stdout, "reg mlc %p -> %p %dbyte\n",
+			addr, mem, (int)size);
 
 	switch (op->mode) {
 	case op_mode_print:
@@ -1190,9 +4705,33 @@ int main(int argc, char **argv)
 	case op_mode_update:
 		ret = update_device(op);
 		break;
+	case op_mode_trace:
+		ret = trace_device(op);
+		break;
+	case op_mode_monitor:
+		ret = monitor_device(op);
+		break;
+	case op_mode_daemon:
+		ret = daemon_device(op);
+		break;
+	case op_mode_batch:
+		ret = batch_device(op);
+		break;
+	case op_mode_watchdog:
+		ret = watchdog_device(op);
+		break;
 	}
 __exit:
-	iomem_free(mem, size);
+	timeline_close();
+	perf_report(op->perf, stdout);
+	perf_destroy(op->perf);
+	copypool_report(op->pool, stdout);
+	copypool_destroy(op->pool);
+	free(op->staging);
+	stream_report(op->stream, stdout);
+	stream_destroy(op->stream);
+	iomem_free(mapped, size);
+	capture_exit();
 	free(op);
 
 	return ret;
@@ -0,0 +1,710 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "compare.h"
+#include "io.h"
+
+/* 16 lanes, NEON on arm and SSE2 on x86 */
+typedef uint8_t compare_u8 __attribute__((vector_size(16)));
+typedef uint16_t compare_u16 __attribute__((vector_size(16)));
+typedef uint32_t compare_u32 __attribute__((vector_size(16)));
+
+#define COMPARE_LANES		16
+/* u8 counts overflow past 255 runs of the kernel */
+#define COMPARE_BLOCK		255
+
+#define COMPARE_C1		(0.01 * 255 * 0.01 * 255)
+#define COMPARE_C2		(0.03 * 255 * 0.03 * 255)
+
+struct compare_rgb {
+	unsigned int format;
+	struct {
+		unsigned int length, offset;
+	} r, g, b;
+};
+
+/* the color components of the rgb formats, the alpha left out */
+static const struct compare_rgb compare_rgb_formats[] = {
+	{ mlc_rgbfmt_r5g6b5, { 5, 11 }, { 6, 5 }, { 5, 0 } },
+	{ mlc_rgbfmt_b5g6r5, { 5, 0 }, { 6, 5 }, { 5, 11 } },
+	{ mlc_rgbfmt_x1r5g5b5, { 5, 10 }, { 5, 5 }, { 5, 0 } },
+	{ mlc_rgbfmt_x1b5g5r5, { 5, 0 }, { 5, 5 }, { 5, 10 } },
+	{ mlc_rgbfmt_a1r5g5b5, { 5, 10 }, { 5, 5 }, { 5, 0 } },
+	{ mlc_rgbfmt_a1b5g5r5, { 5, 0 }, { 5, 5 }, { 5, 10 } },
+	{ mlc_rgbfmt_x4r4g4b4, { 4, 8 }, { 4, 4 }, { 4, 0 } },
+	{ mlc_rgbfmt_x4b4g4r4, { 4, 0 }, { 4, 4 }, { 4, 8 } },
+	{ mlc_rgbfmt_a4r4g4b4, { 4, 8 }, { 4, 4 }, { 4, 0 } },
+	{ mlc_rgbfmt_a4b4g4r4, { 4, 0 }, { 4, 4 }, { 4, 8 } },
+	{ mlc_rgbfmt_x8r3g3b2, { 3, 5 }, { 3, 2 }, { 2, 0 } },
+	{ mlc_rgbfmt_x8b3g3r2, { 2, 0 }, { 3, 2 }, { 3, 5 } },
+	{ mlc_rgbfmt_a8r3g3b2, { 3, 5 }, { 3, 2 }, { 2, 0 } },
+	{ mlc_rgbfmt_a8b3g3r2, { 2, 0 }, { 3, 2 }, { 3, 5 } },
+	/* and x8r8g8b8, x8b8g8r8 at 4 bytes a pixel */
+	{ mlc_rgbfmt_r8g8b8, { 8, 16 }, { 8, 8 }, { 8, 0 } },
+	{ mlc_rgbfmt_b8g8r8, { 8, 0 }, { 8, 8 }, { 8, 16 } },
+	{ mlc_rgbfmt_a8r8g8b8, { 8, 16 }, { 8, 8 }, { 8, 0 } },
+	{ mlc_rgbfmt_a8b8g8r8, { 8, 0 }, { 8, 8 }, { 8, 16 } },
+};
+
+/* a component to 8 bits, its high bits repeated in the low ones */
+static inline uint8_t compare_expand(uint32_t pixel, unsigned int length,
+				     unsigned int offset)
+{
+	uint32_t v = (pixel >> offset) & ((1u << length) - 1);
+
+	v <<= 8 - length;
+	while (length < 8) {
+		v |= v >> length;
+		length *= 2;
+	}
+
+	return v;
+}
+
+static inline uint8_t compare_clamp(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline uint8_t compare_luma_of(uint8_t r, uint8_t g, uint8_t b)
+{
+	return (77 * r + 150 * g + 29 * b) >> 8;
+}
+
+static int compare_image_alloc(struct compare_image *img, unsigned int width,
+			       unsigned int height)
+{
+	size_t size = (size_t)width * height;
+	int i;
+
+	memset(img, 0, sizeof(*img));
+	if (!size)
+		return -EINVAL;
+
+	img->width = width;
+	img->height = height;
+	img->planes[0] = malloc(size * compare_planes);
+	if (!img->planes[0])
+		return -ENOMEM;
+	for (i = 1; i < compare_planes; i++)
+		img->planes[i] = img->planes[0] + size * i;
+
+	return 0;
+}
+
+void compare_image_free(struct compare_image *img)
+{
+	free(img->planes[0]);
+	memset(img, 0, sizeof(*img));
+}
+
+static void compare_set(struct compare_image *img, size_t i, uint8_t r,
+			uint8_t g, uint8_t b)
+{
+	img->planes[compare_red][i] = r;
+	img->planes[compare_green][i] = g;
+	img->planes[compare_blue][i] = b;
+	img->planes[compare_luma][i] = compare_luma_of(r, g, b);
+}
+
+static int compare_rgb_layer(struct compare_image *img,
+			     const struct mlcrgblayer *reg, const void *buf,
+			     size_t size)
+{
+	unsigned int format = reg->mlccontrol & _maskbit(16, 16);
+	const struct compare_rgb *f = NULL;
+	unsigned int width, height, x, y, bpp, i;
+	const uint8_t *p;
+	uint32_t pixel;
+	int ret;
+
+	for (i = 0; i < sizeof(compare_rgb_formats) /
+			sizeof(compare_rgb_formats[0]); i++)
+		if (compare_rgb_formats[i].format == format)
+			f = &compare_rgb_formats[i];
+	if (!f) {
+		fprintf(stderr, "Fail, not support 0x%x format\n", format);
+		return -EINVAL;
+	}
+
+	width = _getbits(reg->mlcleftright, 0, 11) -
+		_getbits(reg->mlcleftright, 16, 11) + 1;
+	height = _getbits(reg->mlctopbottom, 0, 11) -
+		 _getbits(reg->mlctopbottom, 16, 11) + 1;
+	bpp = reg->mlchstride;
+	if (bpp < 1 || bpp > 4 || width * bpp > (unsigned int)reg->mlcvstride ||
+	    (size_t)reg->mlcvstride * height > size)
+		return -EINVAL;
+
+	ret = compare_image_alloc(img, width, height);
+	if (ret)
+		return ret;
+
+	for (y = 0, i = 0; y < height; y++) {
+		p = buf + (size_t)reg->mlcvstride * y;
+		for (x = 0; x < width; x++, i++, p += bpp) {
+			/* little endian pixels */
+			pixel = p[0];
+			if (bpp > 1)
+				pixel |= (uint32_t)p[1] << 8;
+			if (bpp > 2)
+				pixel |= (uint32_t)p[2] << 16;
+			if (bpp > 3)
+				pixel |= (uint32_t)p[3] << 24;
+			compare_set(img, i,
+				    compare_expand(pixel, f->r.length, f->r.offset),
+				    compare_expand(pixel, f->g.length, f->g.offset),
+				    compare_expand(pixel, f->b.length, f->b.offset));
+		}
+	}
+
+	return 0;
+}
+
+/* BT.601 limited range */
+static void compare_set_yuv(struct compare_image *img, size_t i, int y,
+			    int u, int v)
+{
+	int c = 298 * (y - 16), d = u - 128, e = v - 128;
+
+	compare_set(img, i, compare_clamp((c + 409 * e + 128) >> 8),
+		    compare_clamp((c - 100 * d - 208 * e + 128) >> 8),
+		    compare_clamp((c + 516 * d + 128) >> 8));
+}
+
+static int compare_yuv_layer(struct compare_image *img,
+			     const struct mlcyuvlayer *reg, const void *buf,
+			     size_t size)
+{
+	unsigned int format = reg->mlccontrol & _maskbit(16, 3);
+	unsigned int width, height, rows, x, y, cy, xsub = 1, ysub = 1;
+	unsigned int cbcr = 0;	/* the cr offset of interleaved chroma */
+	const uint8_t *luma = buf, *cb, *cr, *p, *pcb, *pcr;
+	size_t i, chroma;
+	int ret;
+
+	switch (format) {
+	case mlc_yuvfmt_420_cbcr:
+		cbcr = 1;
+		/* fall through */
+	case mlc_yuvfmt_420:
+		ysub = 2;
+		xsub = 2;
+		break;
+	case mlc_yuvfmt_422_cbcr:
+		cbcr = 1;
+		/* fall through */
+	case mlc_yuvfmt_422:
+		xsub = 2;
+		break;
+	case mlc_yuvfmt_444:
+	case mlc_yuvfmt_yuyv:
+		break;
+	default:
+		fprintf(stderr, "Fail, not support 0x%x format\n", format);
+		return -EINVAL;
+	}
+
+	/* the source the scaler reads, of the visible size */
+	width = _getbits(reg->mlcleftright, 0, 11) -
+		_getbits(reg->mlcleftright, 16, 11) + 1;
+	width = _getbits(reg->mlchscale, 0, 23) * width /
+		MLC_YUV_SCALE_CONSTANT;
+	height = _getbits(reg->mlctopbottom, 0, 11) -
+		 _getbits(reg->mlctopbottom, 16, 11) + 1;
+	height = _getbits(reg->mlcvscale, 0, 23) * height /
+		 MLC_YUV_SCALE_CONSTANT;
+	/* the chroma rows of the capture, the last one of an odd height */
+	rows = height / ysub;
+
+	if (!width || !height ||
+	    (format == mlc_yuvfmt_yuyv ? (width + 1) / 2 * 4 : width) >
+	    reg->mlcvstride ||
+	    (size_t)reg->mlcvstride * height > size)
+		return -EINVAL;
+
+	if (format != mlc_yuvfmt_yuyv) {
+		/* two bytes a chroma sample when interleaved */
+		if ((cbcr ? (width + 1) / 2 * 2 : (width + xsub - 1) / xsub) >
+		    (unsigned int)reg->mlcvstridecb ||
+		    (!cbcr && (width + xsub - 1) / xsub >
+		     (unsigned int)reg->mlcvstridecr))
+			return -EINVAL;
+		chroma = (size_t)reg->mlcvstridecb * rows;
+		if (!cbcr)
+			chroma += (size_t)reg->mlcvstridecr * rows;
+		if (!rows || (size_t)reg->mlcvstride * height + chroma > size)
+			return -EINVAL;
+	}
+
+	ret = compare_image_alloc(img, width, height);
+	if (ret)
+		return ret;
+
+	cb = luma + (size_t)reg->mlcvstride * height;
+	cr = cbcr ? cb + 1 : cb + (size_t)reg->mlcvstridecb * rows;
+
+	for (y = 0, i = 0; y < height; y++) {
+		p = luma + (size_t)reg->mlcvstride * y;
+
+		if (format == mlc_yuvfmt_yuyv) {
+			for (x = 0; x < width; x++, i++)
+				compare_set_yuv(img, i, p[x * 2],
+						p[(x & ~1u) * 2 + 1],
+						p[(x & ~1u) * 2 + 3]);
+			continue;
+		}
+
+		cy = y / ysub < rows ? y / ysub : rows - 1;
+		pcb = cb + (size_t)reg->mlcvstridecb * cy;
+		pcr = cr + (size_t)(cbcr ? reg->mlcvstridecb :
+				    reg->mlcvstridecr) * cy;
+		for (x = 0; x < width; x++, i++)
+			compare_set_yuv(img, i, p[x],
+					pcb[(x / xsub) << cbcr],
+					pcr[(x / xsub) << cbcr]);
+	}
+
+	return 0;
+}
+
+int compare_image_layer(struct compare_image *img, const struct mlc_reg *reg,
+			enum mlc_layer layer, const void *buf, size_t size)
+{
+	switch (layer) {
+	case mlc_layer_rgb0:
+	case mlc_layer_rgb1:
+		return compare_rgb_layer(img, &reg->rgb[layer], buf, size);
+	case mlc_layer_video:
+		return compare_yuv_layer(img, &reg->yuv, buf, size);
+	case mlc_layer_unknown:
+	default:
+		return -EINVAL;
+	}
+}
+
+static uint32_t compare_le(const uint8_t *p, int bytes)
+{
+	uint32_t v = 0;
+
+	while (bytes--)
+		v = v << 8 | p[bytes];
+
+	return v;
+}
+
+int compare_image_bmp(struct compare_image *img, const char *file)
+{
+	uint8_t head[54], *row = NULL;
+	unsigned int width, x, y, bpp, offset, compression;
+	int32_t height;
+	size_t pitch;
+	bool top_down;
+	FILE *fp;
+	int ret = -EINVAL;
+
+	fp = fopen(file, "rb");
+	if (!fp) {
+		fprintf(stderr, "Error file %s\n", file);
+		perror("- error");
+		return -errno;
+	}
+
+	if (fread(head, 1, sizeof(head), fp) != sizeof(head) ||
+	    head[0] != 'B' || head[1] != 'M')
+		goto __exit_bmp;
+
+	offset = compare_le(head + 10, 4);
+	width = compare_le(head + 18, 4);
+	height = (int32_t)compare_le(head + 22, 4);
+	bpp = compare_le(head + 28, 2);
+	compression = compare_le(head + 30, 4);
+
+	/* BI_RGB, or BI_BITFIELDS of the usual 32 bit masks */
+	if ((bpp != 24 && bpp != 32) || (compression != 0 && compression != 3))
+		goto __exit_bmp;
+
+	top_down = height < 0;
+	if (top_down)
+		height = -height;
+
+	pitch = ((size_t)width * bpp / 8 + 3) & ~(size_t)3;
+	row = malloc(pitch);
+	ret = row ? compare_image_alloc(img, width, height) : -ENOMEM;
+	if (ret)
+		goto __exit_bmp;
+
+	ret = -EIO;
+	if (fseek(fp, offset, SEEK_SET))
+		goto __exit_bmp;
+
+	for (y = 0; y < (unsigned int)height; y++) {
+		size_t i = (size_t)width * (top_down ? y : height - 1 - y);
+
+		if (fread(row, 1, pitch, fp) != pitch)
+			goto __exit_bmp;
+		for (x = 0; x < width; x++) {
+			const uint8_t *p = row + x * bpp / 8;
+
+			compare_set(img, i + x, p[2], p[1], p[0]);
+		}
+	}
+	ret = 0;
+
+__exit_bmp:
+	if (ret) {
+		fprintf(stderr, "Fail, %s is not a 24 or 32 bit BMP\n", file);
+		compare_image_free(img);
+	}
+	free(row);
+	fclose(fp);
+
+	return ret;
+}
+
+static inline compare_u8 compare_load(const uint8_t *p)
+{
+	compare_u8 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline compare_u8 compare_absdiff(compare_u8 a, compare_u8 b)
+{
+	compare_u8 gt = (compare_u8)(a > b);
+
+	return ((a - b) & gt) | ((b - a) & ~gt);
+}
+
+static inline compare_u8 compare_max(compare_u8 a, compare_u8 b)
+{
+	compare_u8 gt = (compare_u8)(a > b);
+
+	return (a & gt) | (b & ~gt);
+}
+
+/* the squares of the 16 differences summed in 4 lanes */
+static inline compare_u32 compare_squares(compare_u8 d)
+{
+	compare_u16 w = (compare_u16)d;
+	compare_u16 lo = w & 0xff, hi = w >> 8;
+	compare_u32 l = (compare_u32)(lo * lo), h = (compare_u32)(hi * hi);
+
+	return (l & 0xffff) + (l >> 16) + (h & 0xffff) + (h >> 16);
+}
+
+/*
+ * The sum of the squared errors of the color planes, the max error and
+ * the differing pixels, 16 pixels a run. The max channel error of a
+ * pixel goes to 'diff'.
+ */
+static void compare_errors(const struct compare_image *a,
+			   const struct compare_image *b, uint64_t *sse,
+			   unsigned int *max_error, uint64_t *differ,
+			   uint8_t *diff)
+{
+	size_t size = (size_t)a->width * a->height;
+	size_t n = size - size % COMPARE_LANES, i = 0;
+	compare_u8 maxv = { 0 }, ones, zero = { 0 };
+	uint64_t sum = 0, count = 0;
+	unsigned int max = 0;
+	int c, l, run;
+
+	memset(&ones, 1, sizeof(ones));
+
+	while (i < n) {
+		compare_u32 acc = { 0 };
+		compare_u8 cnt = { 0 };
+
+		for (run = 0; run < COMPARE_BLOCK && i < n;
+		     run++, i += COMPARE_LANES) {
+			compare_u8 dm = zero;
+
+			for (c = compare_red; c <= compare_blue; c++) {
+				compare_u8 d = compare_absdiff(
+					compare_load(a->planes[c] + i),
+					compare_load(b->planes[c] + i));
+
+				acc += compare_squares(d);
+				dm = compare_max(dm, d);
+			}
+
+			maxv = compare_max(maxv, dm);
+			cnt += (compare_u8)(dm != zero) & ones;
+			if (diff)
+				memcpy(diff + i, &dm, sizeof(dm));
+		}
+
+		for (l = 0; l < 4; l++)
+			sum += acc[l];
+		for (l = 0; l < COMPARE_LANES; l++)
+			count += cnt[l];
+	}
+
+	for (l = 0; l < COMPARE_LANES; l++)
+		if (maxv[l] > max)
+			max = maxv[l];
+
+	/* the pixels left over */
+	for (; i < size; i++) {
+		unsigned int dm = 0;
+
+		for (c = compare_red; c <= compare_blue; c++) {
+			int d = abs(a->planes[c][i] - b->planes[c][i]);
+
+			sum += d * d;
+			if ((unsigned int)d > dm)
+				dm = d;
+		}
+		if (dm > max)
+			max = dm;
+		if (dm)
+			count++;
+		if (diff)
+			diff[i] = dm;
+	}
+
+	*sse = sum;
+	*max_error = max;
+	*differ = count;
+}
+
+/* the luma sums of a 4x4 block, or an 8x8 window of 4 of them */
+struct compare_sums {
+	uint32_t x, y, xx, yy, xy;
+};
+
+/* the column sums of 4 luma rows, 16 columns a run */
+static void compare_columns(const uint8_t *pa, const uint8_t *pb,
+			    size_t pitch, unsigned int width,
+			    uint32_t *cols[5])
+{
+	unsigned int x, n = width - width % COMPARE_LANES, row, l;
+
+	for (x = 0; x < n; x += COMPARE_LANES) {
+		compare_u32 s[5][4];
+
+		memset(s, 0, sizeof(s));
+		for (row = 0; row < 4; row++) {
+			compare_u16 wa = (compare_u16)compare_load(pa + pitch * row + x);
+			compare_u16 wb = (compare_u16)compare_load(pb + pitch * row + x);
+			/* the even and the odd pixels */
+			compare_u16 va[2] = { wa & 0xff, wa >> 8 };
+			compare_u16 vb[2] = { wb & 0xff, wb >> 8 };
+
+			for (l = 0; l < 2; l++) {
+				compare_u32 xa = (compare_u32)va[l];
+				compare_u32 xb = (compare_u32)vb[l];
+				compare_u32 aa = (compare_u32)(va[l] * va[l]);
+				compare_u32 bb = (compare_u32)(vb[l] * vb[l]);
+				compare_u32 ab = (compare_u32)(va[l] * vb[l]);
+
+				/* pixels 4k + 2l and 4k + 2l + 1 */
+				s[0][l * 2] += xa & 0xffff;
+				s[0][l * 2 + 1] += xa >> 16;
+				s[1][l * 2] += xb & 0xffff;
+				s[1][l * 2 + 1] += xb >> 16;
+				s[2][l * 2] += aa & 0xffff;
+				s[2][l * 2 + 1] += aa >> 16;
+				s[3][l * 2] += bb & 0xffff;
+				s[3][l * 2 + 1] += bb >> 16;
+				s[4][l * 2] += ab & 0xffff;
+				s[4][l * 2 + 1] += ab >> 16;
+			}
+		}
+
+		/* lane k of the 4 sums is the block k of the run */
+		for (l = 0; l < 5; l++) {
+			compare_u32 sum = s[l][0] + s[l][1] + s[l][2] + s[l][3];
+			uint32_t *c = cols[l] + x / 4;
+
+			c[0] = sum[0];
+			c[1] = sum[1];
+			c[2] = sum[2];
+			c[3] = sum[3];
+		}
+	}
+
+	/* the blocks left over */
+	for (; x + 4 <= width; x += 4) {
+		uint32_t sum[5] = { 0 };
+
+		for (row = 0; row < 4; row++) {
+			for (l = x; l < x + 4; l++) {
+				unsigned int va = pa[pitch * row + l];
+				unsigned int vb = pb[pitch * row + l];
+
+				sum[0] += va;
+				sum[1] += vb;
+				sum[2] += va * va;
+				sum[3] += vb * vb;
+				sum[4] += va * vb;
+			}
+		}
+		for (l = 0; l < 5; l++)
+			cols[l][x / 4] = sum[l];
+	}
+}
+
+/* the mean SSIM of the luma, in 8x8 windows of the 4x4 block sums */
+static double compare_ssim(const struct compare_image *a,
+			   const struct compare_image *b)
+{
+	unsigned int bw = a->width / 4, bh = a->height / 4, x, y, i, j, l;
+	struct compare_sums *s;
+	uint32_t *cols[5];
+	unsigned int windows = 0;
+	double ssim = 0;
+
+	/* too small for a window, only an exact match is a match */
+	if (bw < 2 || bh < 2)
+		return memcmp(a->planes[compare_luma], b->planes[compare_luma],
+			      (size_t)a->width * a->height) ? 0 : 1;
+
+	s = malloc((size_t)bw * bh * sizeof(*s) + sizeof(uint32_t) * bw * 5);
+	if (!s)
+		return 0;
+	cols[0] = (uint32_t *)(s + (size_t)bw * bh);
+	for (l = 1; l < 5; l++)
+		cols[l] = cols[l - 1] + bw;
+
+	for (y = 0; y < bh; y++) {
+		struct compare_sums *row = s + (size_t)bw * y;
+
+		compare_columns(a->planes[compare_luma] + (size_t)a->width * y * 4,
+				b->planes[compare_luma] + (size_t)b->width * y * 4,
+				a->width, a->width, cols);
+		/* the block sums, 4 columns each */
+		for (x = 0; x < bw; x++) {
+			row[x].x = cols[0][x];
+			row[x].y = cols[1][x];
+			row[x].xx = cols[2][x];
+			row[x].yy = cols[3][x];
+			row[x].xy = cols[4][x];
+		}
+	}
+
+	for (y = 0; y + 1 < bh; y++) {
+		for (x = 0; x + 1 < bw; x++) {
+			struct compare_sums w = { 0 };
+			double mx, my, vx, vy, cov;
+
+			for (j = 0; j < 2; j++) {
+				for (i = 0; i < 2; i++) {
+					const struct compare_sums *k =
+						&s[(size_t)bw * (y + j) + x + i];
+
+					w.x += k->x;
+					w.y += k->y;
+					w.xx += k->xx;
+					w.yy += k->yy;
+					w.xy += k->xy;
+				}
+			}
+
+			mx = w.x / 64.0;
+			my = w.y / 64.0;
+			vx = w.xx / 64.0 - mx * mx;
+			vy = w.yy / 64.0 - my * my;
+			cov = w.xy / 64.0 - mx * my;
+			ssim += (2 * mx * my + COMPARE_C1) * (2 * cov + COMPARE_C2) /
+				((mx * mx + my * my + COMPARE_C1) *
+				 (vx + vy + COMPARE_C2));
+			windows++;
+		}
+	}
+
+	free(s);
+
+	return ssim / windows;
+}
+
+int compare_images(const struct compare_image *a,
+		   const struct compare_image *b,
+		   struct compare_result *r, uint8_t *diff)
+{
+	uint64_t sse;
+	double mse;
+
+	memset(r, 0, sizeof(*r));
+
+	if (a->width != b->width || a->height != b->height) {
+		fprintf(stderr, "Fail, %u x %u to a %u x %u reference\n",
+			a->width, a->height, b->width, b->height);
+		return -EINVAL;
+	}
+
+	compare_errors(a, b, &sse, &r->max_error, &r->differ, diff);
+	r->exact = !r->differ;
+
+	mse = (double)sse / ((double)a->width * a->height * 3);
+	r->psnr = mse ? 10 * log10(255.0 * 255.0 / mse) : INFINITY;
+	r->ssim = compare_ssim(a, b);
+
+	return 0;
+}
+
+static void compare_put_le(uint8_t *p, uint32_t v, int bytes)
+{
+	while (bytes--) {
+		*p++ = v;
+		v >>= 8;
+	}
+}
+
+int compare_write_mask(const char *file, const uint8_t *diff,
+		       unsigned int width, unsigned int height)
+{
+	size_t pitch = ((size_t)width * 3 + 3) & ~(size_t)3;
+	uint8_t head[54] = { 'B', 'M' }, *row;
+	unsigned int x, y;
+	FILE *fp;
+	int ret = 0;
+
+	row = calloc(1, pitch);
+	if (!row)
+		return -ENOMEM;
+
+	fp = fopen(file, "wb");
+	if (!fp) {
+		fprintf(stderr, "Error file %s\n", file);
+		perror("- error");
+		free(row);
+		return -errno;
+	}
+
+	compare_put_le(head + 2, sizeof(head) + pitch * height, 4);
+	compare_put_le(head + 10, sizeof(head), 4);
+	compare_put_le(head + 14, 40, 4);
+	compare_put_le(head + 18, width, 4);
+	compare_put_le(head + 22, height, 4);
+	compare_put_le(head + 26, 1, 2);
+	compare_put_le(head + 28, 24, 2);
+	compare_put_le(head + 34, pitch * height, 4);
+	fwrite(head, 1, sizeof(head), fp);
+
+	/* bottom up, an error of 1 is still visible */
+	for (y = height; y-- > 0;) {
+		const uint8_t *d = diff + (size_t)width * y;
+
+		for (x = 0; x < width; x++) {
+			uint8_t v = d[x] ? 64 + d[x] * 191 / 255 : 0;
+
+			row[x * 3] = v;
+			row[x * 3 + 1] = v;
+			row[x * 3 + 2] = v;
+		}
+		fwrite(row, 1, pitch, fp);
+	}
+
+	if (fclose(fp))
+		ret = -EIO;
+	free(row);
+
+	return ret;
+}
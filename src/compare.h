@@ -0,0 +1,53 @@
+#ifndef __COMPARE_H__
+#define __COMPARE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mlc.h"
+
+/*
+ * Compares a captured layer to a golden reference. Both are converted to
+ * 8 bit red, green, blue and luma planes first, so a layer of any mlc
+ * format compares to a reference of another one or to a BMP. The error
+ * is over the color planes, the SSIM over the luma in 8x8 windows at a
+ * step of 4.
+ */
+enum compare_plane {
+	compare_red,
+	compare_green,
+	compare_blue,
+	compare_luma,
+	compare_planes,
+};
+
+struct compare_image {
+	unsigned int width, height;
+	uint8_t *planes[compare_planes];	/* width x height each */
+};
+
+struct compare_result {
+	bool exact;
+	uint64_t differ;	/* pixels */
+	unsigned int max_error;
+	double psnr;		/* dB, infinite on an exact match */
+	double ssim;
+};
+
+/* the frame of 'layer' in 'buf', the planes one after the other */
+int compare_image_layer(struct compare_image *img, const struct mlc_reg *reg,
+			enum mlc_layer layer, const void *buf, size_t size);
+/* an uncompressed 24 or 32 bit BMP */
+int compare_image_bmp(struct compare_image *img, const char *file);
+void compare_image_free(struct compare_image *img);
+
+/* 'diff' is NULL or width x height, the max channel error of a pixel */
+int compare_images(const struct compare_image *a,
+		   const struct compare_image *b,
+		   struct compare_result *r, uint8_t *diff);
+/* the differing pixels of 'diff' as a gray BMP, brighter the larger */
+int compare_write_mask(const char *file, const uint8_t *diff,
+		       unsigned int width, unsigned int height);
+
+#endif
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "copypool.h"
+
+struct copypool_worker {
+	struct copypool *pool;
+	unsigned int band;
+	pthread_t thread;
+};
+
+struct copypool {
+	unsigned int threads;
+	struct copypool_worker *workers;
+	/* the frame starts at the first, ends at the second */
+	pthread_barrier_t start, done;
+	/* the workers wait to be all there before the barriers */
+	pthread_mutex_t lock;
+	pthread_cond_t ready_cond;
+	bool ready, quit;
+	/* the copy, one at a time of the threads sharing the pool */
+	pthread_mutex_t copy_lock;
+	void *dst;
+	const void *src;
+	size_t stride;
+	unsigned int rows;
+	/* statistics */
+	unsigned int copies;
+	uint64_t bytes, ns;
+	/* the first copy again on the calling thread alone */
+	uint64_t single_bytes, single_ns;
+};
+
+static uint64_t copypool_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void copypool_band(struct copypool *p, unsigned int band)
+{
+	unsigned int first = (uint64_t)p->rows * band / p->threads;
+	unsigned int last = (uint64_t)p->rows * (band + 1) / p->threads;
+	size_t offset = (size_t)first * p->stride;
+
+	memcpy(p->dst + offset, p->src + offset,
+	       (size_t)(last - first) * p->stride);
+}
+
+static void *copypool_thread(void *arg)
+{
+	struct copypool_worker *w = arg;
+	struct copypool *p = w->pool;
+	sigset_t mask;
+	bool quit;
+
+	/* the signals go to the thread waiting on them */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->ready && !p->quit)
+		pthread_cond_wait(&p->ready_cond, &p->lock);
+	quit = p->quit;
+	pthread_mutex_unlock(&p->lock);
+	if (quit)
+		return NULL;
+
+	for (;;) {
+		pthread_barrier_wait(&p->start);
+		if (p->quit)
+			break;
+		copypool_band(p, w->band);
+		pthread_barrier_wait(&p->done);
+	}
+
+	return NULL;
+}
+
+/* the cpus of the process but the caller's, the workers go round them */
+static int copypool_cpus(int cpu, int cpus[CPU_SETSIZE])
+{
+	cpu_set_t set;
+	int i, n = 0;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return 0;
+
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &set) && i != cpu)
+			cpus[n++] = i;
+
+	return n;
+}
+
+struct copypool *copypool_create(unsigned int threads, int cpu)
+{
+	int cpus[CPU_SETSIZE], count;
+	struct copypool *p;
+	cpu_set_t set;
+	unsigned int i;
+	int ret;
+
+	if (threads < 2)
+		return NULL;
+	count = copypool_cpus(cpu, cpus);
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	p->workers = calloc(threads, sizeof(*p->workers));
+	if (!p->workers) {
+		free(p);
+		return NULL;
+	}
+
+	pthread_barrier_init(&p->start, NULL, threads);
+	pthread_barrier_init(&p->done, NULL, threads);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_mutex_init(&p->copy_lock, NULL);
+	pthread_cond_init(&p->ready_cond, NULL);
+
+	/* band 0 is the caller's */
+	p->threads = 1;
+	for (i = 1; i < threads; i++) {
+		struct copypool_worker *w = &p->workers[i];
+
+		w->pool = p;
+		w->band = i;
+		ret = pthread_create(&w->thread, NULL, copypool_thread, w);
+		if (ret) {
+			fprintf(stderr, "failed to create copy thread: %s\n",
+				strerror(ret));
+			break;
+		}
+		p->threads++;
+
+		/* left to the scheduler when the caller has the only cpu */
+		if (!count)
+			continue;
+		CPU_ZERO(&set);
+		CPU_SET(cpus[(i - 1) % count], &set);
+		pthread_setaffinity_np(w->thread, sizeof(set), &set);
+	}
+
+	pthread_mutex_lock(&p->lock);
+	if (p->threads < threads)
+		p->quit = true;
+	else
+		p->ready = true;
+	pthread_cond_broadcast(&p->ready_cond);
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->quit) {
+		copypool_destroy(p);
+		return NULL;
+	}
+
+	return p;
+}
+
+void copypool_destroy(struct copypool *p)
+{
+	unsigned int i;
+
+	if (!p)
+		return;
+
+	/* not ready, the workers quit without the barriers */
+	if (p->ready) {
+		p->quit = true;
+		pthread_barrier_wait(&p->start);
+	}
+	for (i = 1; i < p->threads; i++)
+		pthread_join(p->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&p->ready_cond);
+	pthread_mutex_destroy(&p->copy_lock);
+	pthread_mutex_destroy(&p->lock);
+	pthread_barrier_destroy(&p->start);
+	pthread_barrier_destroy(&p->done);
+	free(p->workers);
+	free(p);
+}
+
+void copypool_copy(struct copypool *p, void *dst, const void *src,
+		   size_t stride, unsigned int rows)
+{
+	size_t bytes = stride * rows;
+	uint64_t start;
+
+	pthread_mutex_lock(&p->copy_lock);
+	start = copypool_now();
+
+	p->dst = dst;
+	p->src = src;
+	p->stride = stride;
+	p->rows = rows;
+	pthread_barrier_wait(&p->start);
+	copypool_band(p, 0);
+	pthread_barrier_wait(&p->done);
+
+	p->ns += copypool_now() - start;
+	p->bytes += bytes;
+	p->copies++;
+
+	/* after the bands, the destination is faulted in for both */
+	if (!p->single_ns) {
+		start = copypool_now();
+		memcpy(dst, src, bytes);
+		p->single_ns = copypool_now() - start + 1;
+		p->single_bytes = bytes;
+	}
+
+	pthread_mutex_unlock(&p->copy_lock);
+}
+
+void copypool_report(struct copypool *p, FILE *fp)
+{
+	if (!p || !p->ns)
+		return;
+
+	fprintf(fp,
+		"row copy on %u threads: %u copies, %.1f MB/s, %.1f MB/s on one thread, %.2fx\n",
+		p->threads, p->copies, p->bytes * 1000.0 / p->ns,
+		p->single_bytes * 1000.0 / p->single_ns,
+		(double)p->bytes / p->ns * p->single_ns / p->single_bytes);
+}
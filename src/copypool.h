@@ -0,0 +1,27 @@
+#ifndef __COPYPOOL_H__
+#define __COPYPOOL_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Copies the rows of a plane in bands, one a thread, for the memory
+ * parallelism a single thread reading uncached device memory leaves
+ * unused. The calling thread copies the first band, the workers pinned
+ * to the other cpus of the process the others. The first copy is done
+ * again on the calling thread alone, from the same mapping, for the
+ * report to have the speedup over one thread on the memory captured.
+ */
+struct copypool;
+
+/* 'cpu' is the one the caller runs on, -1 when not pinned */
+struct copypool *copypool_create(unsigned int threads, int cpu);
+void copypool_destroy(struct copypool *p);
+
+/* returns when all the bands are copied, copies of threads take turns */
+void copypool_copy(struct copypool *p, void *dst, const void *src,
+		   size_t stride, unsigned int rows);
+/* the throughput of the copies and their speedup over one thread */
+void copypool_report(struct copypool *p, FILE *fp);
+
+#endif
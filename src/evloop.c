@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "evloop.h"
+
+#define EVLOOP_MAX_EVENTS	16
+#define EVLOOP_LINE_MAX		256
+/* a client that reads nothing for so long is dropped */
+#define EVLOOP_SEND_TIMEOUT	1000
+
+enum evloop_type {
+	evloop_type_fd,
+	evloop_type_timer,
+	evloop_type_signal,
+	evloop_type_server,
+	evloop_type_client,
+	evloop_type_lines,
+};
+
+struct evloop_handler {
+	int fd;
+	enum evloop_type type;
+	evloop_cb_t cb;
+	evloop_line_cb_t line_cb;
+	void *data;
+	bool dead;
+	/* control clients */
+	char *line;
+	size_t len;
+	struct evloop_handler *next;
+};
+
+struct evloop {
+	int epfd;
+	bool quit;
+	struct evloop_handler *handlers;
+	char *path;	/* control socket */
+	/* of the thread before the signals were blocked */
+	sigset_t sigmask;
+	bool sigmasked;
+};
+
+struct evloop *evloop_create(void)
+{
+	struct evloop *loop;
+
+	loop = calloc(1, sizeof(*loop));
+	if (!loop)
+		return NULL;
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) {
+		fprintf(stderr, "failed to create epoll: %s\n",
+			strerror(errno));
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+static struct evloop_handler *evloop_handler_add(struct evloop *loop, int fd,
+						 enum evloop_type type,
+						 uint32_t events)
+{
+	struct evloop_handler *h;
+	struct epoll_event ev;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+
+	h->fd = fd;
+	h->type = type;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = h;
+
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		/* EPERM is a regular file, the caller knows */
+		if (errno != EPERM)
+			fprintf(stderr, "failed to add fd.%d to epoll: %s\n",
+				fd, strerror(errno));
+		free(h);
+		return NULL;
+	}
+
+	h->next = loop->handlers;
+	loop->handlers = h;
+
+	return h;
+}
+
+/* handlers are freed out of the dispatch, events may still refer them */
+static void evloop_handler_sweep(struct evloop *loop)
+{
+	struct evloop_handler **p = &loop->handlers;
+
+	while (*p) {
+		struct evloop_handler *h = *p;
+
+		if (!h->dead) {
+			p = &h->next;
+			continue;
+		}
+
+		*p = h->next;
+		free(h->line);
+		free(h);
+	}
+}
+
+static void evloop_handler_del(struct evloop *loop, struct evloop_handler *h)
+{
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, h->fd, NULL);
+
+	/* the loop owns the fds it has created */
+	if (h->type != evloop_type_fd && h->type != evloop_type_lines)
+		close(h->fd);
+
+	h->dead = true;
+}
+
+void evloop_destroy(struct evloop *loop)
+{
+	struct evloop_handler *h;
+
+	if (!loop)
+		return;
+
+	for (h = loop->handlers; h; h = h->next)
+		if (!h->dead)
+			evloop_handler_del(loop, h);
+
+	evloop_handler_sweep(loop);
+
+	if (loop->path) {
+		unlink(loop->path);
+		free(loop->path);
+	}
+
+	if (loop->sigmasked)
+		pthread_sigmask(SIG_SETMASK, &loop->sigmask, NULL);
+
+	close(loop->epfd);
+	free(loop);
+}
+
+int evloop_add(struct evloop *loop, int fd, uint32_t events,
+	       evloop_cb_t cb, void *data)
+{
+	struct evloop_handler *h;
+
+	h = evloop_handler_add(loop, fd, evloop_type_fd, events);
+	if (!h)
+		return -EINVAL;
+
+	h->cb = cb;
+	h->data = data;
+
+	return 0;
+}
+
+void evloop_del(struct evloop *loop, int fd)
+{
+	struct evloop_handler *h;
+
+	for (h = loop->handlers; h; h = h->next)
+		if (h->fd == fd && !h->dead) {
+			evloop_handler_del(loop, h);
+			break;
+		}
+}
+
+/*
+ * The signals are blocked in the calling thread until the loop is
+ * destroyed, threads created after inherit it. Call it before any other
+ * thread is created, or block them in the other threads.
+ */
+int evloop_add_signal(struct evloop *loop, const int *signals, int count,
+		      evloop_cb_t cb, void *data)
+{
+	struct evloop_handler *h;
+	sigset_t mask;
+	int fd, i, ret;
+
+	sigemptyset(&mask);
+	for (i = 0; i < count; i++)
+		sigaddset(&mask, signals[i]);
+
+	ret = pthread_sigmask(SIG_BLOCK, &mask,
+			      loop->sigmasked ? NULL : &loop->sigmask);
+	if (ret)
+		return -ret;
+	loop->sigmasked = true;
+
+	fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "failed to create signalfd: %s\n",
+			strerror(errno));
+		return -errno;
+	}
+
+	h = evloop_handler_add(loop, fd, evloop_type_signal, EPOLLIN);
+	if (!h) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	h->cb = cb;
+	h->data = data;
+
+	return fd;
+}
+
+int evloop_add_timer(struct evloop *loop, unsigned int msec, int periodic,
+		     evloop_cb_t cb, void *data)
+{
+	return evloop_add_timer_ns(loop, (uint64_t)msec * 1000000, periodic,
+				   cb, data);
+}
+
+int evloop_add_timer_ns(struct evloop *loop, uint64_t nsec, int periodic,
+			evloop_cb_t cb, void *data)
+{
+	struct evloop_handler *h;
+	struct itimerspec its;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "failed to create timerfd: %s\n",
+			strerror(errno));
+		return -errno;
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = nsec / 1000000000;
+	its.it_value.tv_nsec = nsec % 1000000000;
+	if (periodic)
+		its.it_interval = its.it_value;
+
+	if (timerfd_settime(fd, 0, &its, NULL)) {
+		close(fd);
+		return -errno;
+	}
+
+	h = evloop_handler_add(loop, fd, evloop_type_timer, EPOLLIN);
+	if (!h) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	h->cb = cb;
+	h->data = data;
+
+	return fd;
+}
+
+int evloop_add_server(struct evloop *loop, const char *path,
+		      evloop_line_cb_t cb, void *data)
+{
+	struct evloop_handler *h;
+	struct sockaddr_un addr;
+	int fd;
+
+	if (loop->path || strlen(path) >= sizeof(addr.sun_path))
+		return -EINVAL;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if (bind(fd, (void *)&addr, sizeof(addr)) ||
+	    listen(fd, 4)) {
+		fprintf(stderr, "failed to listen %s: %s\n",
+			path, strerror(errno));
+		close(fd);
+		return -errno;
+	}
+
+	h = evloop_handler_add(loop, fd, evloop_type_server, EPOLLIN);
+	if (!h) {
+		close(fd);
+		unlink(path);
+		return -EINVAL;
+	}
+
+	h->line_cb = cb;
+	h->data = data;
+	loop->path = strdup(path);
+
+	return fd;
+}
+
+static struct evloop_handler *evloop_lines_add(struct evloop *loop, int fd,
+					       enum evloop_type type,
+					       evloop_line_cb_t cb, void *data)
+{
+	struct evloop_handler *h;
+
+	h = evloop_handler_add(loop, fd, type, EPOLLIN);
+	if (!h)
+		return NULL;
+
+	h->line = malloc(EVLOOP_LINE_MAX);
+	if (!h->line) {
+		evloop_handler_del(loop, h);
+		return NULL;
+	}
+
+	h->line_cb = cb;
+	h->data = data;
+
+	return h;
+}
+
+/* regular files can't be polled, the caller reads them as it likes */
+int evloop_add_lines(struct evloop *loop, int fd,
+		     evloop_line_cb_t cb, void *data)
+{
+	if (!evloop_lines_add(loop, fd, evloop_type_lines, cb, data))
+		return -EINVAL;
+
+	return 0;
+}
+
+static void evloop_server_accept(struct evloop *loop,
+				 struct evloop_handler *server)
+{
+	int fd;
+
+	fd = accept(server->fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	if (!evloop_lines_add(loop, fd, evloop_type_client,
+			      server->line_cb, server->data))
+		close(fd);
+}
+
+int evloop_send(int client, const void *buf, size_t len, int fd)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	struct pollfd pfd = { .fd = client, .events = POLLOUT };
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	ssize_t ret;
+
+	while (len) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = (void *)buf;
+		iov.iov_len = len;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		/* the fd goes with the first byte */
+		if (fd >= 0) {
+			memset(control, 0, sizeof(control));
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+		}
+
+		ret = sendmsg(client, &msg, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0 && errno == EAGAIN) {
+			ret = poll(&pfd, 1, EVLOOP_SEND_TIMEOUT);
+			if (ret <= 0)
+				return ret ? -errno : -ETIMEDOUT;
+			continue;
+		}
+		if (ret < 0)
+			return -errno;
+
+		buf += ret;
+		len -= ret;
+		fd = -1;
+	}
+
+	return 0;
+}
+
+static void evloop_lines_read(struct evloop *loop, struct evloop_handler *h)
+{
+	ssize_t ret;
+	char *end;
+
+	ret = read(h->fd, h->line + h->len, EVLOOP_LINE_MAX - 1 - h->len);
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	/* the fd is closed by the del, it can't be reused before the call */
+	if (ret <= 0) {
+		h->line_cb(NULL, h->fd, h->data);
+		evloop_handler_del(loop, h);
+		return;
+	}
+
+	h->len += ret;
+	h->line[h->len] = '\0';
+
+	while (!h->dead && (end = strchr(h->line, '\n'))) {
+		size_t len = end - h->line + 1;
+		char c = end[1];
+
+		end[1] = '\0';
+		h->line_cb(h->line, h->fd, h->data);
+		end[1] = c;
+
+		memmove(h->line, h->line + len, h->len - len + 1);
+		h->len -= len;
+	}
+
+	/* no room for a line end, drop the client */
+	if (h->len == EVLOOP_LINE_MAX - 1) {
+		h->line_cb(NULL, h->fd, h->data);
+		evloop_handler_del(loop, h);
+	}
+}
+
+static void evloop_handle(struct evloop *loop, struct evloop_handler *h,
+			  uint32_t events)
+{
+	struct signalfd_siginfo si;
+	uint64_t expirations;
+
+	switch (h->type) {
+	case evloop_type_fd:
+		h->cb(h->fd, events, h->data);
+		break;
+	case evloop_type_timer:
+		if (read(h->fd, &expirations, sizeof(expirations)) ==
+		    sizeof(expirations))
+			h->cb(h->fd, (uint32_t)expirations, h->data);
+		break;
+	case evloop_type_signal:
+		if (read(h->fd, &si, sizeof(si)) == sizeof(si))
+			h->cb(h->fd, si.ssi_signo, h->data);
+		break;
+	case evloop_type_server:
+		evloop_server_accept(loop, h);
+		break;
+	case evloop_type_client:
+	case evloop_type_lines:
+		evloop_lines_read(loop, h);
+		break;
+	}
+}
+
+int evloop_dispatch(struct evloop *loop, int timeout)
+{
+	struct epoll_event events[EVLOOP_MAX_EVENTS];
+	int i, n;
+
+	n = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, timeout);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (i = 0; i < n; i++) {
+		struct evloop_handler *h = events[i].data.ptr;
+
+		if (!h->dead)
+			evloop_handle(loop, h, events[i].events);
+	}
+
+	evloop_handler_sweep(loop);
+
+	return n;
+}
+
+int evloop_run(struct evloop *loop)
+{
+	int ret = 0;
+
+	loop->quit = false;
+
+	while (!loop->quit) {
+		ret = evloop_dispatch(loop, -1);
+		if (ret < 0)
+			break;
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
+void evloop_quit(struct evloop *loop)
+{
+	loop->quit = true;
+}
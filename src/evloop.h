@@ -0,0 +1,45 @@
+#ifndef __EVLOOP_H__
+#define __EVLOOP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct evloop;
+
+/*
+ * 'events' are the epoll events of the fd, the number of expirations of
+ * a timer or the signal number of a signal.
+ */
+typedef void (*evloop_cb_t)(int fd, uint32_t events, void *data);
+/*
+ * A line from a control client, reply by writing to 'client'.
+ * 'line' is NULL when the client is gone.
+ */
+typedef void (*evloop_line_cb_t)(char *line, int client, void *data);
+
+struct evloop *evloop_create(void);
+/* restores the signal mask, in the thread that added the signals */
+void evloop_destroy(struct evloop *loop);
+
+int evloop_add(struct evloop *loop, int fd, uint32_t events,
+	       evloop_cb_t cb, void *data);
+void evloop_del(struct evloop *loop, int fd);
+
+int evloop_add_lines(struct evloop *loop, int fd,
+		     evloop_line_cb_t cb, void *data);
+int evloop_add_signal(struct evloop *loop, const int *signals, int count,
+		      evloop_cb_t cb, void *data);
+int evloop_add_timer(struct evloop *loop, unsigned int msec, int periodic,
+		     evloop_cb_t cb, void *data);
+int evloop_add_timer_ns(struct evloop *loop, uint64_t nsec, int periodic,
+			evloop_cb_t cb, void *data);
+int evloop_add_server(struct evloop *loop, const char *path,
+		      evloop_line_cb_t cb, void *data);
+/* all of 'buf' to a client, 'fd' is passed along when not -1 */
+int evloop_send(int client, const void *buf, size_t len, int fd);
+
+int evloop_dispatch(struct evloop *loop, int timeout);
+int evloop_run(struct evloop *loop);
+void evloop_quit(struct evloop *loop);
+
+#endif
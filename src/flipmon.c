@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include <xf86drm.h>
+
+#include "flipmon.h"
+#include "evloop.h"
+#include "mlc.h"
+#include "io.h"
+
+struct flipmon_layer {
+	enum mlc_layer layer;
+	uint32_t *control;
+	uint32_t *addr[3];
+	int planes;
+	bool enabled;
+	uint32_t last[3];
+	uint64_t last_us;	/* of the last flip, 0 before one */
+	uint64_t cadence_us;	/* mean frame of the last report */
+	uint64_t total;
+	/* this report */
+	unsigned int flips, frames, missed;
+	uint64_t sum_us, min_us, max_us;
+	double sum2;
+};
+
+struct flipmon_module {
+	struct flipmon *m;
+	int module;
+	struct flipmon_layer layers[NUMBER_OF_MLC_LAYER];
+	int vblank;		/* the pipe bits of its crtc, -1 without */
+	unsigned int sequence;	/* of the last vblank */
+	unsigned int late;	/* vblanks gone without a sample */
+};
+
+struct flipmon {
+	unsigned int rate;
+	int drm_fd;
+	bool vblank, json, tty;
+	struct flipmon_module modules[NUMBER_OF_MLC_MODULE];
+	int count;
+	struct evloop *loop;
+	drmEventContext evctx;
+	uint64_t report_us;
+	unsigned int samples;
+	uint64_t sample_ns;
+	int error;
+};
+
+static uint64_t flipmon_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static const char * const flipmon_layer_name[] = {
+	[mlc_layer_rgb0] = "rgb0",
+	[mlc_layer_rgb1] = "rgb1",
+	[mlc_layer_video] = "video",
+};
+
+static void flipmon_layer_init(struct flipmon_layer *l, struct mlc_reg *r,
+			       enum mlc_layer layer)
+{
+	l->layer = layer;
+
+	if (layer == mlc_layer_video) {
+		l->control = &r->yuv.mlccontrol;
+		l->addr[0] = &r->yuv.mlcaddress;
+		l->addr[1] = &r->yuv.mlcaddresscb;
+		l->addr[2] = &r->yuv.mlcaddresscr;
+		l->planes = 3;
+	} else {
+		l->control = &r->rgb[layer].mlccontrol;
+		l->addr[0] = &r->rgb[layer].mlcaddress;
+		l->planes = 1;
+	}
+}
+
+struct flipmon *flipmon_create(unsigned int rate, int drm_fd,
+			       const int *vblank)
+{
+	struct flipmon *m;
+	int i, n;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	m->rate = rate ? rate : 1000;
+	m->drm_fd = drm_fd;
+
+	for (i = 0; i < hw_reg_get_module_num(); i++) {
+		struct flipmon_module *mm = &m->modules[m->count];
+		struct mlc_reg *r = hw_reg_get_mem(i);
+
+		if (!r)
+			continue;
+
+		mm->m = m;
+		mm->module = i;
+		mm->vblank = vblank ? vblank[i] : -1;
+		for (n = 0; n < hw_reg_get_layer_num(i); n++)
+			flipmon_layer_init(&mm->layers[n], r, n);
+		m->count++;
+	}
+
+	if (!m->count) {
+		fprintf(stderr, "no mapped module to monitor\n");
+		free(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+void flipmon_destroy(struct flipmon *m)
+{
+	free(m);
+}
+
+static void flipmon_flip(struct flipmon_layer *l, uint64_t now)
+{
+	l->flips++;
+	l->total++;
+
+	if (l->last_us) {
+		uint64_t dt = now - l->last_us;
+
+		if (!l->frames || dt < l->min_us)
+			l->min_us = dt;
+		if (dt > l->max_us)
+			l->max_us = dt;
+		l->sum_us += dt;
+		l->sum2 += (double)dt * dt;
+		l->frames++;
+
+		/* the frame stayed for more vsyncs than the layer's cadence */
+		if (l->cadence_us && dt > l->cadence_us * 3 / 2)
+			l->missed += (dt + l->cadence_us / 2) / l->cadence_us - 1;
+	}
+
+	l->last_us = now;
+}
+
+/* reads through the register mapping, a few words a layer */
+static void flipmon_sample(struct flipmon_module *mm, uint64_t now)
+{
+	int i, n;
+
+	for (i = 0; i < hw_reg_get_layer_num(mm->module); i++) {
+		struct flipmon_layer *l = &mm->layers[i];
+		bool changed = false;
+
+		if (!_getbits(readl(l->control), 5, 1)) {
+			l->enabled = false;
+			l->last_us = 0;
+			continue;
+		}
+
+		for (n = 0; n < l->planes; n++) {
+			uint32_t v = readl(l->addr[n]);
+
+			if (v != l->last[n])
+				changed = true;
+			l->last[n] = v;
+		}
+
+		/* the first sample of an enabled layer has no flip */
+		if (!l->enabled)
+			l->enabled = true;
+		else if (changed)
+			flipmon_flip(l, now);
+	}
+}
+
+static void flipmon_timer(int fd, uint32_t events, void *data)
+{
+	struct flipmon *m = data;
+	uint64_t start = flipmon_now_ns();
+	int i;
+
+	for (i = 0; i < m->count; i++)
+		flipmon_sample(&m->modules[i], start / 1000);
+
+	m->sample_ns += flipmon_now_ns() - start;
+	m->samples++;
+}
+
+static int flipmon_wait_vblank(struct flipmon_module *mm)
+{
+	drmVBlank vbl;
+
+	if (mm->vblank < 0)
+		return -ENODEV;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT | mm->vblank;
+	vbl.request.sequence = 1;
+	vbl.request.signal = (unsigned long)mm;
+
+	return drmWaitVBlank(mm->m->drm_fd, &vbl) ? -errno : 0;
+}
+
+static void flipmon_vblank(int fd, unsigned int sequence,
+			   unsigned int tv_sec, unsigned int tv_usec,
+			   void *data)
+{
+	struct flipmon_module *mm = data;
+	struct flipmon *m = mm->m;
+	uint64_t start = flipmon_now_ns();
+	int ret;
+
+	if (mm->sequence && sequence - mm->sequence > 1)
+		mm->late += sequence - mm->sequence - 1;
+	mm->sequence = sequence;
+
+	/* the flips are on the vblank grid */
+	flipmon_sample(mm, (uint64_t)tv_sec * 1000000 + tv_usec);
+
+	m->sample_ns += flipmon_now_ns() - start;
+	m->samples++;
+
+	ret = flipmon_wait_vblank(mm);
+	if (ret && !m->error) {
+		m->error = ret;
+		evloop_quit(m->loop);
+	}
+}
+
+static void flipmon_drm_event(int fd, uint32_t events, void *data)
+{
+	struct flipmon *m = data;
+
+	drmHandleEvent(fd, &m->evctx);
+}
+
+static double flipmon_mean(struct flipmon_layer *l)
+{
+	return l->frames ? (double)l->sum_us / l->frames : 0;
+}
+
+/* the deviation of the frame time */
+static double flipmon_jitter(struct flipmon_layer *l, double mean)
+{
+	return l->frames ? sqrt(fabs(l->sum2 / l->frames - mean * mean)) : 0;
+}
+
+static void flipmon_json(struct flipmon *m, double sec)
+{
+	int i, n;
+	bool first = true;
+
+	fprintf(stdout,
+		"{\"time_us\":%llu,\"interval_ms\":%u,\"sync\":\"%s\",\"samples\":%u,\"sample_ns\":%llu,\"layers\":[",
+		(unsigned long long)(flipmon_now_ns() / 1000),
+		(unsigned int)(sec * 1000), m->vblank ? "vblank" : "timer",
+		m->samples,
+		(unsigned long long)(m->samples ? m->sample_ns / m->samples : 0));
+
+	for (i = 0; i < m->count; i++) {
+		struct flipmon_module *mm = &m->modules[i];
+
+		for (n = 0; n < hw_reg_get_layer_num(mm->module); n++) {
+			struct flipmon_layer *l = &mm->layers[n];
+			double mean = flipmon_mean(l);
+			double jitter = flipmon_jitter(l, mean);
+
+			if (!l->enabled)
+				continue;
+
+			fprintf(stdout,
+				"%s{\"module\":%d,\"layer\":\"%s\",\"fps\":%.2f,\"flips\":%u,\"total\":%llu,\"frame_ms\":{\"mean\":%.3f,\"min\":%.3f,\"max\":%.3f,\"jitter\":%.3f},\"missed\":%u,\"late_samples\":%u}",
+				first ? "" : ",", mm->module,
+				flipmon_layer_name[l->layer], l->flips / sec,
+				l->flips, (unsigned long long)l->total, mean / 1000,
+				l->min_us / 1000.0, l->max_us / 1000.0,
+				jitter / 1000, l->missed, mm->late);
+			first = false;
+		}
+	}
+
+	fprintf(stdout, "]}\n");
+}
+
+static void flipmon_view(struct flipmon *m, double sec)
+{
+	int i, n;
+
+	if (m->tty)
+		fprintf(stdout, "\033[H\033[2J");
+
+	fprintf(stdout, "%s sampling, %u samples, %lluns a sample\n",
+		m->vblank ? "vblank" : "timer", m->samples,
+		(unsigned long long)(m->samples ? m->sample_ns / m->samples : 0));
+
+	for (i = 0; i < m->count; i++) {
+		struct flipmon_module *mm = &m->modules[i];
+
+		for (n = 0; n < hw_reg_get_layer_num(mm->module); n++) {
+			struct flipmon_layer *l = &mm->layers[n];
+			double mean = flipmon_mean(l);
+			double jitter = flipmon_jitter(l, mean);
+
+			if (!l->enabled) {
+				fprintf(stdout, " mlc.%d %-5s off\n", mm->module,
+					flipmon_layer_name[l->layer]);
+				continue;
+			}
+
+			fprintf(stdout,
+				" mlc.%d %-5s %7.2f fps, frame %.2f ms (min %.2f, max %.2f, jitter %.3f), missed %u, late %u\n",
+				mm->module, flipmon_layer_name[l->layer],
+				l->flips / sec, mean / 1000, l->min_us / 1000.0,
+				l->max_us / 1000.0, jitter / 1000, l->missed,
+				mm->late);
+		}
+	}
+}
+
+static void flipmon_report(int fd, uint32_t events, void *data)
+{
+	struct flipmon *m = data;
+	uint64_t now = flipmon_now_ns() / 1000;
+	double sec = (now - m->report_us) / 1000000.0;
+	int i, n;
+
+	if (m->json)
+		flipmon_json(m, sec);
+	else
+		flipmon_view(m, sec);
+	fflush(stdout);
+
+	for (i = 0; i < m->count; i++) {
+		struct flipmon_module *mm = &m->modules[i];
+
+		mm->late = 0;
+		for (n = 0; n < NUMBER_OF_MLC_LAYER; n++) {
+			struct flipmon_layer *l = &mm->layers[n];
+
+			if (l->frames)
+				l->cadence_us = l->sum_us / l->frames;
+			l->flips = l->frames = l->missed = 0;
+			l->sum_us = l->min_us = l->max_us = 0;
+			l->sum2 = 0;
+		}
+	}
+
+	m->samples = 0;
+	m->sample_ns = 0;
+	m->report_us = now;
+}
+
+static void flipmon_stop(int fd, uint32_t events, void *data)
+{
+	struct flipmon *m = data;
+
+	evloop_quit(m->loop);
+}
+
+int flipmon_run(struct flipmon *m, unsigned int report, unsigned int msec,
+		bool json)
+{
+	const int signals[] = { SIGINT, SIGTERM };
+	int i, ret;
+
+	m->json = json;
+	m->tty = isatty(STDOUT_FILENO);
+
+	m->loop = evloop_create();
+	if (!m->loop)
+		return -ENOMEM;
+
+	/* on the vblanks of every module, else on the timer */
+	m->vblank = m->drm_fd >= 0;
+	for (i = 0; i < m->count && m->vblank; i++)
+		if (flipmon_wait_vblank(&m->modules[i])) {
+			fprintf(stderr, "no vblank of mlc.%d, sample at %u Hz\n",
+				m->modules[i].module, m->rate);
+			m->vblank = false;
+		}
+
+	if (m->vblank) {
+		m->evctx.version = 2;
+		m->evctx.vblank_handler = flipmon_vblank;
+		ret = evloop_add(m->loop, m->drm_fd, EPOLLIN,
+				 flipmon_drm_event, m);
+	} else {
+		ret = evloop_add_timer_ns(m->loop, 1000000000ull / m->rate, 1,
+					  flipmon_timer, m);
+	}
+
+	if (ret >= 0)
+		ret = evloop_add_signal(m->loop, signals, ARRAY_SIZE(signals),
+					flipmon_stop, m);
+	if (ret >= 0 && msec)
+		ret = evloop_add_timer(m->loop, msec, 0, flipmon_stop, m);
+	if (ret >= 0)
+		ret = evloop_add_timer(m->loop, report ? report : 1000, 1,
+				       flipmon_report, m);
+	if (ret < 0)
+		goto __exit_run;
+
+	m->report_us = flipmon_now_ns() / 1000;
+
+	ret = evloop_run(m->loop);
+	if (!ret)
+		ret = m->error;
+
+__exit_run:
+	evloop_destroy(m->loop);
+	m->loop = NULL;
+
+	return ret < 0 ? ret : 0;
+}
@@ -0,0 +1,23 @@
+#ifndef __FLIPMON_H__
+#define __FLIPMON_H__
+
+#include <stdbool.h>
+
+/*
+ * Flip rate of the layers of the mapped modules, from their address
+ * registers. A layer flips when one of its plane addresses changes.
+ * With a drm fd the registers are sampled on the vblanks of the module's
+ * pipe, else at 'rate' Hz. 'vblank' has the drmWaitVBlank pipe bits of
+ * the crtc of each module, -1 for one without.
+ */
+struct flipmon;
+
+struct flipmon *flipmon_create(unsigned int rate, int drm_fd,
+			       const int *vblank);
+void flipmon_destroy(struct flipmon *m);
+
+/* reports every 'report' msec, as a json line or a live view */
+int flipmon_run(struct flipmon *m, unsigned int report, unsigned int msec,
+		bool json);
+
+#endif
@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 
@@ -40,6 +42,7 @@
 #include "common.h"
 #include "format.h"
 #include "image.h"
+#include "timeline.h"
 
 static unsigned int util_yuv_height(unsigned int fourcc,
 				    unsigned int width, unsigned int height)
@@ -74,128 +77,332 @@ static unsigned int util_yuv_height(unsigned int fourcc,
 	return virtual_height;
 }
 
-static int util_load_raw_yuv(const char *file, unsigned int fourcc,
-			     void *virtual[3], unsigned int width,
-			     unsigned int height,
-			     unsigned int stride[3], unsigned int bpp,
-			     unsigned int start_offset)
+static int util_read_full(int fd, void *addr, size_t size, off_t offset)
 {
-	void *addr;
-	FILE *fp = NULL;
-	int i, n, div;
+	while (size) {
+		ssize_t ret = pread(fd, addr, size, offset);
 
-	fp = fopen(file, "rb");
-	if (!fp) {
-		fprintf(stderr, "Error file %s\n", file);
-		perror("- error");
-		return errno;
+		if (ret <= 0) {
+			fprintf(stderr, "Reading error: %s\n",
+				ret ? strerror(errno) : "end of file");
+			return -EIO;
+		}
+
+		addr += ret;
+		offset += ret;
+		size -= ret;
 	}
-	fseek(fp, start_offset, SEEK_SET);
 
-	for (i = 0; i < 3; i++) {
-		addr = virtual[i];
-		div = 1;
+	return 0;
+}
 
-		if (i != 0)
-			if ((fourcc == DRM_FORMAT_YUV420) ||
-			    (fourcc == DRM_FORMAT_YVU420))
-				div = 2;
+/* the file has the same line stride as the buffer */
+static size_t util_plane_size(unsigned int fourcc, int plane,
+			      unsigned int height, unsigned int stride)
+{
+	const struct util_format_info *info = util_format_info_find(fourcc);
+	int div = 1;
 
-		for (n = 0; n < (int)height / div; n++) {
-			size_t ret = fread(addr, 1, stride[i], fp);
+	/* the chroma planes of 4:2:0 have half the lines */
+	if (plane != 0 && info && info->yuv.ysub)
+		div = info->yuv.ysub;
 
-			if (ret != (size_t)stride[i]) {
-				fprintf(stderr, "Reading error: %s\n",
-					strerror(errno));
-				return errno;
-			}
+	return (size_t)stride * (height / div);
+}
 
-			addr += stride[i];
-		}
-	}
+static size_t util_image_size(unsigned int fourcc, unsigned int height,
+			      unsigned int pitches[4])
+{
+	size_t size = 0;
+	int i;
 
-	fclose(fp);
+	if (!util_format_is_yuv(fourcc))
+		return (size_t)pitches[0] * height;
+
+	for (i = 0; i < 3; i++)
+		size += util_plane_size(fourcc, i, height, pitches[i]);
+
+	return size;
+}
+
+static int util_load_raw_yuv(int fd, unsigned int fourcc,
+			     void *virtual[3], unsigned int width,
+			     unsigned int height,
+			     unsigned int stride[3], unsigned int bpp,
+			     off_t start_offset)
+{
+	size_t size;
+	int i, ret;
+
+	for (i = 0; i < 3; i++) {
+		size = util_plane_size(fourcc, i, height, stride[i]);
+		if (!size)
+			continue;
+
+		ret = util_read_full(fd, virtual[i], size, start_offset);
+		if (ret)
+			return ret;
+
+		start_offset += size;
+	}
 
 	return 0;
 }
 
-static int util_load_raw_rgb(const char *file, unsigned int fourcc,
+static int util_load_raw_rgb(int fd, unsigned int fourcc,
 			     void *virtual, unsigned int width,
 			     unsigned int height,
 			     unsigned int stride, unsigned int bpp,
-			     unsigned int start_offset)
+			     off_t start_offset)
+{
+	return util_read_full(fd, virtual, (size_t)stride * height,
+			      start_offset);
+}
+
+struct util_plane_desc {
+	unsigned int cpp;	/* bytes of a unit */
+	unsigned int xdiv;	/* pixels of a unit */
+	unsigned int ydiv;	/* lines of a plane line */
+};
+
+static int util_plane_descs(unsigned int fourcc, struct util_plane_desc d[3])
 {
-	void *buffer;
-	FILE *fp = NULL;
+	const struct util_format_info *info = util_format_info_find(fourcc);
+	const struct util_yuv_info *yuv;
 	int i;
 
-	fp = fopen(file, "rb");
-	if (!fp) {
-		fprintf(stderr, "Error file %s\n", file);
-		perror("- error");
-		return errno;
+	if (!info)
+		return 0;
+
+	yuv = &info->yuv;
+
+	d[0].cpp = 1;
+	d[0].xdiv = 1;
+	d[0].ydiv = 1;
+
+	/* packed yuv, two pixels share a chroma pair */
+	if (yuv->order & (YUV_YC | YUV_CY)) {
+		d[0].cpp = 4;
+		d[0].xdiv = 2;
+		return 1;
 	}
-	fseek(fp, start_offset, SEEK_SET);
 
-	buffer = malloc(stride);
-	if (!buffer) {
-		fprintf(stderr, "memory allocation failed\n");
-		fclose(fp);
-		return -ENOMEM;
+	if (!util_format_is_yuv(fourcc)) {
+		d[0].cpp = util_format_bpp(fourcc, 1, 1) / 8;
+		return 1;
+	}
+
+	for (i = 1; i < 3; i++) {
+		d[i].cpp = yuv->chroma_stride;
+		d[i].xdiv = yuv->xsub;
+		d[i].ydiv = yuv->ysub;
+	}
+
+	/* semi-planar has the chroma pairs in one plane */
+	return yuv->chroma_stride == 2 ? 2 : 3;
+}
+
+/* a tightly packed image in memory, the caller frees the returned base */
+void *util_image_alloc(unsigned int fourcc, unsigned int width,
+		       unsigned int height, void *planes[3],
+		       unsigned int pitches[4])
+{
+	struct util_plane_desc d[3];
+	size_t offsets[3], size = 0;
+	void *base;
+	int i, n;
+
+	n = util_plane_descs(fourcc, d);
+	if (!n)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		pitches[i] = width / d[i].xdiv * d[i].cpp;
+		offsets[i] = size;
+		size += (size_t)pitches[i] * (height / d[i].ydiv);
 	}
 
-	for (i = 0; i < (int)height; i++) {
-		size_t ret = fread(buffer, 1, stride, fp);
+	base = malloc(size);
+	if (!base)
+		return NULL;
+
+	for (i = 0; i < 3; i++)
+		planes[i] = i < n ? base + offsets[i] : NULL;
+	for (i = n; i < 4; i++)
+		pitches[i] = 0;
 
-		if (ret != (size_t)stride) {
-			fprintf(stderr, "Reading error: %s\n", strerror(errno));
-			return errno;
+	return base;
+}
+
+#define util_scale_line(type, d, s, xmap, dw)                                   \
+	do {                                                                    \
+		type *__d = (type *)(d);                                        \
+		unsigned int __x;                                               \
+		for (__x = 0; __x < (dw); __x++)                                \
+			memcpy(&__d[__x], (s) + (xmap)[__x], sizeof(type));     \
+	} while (0)
+
+struct util_unit3 {
+	uint8_t b[3];
+};
+
+static void util_scale_plane(const void *src, unsigned int src_pitch,
+			     unsigned int sw, unsigned int sh,
+			     void *dst, unsigned int dst_pitch,
+			     unsigned int dw, unsigned int dh,
+			     unsigned int cpp, unsigned int *xmap)
+{
+	const void *s;
+	void *d;
+	unsigned int x, y, sy, prev = ~0u;
+
+	for (x = 0; x < dw; x++)
+		xmap[x] = (unsigned int)((uint64_t)x * sw / dw) * cpp;
+
+	for (y = 0; y < dh; y++) {
+		sy = (uint64_t)y * sh / dh;
+		d = dst + (size_t)y * dst_pitch;
+
+		/* an upscaled line repeats the one above */
+		if (sy == prev) {
+			memcpy(d, d - dst_pitch, (size_t)dw * cpp);
+			continue;
 		}
 
-		memcpy(virtual, buffer, stride);
-		virtual += stride;
+		s = src + (size_t)sy * src_pitch;
+		switch (cpp) {
+		case 1:
+			util_scale_line(uint8_t, d, s, xmap, dw);
+			break;
+		case 2:
+			util_scale_line(uint16_t, d, s, xmap, dw);
+			break;
+		case 3:
+			util_scale_line(struct util_unit3, d, s, xmap, dw);
+			break;
+		case 4:
+			util_scale_line(uint32_t, d, s, xmap, dw);
+			break;
+		}
+		prev = sy;
 	}
+}
+
+/*
+ * Nearest neighbour scaling for the planes a plane can't scale, the units
+ * are copied as they are so any format of the same layout scales.
+ */
+int util_scale_image(unsigned int fourcc,
+		     void *src[3], const unsigned int src_pitches[4],
+		     unsigned int sw, unsigned int sh,
+		     void *dst[3], const unsigned int dst_pitches[4],
+		     unsigned int dw, unsigned int dh)
+{
+	struct util_plane_desc d[3];
+	unsigned int *xmap;
+	int i, n;
+
+	n = util_plane_descs(fourcc, d);
+	if (!n || !sw || !sh || !dw || !dh)
+		return -EINVAL;
+
+	xmap = malloc(dw * sizeof(*xmap));
+	if (!xmap)
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++)
+		util_scale_plane(src[i], src_pitches[i],
+				 sw / d[i].xdiv, sh / d[i].ydiv,
+				 dst[i], dst_pitches[i],
+				 dw / d[i].xdiv, dh / d[i].ydiv,
+				 d[i].cpp, xmap);
 
-	free(buffer);
-	fclose(fp);
+	free(xmap);
 
 	return 0;
 }
 
-struct bo *util_bo_create_image(int fd, unsigned int fourcc,
-				unsigned int width, unsigned int height,
-				unsigned int handles[4],
-				unsigned int pitches[4],
-				unsigned int offsets[4],
-				const struct util_image_info *image)
+int util_load_image_fd(int fd, unsigned int fourcc, void *planes[3],
+		       unsigned int width, unsigned int height,
+		       unsigned int pitches[4], off_t offset)
+{
+	int bpp = util_format_bpp(fourcc, width, height);
+
+	if (!bpp)
+		return -EINVAL;
+
+	if (util_format_is_yuv(fourcc))
+		return util_load_raw_yuv(fd, fourcc,
+					 planes, width, height, pitches,
+					 bpp, offset);
+
+	return util_load_raw_rgb(fd, fourcc,
+				 planes[0], width, height, pitches[0],
+				 bpp, offset);
+}
+
+/* a udmabuf is filled in the kernel, a dumb buffer through its mapping */
+int util_load_image_bo(int fd, struct bo *bo, unsigned int fourcc,
+		       void *planes[3], unsigned int width,
+		       unsigned int height, unsigned int pitches[4],
+		       off_t offset)
+{
+	if (bo && bo_is_udmabuf(bo))
+		return bo_load_fd(bo, fd, offset,
+				  util_image_size(fourcc, height, pitches));
+
+	return util_load_image_fd(fd, fourcc, planes, width, height, pitches,
+				  offset);
+}
+
+int util_load_image(struct bo *bo, unsigned int fourcc, void *planes[3],
+		    unsigned int width, unsigned int height,
+		    unsigned int pitches[4],
+		    const struct util_image_info *image)
+{
+	int fd, ret;
+
+	fd = open(image->file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error file %s\n", image->file);
+		perror("- error");
+		return -errno;
+	}
+
+	ret = util_load_image_bo(fd, bo, fourcc, planes, width, height,
+				 pitches, image->offset);
+	close(fd);
+
+	return ret;
+}
+
+struct bo *util_bo_create(int fd, enum util_bo_type type, unsigned int fourcc,
+			  unsigned int width, unsigned int height,
+			  unsigned int handles[4],
+			  unsigned int pitches[4],
+			  unsigned int offsets[4],
+			  void *planes[3])
 {
 	struct bo *bo;
-	void *planes[3] = { 0, };
 	void *virtual;
-	struct stat st;
-	int bpp = 8, isyuv = 0;
+	int bpp;
 	unsigned int virtual_height = height;
+	uint64_t ts;
 	int ret;
 
-	if (!image || !image->file) {
-		fprintf(stderr, "No input image info !!!\n");
-		return NULL;
-	}
-
-	if (!stat(image->file, &st) && (errno == EEXIST)) {
-		fprintf(stderr, "Image file not found :%s\n", image->file);
-		return NULL;
-	}
-
 	bpp = util_format_bpp(fourcc, width, height);
 	if (!bpp)
 		return NULL;
 
-	isyuv = util_format_is_yuv(fourcc);
-	if (isyuv)
+	if (util_format_is_yuv(fourcc))
 		virtual_height = util_yuv_height(fourcc, width, height);
 
-	bo = bo_create_dumb(fd, width, virtual_height, bpp);
+	ts = timeline_begin();
+	if (type == UTIL_BO_UDMABUF)
+		bo = bo_create_udmabuf(fd, width, virtual_height, bpp);
+	else
+		bo = bo_create_dumb(fd, width, virtual_height, bpp);
+	timeline_end("drm", "bo create", ts);
 	if (!bo)
 		return NULL;
 
@@ -203,26 +410,48 @@ struct bo *util_bo_create_image(int fd, unsigned int fourcc,
 	if (ret) {
 		fprintf(stderr, "failed to map buffer: %s\n",
 			strerror(-errno));
-		bo_destroy_dumb(bo);
+		bo_destroy(bo);
 		return NULL;
 	}
 
 	ret = bo_dumb_to_plane(fourcc, width, height,
 			       bo, virtual, handles, pitches, offsets, planes);
 	if (ret) {
-		bo_unmap(bo);
-		bo_destroy_dumb(bo);
+		bo_destroy(bo);
 		return NULL;
 	}
 
-	if (isyuv)
-		util_load_raw_yuv(image->file, fourcc,
-				  planes, width, height, pitches,
-				  bpp, image->offset);
-	else
-		util_load_raw_rgb(image->file, fourcc,
-				  planes[0], width, height, pitches[0],
-				  bpp, image->offset);
+	return bo;
+}
+
+struct bo *util_bo_create_image(int fd, enum util_bo_type type,
+				unsigned int fourcc,
+				unsigned int width, unsigned int height,
+				unsigned int handles[4],
+				unsigned int pitches[4],
+				unsigned int offsets[4],
+				const struct util_image_info *image)
+{
+	struct bo *bo;
+	void *planes[3] = { 0, };
+	struct stat st;
+
+	if (!image || !image->file) {
+		fprintf(stderr, "No input image info !!!\n");
+		return NULL;
+	}
+
+	if (!stat(image->file, &st) && (errno == EEXIST)) {
+		fprintf(stderr, "Image file not found :%s\n", image->file);
+		return NULL;
+	}
+
+	bo = util_bo_create(fd, type, fourcc, width, height,
+			    handles, pitches, offsets, planes);
+	if (!bo)
+		return NULL;
+
+	util_load_image(bo, fourcc, planes, width, height, pitches, image);
 
 	bo_unmap(bo);
 
@@ -1,6 +1,8 @@
 #ifndef __UTIL_IMAGE_H__
 #define __UTIL_IMAGE_H__
 
+#include <sys/types.h>
+
 #include "buffers.h"
 
 enum util_image_type {
@@ -8,13 +10,44 @@ enum util_image_type {
 	UTIL_IMAGE_RAW,
 };
 
+enum util_bo_type {
+	UTIL_BO_DUMB,
+	UTIL_BO_UDMABUF,	/* memfd pages imported as a dma-buf */
+};
+
 struct util_image_info {
 	const char *file;
 	enum util_image_type type;
-	unsigned int offset;
+	off_t offset;
 };
 
-struct bo *util_bo_create_image(int fd, unsigned int fourcc,
+int util_load_image_fd(int fd, unsigned int fourcc, void *planes[3],
+		       unsigned int width, unsigned int height,
+		       unsigned int pitches[4], off_t offset);
+int util_load_image_bo(int fd, struct bo *bo, unsigned int fourcc,
+		       void *planes[3], unsigned int width,
+		       unsigned int height, unsigned int pitches[4],
+		       off_t offset);
+int util_load_image(struct bo *bo, unsigned int fourcc, void *planes[3],
+		    unsigned int width, unsigned int height,
+		    unsigned int pitches[4],
+		    const struct util_image_info *image);
+void *util_image_alloc(unsigned int fourcc, unsigned int width,
+		       unsigned int height, void *planes[3],
+		       unsigned int pitches[4]);
+int util_scale_image(unsigned int fourcc,
+		     void *src[3], const unsigned int src_pitches[4],
+		     unsigned int sw, unsigned int sh,
+		     void *dst[3], const unsigned int dst_pitches[4],
+		     unsigned int dw, unsigned int dh);
+struct bo *util_bo_create(int fd, enum util_bo_type type, unsigned int fourcc,
+			  unsigned int width, unsigned int height,
+			  unsigned int handles[4],
+			  unsigned int pitches[4],
+			  unsigned int offsets[4],
+			  void *planes[3]);
+struct bo *util_bo_create_image(int fd, enum util_bo_type type,
+				unsigned int fourcc,
 				unsigned int width, unsigned int height,
 				unsigned int handles[4],
 				unsigned int pitches[4],
@@ -3,46 +3,273 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include "iomap.h"
+#include "iosim.h"
 
-void *iomem_map(const void *addr, size_t length, void *mapped)
+#define IO_MMAP_MAX		64
+#define UIO_MAX_MAPS		5
+
+/* live mappings, a backend maps more than the caller knows of */
+static struct {
+	void *base;
+	size_t size;
+} iomem_maps[IO_MMAP_MAX];
+/* the captures and the replay map from threads of their own */
+static pthread_mutex_t iomem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* opened on the first map, kept for the next ones until the close */
+static int devmem_fd = -1;
+
+static void devmem_close(void)
+{
+	if (devmem_fd >= 0)
+		close(devmem_fd);
+
+	devmem_fd = -1;
+}
+
+static void *devmem_map(size_t physical, size_t length,
+			size_t *start, size_t *size)
 {
 	void *mem;
-	size_t physical = (size_t)addr;
-	int fd;
 
-	fd = open(IO_MMAP_DEVICE, O_RDWR | O_SYNC);
-	if (fd < 0) {
+	if (devmem_fd < 0)
+		devmem_fd = open(IO_MMAP_DEVICE, O_RDWR | O_SYNC | O_CLOEXEC);
+	if (devmem_fd < 0) {
 		fprintf(stderr, "Fail open %s", IO_MMAP_DEVICE);
 		perror(" - erro");
-		return 0;
+		return NULL;
 	}
 
-	physical = MAP_ALIGN_ADDR(physical);
-	length = MAP_ALIGN_SIZE(length);
+	*start = MAP_ALIGN_ADDR(physical);
+	*size = MAP_ALIGN_SIZE((physical - *start + length));
 
-	mem = mmap((void *)0, length,
+	mem = mmap((void *)0, *size,
 		   PROT_READ | PROT_WRITE, MAP_SHARED,
-		   fd, (off_t)physical);
+		   devmem_fd, (off_t)*start);
 	if (mem == MAP_FAILED) {
 		fprintf(stderr, "Fail map addr 0x%x length %d",
-			(unsigned int)physical, (int)length);
+			(unsigned int)*start, (int)*size);
 		perror(" - erro");
-		close(fd);
+		return NULL;
+	}
+
+	return mem;
+}
+
+static const struct iomem_backend iomem_devmem = {
+	.name = "mem",
+	.close = devmem_close,
+	.map = devmem_map,
+};
+
+/* a uio device has its ranges in sysfs, map N is at page N of the device */
+static struct {
+	int fd;
+	int count;
+	size_t addr[UIO_MAX_MAPS];
+	size_t size[UIO_MAX_MAPS];
+} uio = { .fd = -1 };
+
+static int uio_read_attr(const char *name, int map, const char *attr,
+			 size_t *value)
+{
+	char path[128];
+	FILE *fp;
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/class/uio/%s/maps/map%d/%s",
+		 name, map, attr);
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	ret = fscanf(fp, "%zx", value) == 1 ? 0 : -EINVAL;
+	fclose(fp);
+
+	return ret;
+}
+
+static int uio_open(const char *dev)
+{
+	const char *name;
+
+	if (!dev)
+		return -EINVAL;
+
+	name = strrchr(dev, '/');
+	name = name ? name + 1 : dev;
+
+	for (uio.count = 0; uio.count < UIO_MAX_MAPS; uio.count++)
+		if (uio_read_attr(name, uio.count, "addr",
+				  &uio.addr[uio.count]) ||
+		    uio_read_attr(name, uio.count, "size",
+				  &uio.size[uio.count]))
+			break;
+
+	if (!uio.count) {
+		fprintf(stderr, "no uio maps of %s\n", name);
+		return -ENODEV;
+	}
+
+	uio.fd = open(dev, O_RDWR | O_SYNC);
+	if (uio.fd < 0) {
+		fprintf(stderr, "Fail open %s", dev);
+		perror(" - erro");
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void uio_close(void)
+{
+	if (uio.fd >= 0)
+		close(uio.fd);
+
+	uio.fd = -1;
+	uio.count = 0;
+}
+
+static void *uio_map(size_t physical, size_t length,
+		     size_t *start, size_t *size)
+{
+	void *mem;
+	int i;
+
+	for (i = 0; i < uio.count; i++) {
+		if (physical < uio.addr[i] ||
+		    physical + length > uio.addr[i] + uio.size[i])
+			continue;
+
+		mem = mmap(NULL, uio.size[i], PROT_READ | PROT_WRITE,
+			   MAP_SHARED, uio.fd, (off_t)i * getpagesize());
+		if (mem == MAP_FAILED) {
+			fprintf(stderr, "Fail map uio map%d", i);
+			perror(" - erro");
+			return NULL;
+		}
+
+		*start = uio.addr[i];
+		*size = uio.size[i];
+
 		return mem;
 	}
 
-	if (mapped)
-		mapped = mem;
+	fprintf(stderr, "0x%zx length %zu is not in a uio map\n",
+		physical, length);
 
-	close(fd);
+	return NULL;
+}
+
+static const struct iomem_backend iomem_uio = {
+	.name = "uio",
+	.open = uio_open,
+	.close = uio_close,
+	.map = uio_map,
+};
+
+static const struct iomem_backend *iomem_backends[] = {
+	&iomem_devmem,
+	&iomem_uio,
+	&iosim_backend,
+};
+
+static const struct iomem_backend *iomem = &iomem_devmem;
+
+int iomem_open(const char *backend)
+{
+	const char *arg = strchr(backend, ':');
+	size_t len = arg ? (size_t)(arg - backend) : strlen(backend);
+	unsigned int i;
+	int ret;
 
-	return mem + ((size_t)addr - physical);
+	for (i = 0; i < sizeof(iomem_backends) / sizeof(iomem_backends[0]);
+	     i++) {
+		const struct iomem_backend *b = iomem_backends[i];
+
+		if (strlen(b->name) != len || strncmp(b->name, backend, len))
+			continue;
+
+		ret = b->open ? b->open(arg ? arg + 1 : NULL) : 0;
+		if (!ret)
+			iomem = b;
+
+		return ret;
+	}
+
+	fprintf(stderr, "unknown io backend %s\n", backend);
+
+	return -EINVAL;
+}
+
+void iomem_close(void)
+{
+	pthread_mutex_lock(&iomem_lock);
+
+	if (iomem->close)
+		iomem->close();
+
+	iomem = &iomem_devmem;
+
+	pthread_mutex_unlock(&iomem_lock);
+}
+
+void *iomem_map(const void *addr, size_t length, void **mapped)
+{
+	size_t physical = (size_t)addr;
+	size_t start, size;
+	void *mem = NULL;
+	int i;
+
+	pthread_mutex_lock(&iomem_lock);
+
+	for (i = 0; i < IO_MMAP_MAX; i++)
+		if (!iomem_maps[i].base)
+			break;
+
+	if (i == IO_MMAP_MAX) {
+		fprintf(stderr, "Fail map addr %p, over %d maps\n",
+			addr, IO_MMAP_MAX);
+		goto __exit_map;
+	}
+
+	mem = iomem->map(physical, length, &start, &size);
+	if (!mem)
+		goto __exit_map;
+
+	iomem_maps[i].base = mem;
+	iomem_maps[i].size = size;
+
+__exit_map:
+	pthread_mutex_unlock(&iomem_lock);
+	if (!mem)
+		return NULL;
+
+	if (mapped)
+		*mapped = mem;
+
+	return mem + (physical - start);
 }
 
 void iomem_free(void *addr, size_t length)
 {
-	if (addr && length)
-		munmap(addr, length);
+	int i;
+
+	if (!addr)
+		return;
+
+	pthread_mutex_lock(&iomem_lock);
+
+	for (i = 0; i < IO_MMAP_MAX; i++)
+		if (iomem_maps[i].base == addr) {
+			munmap(addr, iomem_maps[i].size);
+			iomem_maps[i].base = NULL;
+			break;
+		}
+
+	pthread_mutex_unlock(&iomem_lock);
 }
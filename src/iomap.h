@@ -1,12 +1,31 @@
 #ifndef __IO_MAP_H__
-#define __IO MAP_H__
+#define __IO_MAP_H__
+
+#include <stddef.h>
 
 #define	IO_MMAP_DEVICE          "/dev/mem"
 #define	IO_MMAP_ALIGN           (4096)
 #define MAP_ALIGN_ADDR(p)       (p & ~((IO_MMAP_ALIGN) - 1))
 #define MAP_ALIGN_SIZE(s)       ((s & ~((IO_MMAP_ALIGN) - 1)) + IO_MMAP_ALIGN)
 
-void *iomem_map(const void *addr, size_t length, void *map_addr);
+/*
+ * Where the physical ranges are mapped from. 'map' returns the mapping of
+ * 'size' bytes over [physical, physical + length), its first byte is the
+ * physical address 'start'.
+ */
+struct iomem_backend {
+	const char *name;
+	int (*open)(const char *arg);
+	void (*close)(void);
+	void *(*map)(size_t physical, size_t length,
+		     size_t *start, size_t *size);
+};
+
+/* "mem" (default), "uio:<dev>" or "sim:<file>[@<hz>]" */
+int iomem_open(const char *backend);
+void iomem_close(void);
+
+void *iomem_map(const void *addr, size_t length, void **mapped);
 void iomem_free(void *addr, size_t length);
 
 #endif
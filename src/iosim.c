@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+
+#include "iosim.h"
+#include "mlc.h"
+#include "io.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC		0x0001U
+#endif
+
+static struct {
+	/* a copy of the file, the device is written without changing it */
+	int memfd;
+	struct iosim_region *regions;
+	int count;
+
+	/* address flips */
+	unsigned int rate;
+	unsigned int frames[NUMBER_OF_MLC_MODULE][mlc_layer_unknown];
+	volatile uint32_t *regs[NUMBER_OF_MLC_MODULE];
+	void *regs_map[NUMBER_OF_MLC_MODULE];
+	size_t regs_size[NUMBER_OF_MLC_MODULE];
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running, quit;
+} sim = { .memfd = -1 };
+
+size_t iosim_layout(struct iosim_region *regions, int count)
+{
+	size_t page = getpagesize();
+	size_t offset;
+	int i;
+
+	offset = sizeof(struct iosim_header) + count * sizeof(*regions);
+
+	for (i = 0; i < count; i++) {
+		offset = (offset + page - 1) & ~(page - 1);
+		regions[i].offset = offset;
+		offset += regions[i].size;
+	}
+
+	return (offset + page - 1) & ~(page - 1);
+}
+
+static struct iosim_region *iosim_find(size_t physical, size_t length)
+{
+	int i;
+
+	for (i = 0; i < sim.count; i++) {
+		struct iosim_region *r = &sim.regions[i];
+
+		if (physical >= r->phys && physical + length <= r->phys + r->size)
+			return r;
+	}
+
+	return NULL;
+}
+
+static void *iosim_map(size_t physical, size_t length,
+		       size_t *start, size_t *size)
+{
+	size_t page = getpagesize();
+	struct iosim_region *r;
+	off_t offset, aligned;
+	void *mem;
+
+	r = iosim_find(physical, length);
+	if (!r) {
+		fprintf(stderr, "0x%zx length %zu is not simulated\n",
+			physical, length);
+		return NULL;
+	}
+
+	offset = r->offset + (physical - r->phys);
+	aligned = offset & ~(page - 1);
+
+	*start = physical - (offset - aligned);
+	*size = (offset - aligned + length + page - 1) & ~(page - 1);
+
+	mem = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   sim.memfd, aligned);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "Fail map simulated 0x%zx", physical);
+		perror(" - erro");
+		return NULL;
+	}
+
+	return mem;
+}
+
+/* the layers show frame 'tick' of theirs */
+static void iosim_flip(unsigned int tick)
+{
+	static const unsigned short rgb_address[] = {
+		[mlc_layer_rgb0] = MLC_REG(rgb[0].mlcaddress),
+		[mlc_layer_rgb1] = MLC_REG(rgb[1].mlcaddress),
+	};
+	static const unsigned short yuv_address[] = {
+		MLC_REG(yuv.mlcaddress),
+		MLC_REG(yuv.mlcaddresscb),
+		MLC_REG(yuv.mlcaddresscr),
+	};
+	int i;
+
+	for (i = 0; i < sim.count; i++) {
+		struct iosim_region *r = &sim.regions[i];
+		volatile uint32_t *regs;
+		unsigned int word;
+
+		if (r->layer == IOSIM_LAYER_REGS)
+			continue;
+
+		regs = sim.regs[r->module];
+		if (!regs || r->frame != tick % sim.frames[r->module][r->layer])
+			continue;
+
+		if (r->layer == mlc_layer_video)
+			word = yuv_address[r->plane];
+		else
+			word = rgb_address[r->layer];
+
+		writel((uint32_t)r->phys, regs + word);
+	}
+}
+
+static void *iosim_flip_thread(void *arg)
+{
+	uint64_t period = 1000000000ull / sim.rate;
+	unsigned int tick = 0;
+	struct timespec next;
+	sigset_t mask;
+
+	/* the signals go to the thread waiting on them */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	pthread_mutex_lock(&sim.lock);
+
+	while (!sim.quit) {
+		next.tv_nsec += period;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+
+		while (!sim.quit &&
+		       pthread_cond_timedwait(&sim.cond, &sim.lock,
+					      &next) != ETIMEDOUT)
+			;
+
+		if (!sim.quit)
+			iosim_flip(++tick);
+	}
+
+	pthread_mutex_unlock(&sim.lock);
+
+	return NULL;
+}
+
+static int iosim_flip_start(void)
+{
+	pthread_condattr_t attr;
+	bool flips = false;
+	int i;
+
+	for (i = 0; i < sim.count; i++) {
+		struct iosim_region *r = &sim.regions[i];
+		unsigned int *frames;
+
+		if (r->module < 0 || r->module >= NUMBER_OF_MLC_MODULE ||
+		    r->layer < IOSIM_LAYER_REGS ||
+		    r->layer >= mlc_layer_unknown || r->plane > 2)
+			return -EINVAL;
+
+		if (r->layer == IOSIM_LAYER_REGS) {
+			void *mem;
+			size_t start;
+
+			mem = iosim_map(r->phys, r->size, &start,
+					&sim.regs_size[r->module]);
+			if (!mem)
+				return -ENOMEM;
+			sim.regs_map[r->module] = mem;
+			sim.regs[r->module] = mem + (r->phys - start);
+			continue;
+		}
+
+		frames = &sim.frames[r->module][r->layer];
+		if (r->frame >= *frames)
+			*frames = r->frame + 1;
+		if (*frames > 1)
+			flips = true;
+	}
+
+	if (!sim.rate || !flips)
+		return 0;
+
+	pthread_mutex_init(&sim.lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sim.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	sim.quit = false;
+	if (pthread_create(&sim.thread, NULL, iosim_flip_thread, NULL)) {
+		fprintf(stderr, "failed to create flip thread\n");
+		pthread_cond_destroy(&sim.cond);
+		pthread_mutex_destroy(&sim.lock);
+		return -EINVAL;
+	}
+	sim.running = true;
+
+	return 0;
+}
+
+static void iosim_close(void)
+{
+	int i;
+
+	if (sim.running) {
+		pthread_mutex_lock(&sim.lock);
+		sim.quit = true;
+		pthread_cond_signal(&sim.cond);
+		pthread_mutex_unlock(&sim.lock);
+
+		pthread_join(sim.thread, NULL);
+		pthread_cond_destroy(&sim.cond);
+		pthread_mutex_destroy(&sim.lock);
+		sim.running = false;
+	}
+
+	for (i = 0; i < NUMBER_OF_MLC_MODULE; i++) {
+		if (sim.regs_map[i])
+			munmap(sim.regs_map[i], sim.regs_size[i]);
+		sim.regs_map[i] = NULL;
+		sim.regs[i] = NULL;
+	}
+
+	if (sim.memfd >= 0)
+		close(sim.memfd);
+	sim.memfd = -1;
+
+	free(sim.regions);
+	sim.regions = NULL;
+	sim.count = 0;
+	memset(sim.frames, 0, sizeof(sim.frames));
+}
+
+/* <file>[@<hz>] */
+static int iosim_open(const char *arg)
+{
+	const char magic[4] = IOSIM_MAGIC;
+	struct iosim_header header;
+	char *file, *rate;
+	struct stat st;
+	off_t offset = 0;
+	size_t size;
+	int i, fd, ret = -EINVAL;
+
+	if (!arg)
+		return -EINVAL;
+
+	file = strdup(arg);
+	if (!file)
+		return -ENOMEM;
+
+	rate = strrchr(file, '@');
+	if (rate) {
+		*rate++ = '\0';
+		sim.rate = strtoul(rate, NULL, 10);
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error file %s\n", file);
+		perror("- error");
+		free(file);
+		return -errno;
+	}
+
+	if (fstat(fd, &st) ||
+	    pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    memcmp(header.magic, magic, sizeof(magic))) {
+		fprintf(stderr, "%s is not a simulated device\n", file);
+		goto __exit_open;
+	}
+
+	size = header.regions * sizeof(*sim.regions);
+	sim.regions = malloc(size);
+	if (!sim.regions ||
+	    pread(fd, sim.regions, size, sizeof(header)) != (ssize_t)size) {
+		fprintf(stderr, "%s has no region table\n", file);
+		goto __exit_open;
+	}
+	sim.count = header.regions;
+
+	for (i = 0; i < sim.count; i++)
+		if (sim.regions[i].offset + sim.regions[i].size >
+		    (uint64_t)st.st_size) {
+			fprintf(stderr, "%s region %d is out of the file\n",
+				file, i);
+			goto __exit_open;
+		}
+
+	sim.memfd = syscall(SYS_memfd_create, "capture-display-sim",
+			    MFD_CLOEXEC);
+	if (sim.memfd < 0 || ftruncate(sim.memfd, st.st_size)) {
+		fprintf(stderr, "failed to create memfd: %s\n",
+			strerror(errno));
+		goto __exit_open;
+	}
+
+	while (offset < st.st_size) {
+		ssize_t n = sendfile(sim.memfd, fd, &offset,
+				     st.st_size - offset);
+
+		if (n <= 0) {
+			fprintf(stderr, "failed to load %s: %s\n", file,
+				n ? strerror(errno) : "end of file");
+			goto __exit_open;
+		}
+	}
+
+	ret = iosim_flip_start();
+	if (ret)
+		goto __exit_open;
+
+	fprintf(stderr, "simulated device %s, %d regions, flips at %u Hz\n",
+		file, sim.count, sim.running ? sim.rate : 0);
+
+	close(fd);
+	free(file);
+
+	return 0;
+
+__exit_open:
+	iosim_close();
+	close(fd);
+	free(file);
+
+	return ret;
+}
+
+const struct iomem_backend iosim_backend = {
+	.name = "sim",
+	.open = iosim_open,
+	.close = iosim_close,
+	.map = iosim_map,
+};
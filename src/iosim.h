@@ -0,0 +1,39 @@
+#ifndef __IO_SIM_H__
+#define __IO_SIM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "iomap.h"
+
+/*
+ * A simulated device file: the header, the region table, then the region
+ * contents at page aligned offsets. The registers of a module are a region
+ * at its physical base, the frames of a layer are regions at the addresses
+ * its registers point to. With a rate the simulator flips the layer
+ * addresses through the frames like a running display.
+ */
+#define IOSIM_MAGIC		{ 'M', 'L', 'C', 'S' }
+#define IOSIM_LAYER_REGS	(-1)
+
+struct iosim_header {
+	char magic[4];
+	uint32_t regions;
+};
+
+struct iosim_region {
+	uint64_t phys;
+	uint64_t size;
+	uint64_t offset;	/* in the file */
+	int32_t module;
+	int32_t layer;		/* mlc_layer or IOSIM_LAYER_REGS */
+	uint32_t plane;		/* y, cb, cr of the video layer */
+	uint32_t frame;
+};
+
+/* places the regions in the file, returns the file size */
+size_t iosim_layout(struct iosim_region *regions, int count);
+
+extern const struct iomem_backend iosim_backend;
+
+#endif
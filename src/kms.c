@@ -56,7 +56,7 @@ struct type_name {
 
 void drm_free_resources(struct resources *res)
 {
-	int i;
+	unsigned int i;
 
 	if (!res)
 		return;
@@ -65,33 +65,35 @@ void drm_free_resources(struct resources *res)
 	do {                                                                    \
 		if (!(_res)->type##s)                                           \
 			break;                                                  \
-		for (i = 0; i < (int)(_res)->__res->count_##type##s; ++i) {     \
-			if (!(_res)->type##s[i].type)                           \
-				break;                                          \
+		for (i = 0; i < (unsigned int)(_res)->__res->count_##type##s; ++i) \
 			drmModeFree##Type((_res)->type##s[i].type);             \
-		}                                                               \
 		free((_res)->type##s);                                          \
 	} while (0)
 
 #define free_properties(_res, __res, type)                                      \
 	do {                                                                    \
-		for (i = 0; i < (int)(_res)->__res->count_##type##s; ++i) {     \
-			drmModeFreeObjectProperties(res->type##s[i].props);     \
-			free(res->type##s[i].props_info);                       \
+		if (!(_res)->type##s)                                           \
+			break;                                                  \
+		for (i = 0; i < (unsigned int)(_res)->__res->count_##type##s; ++i) { \
+			struct object_props *p = &(_res)->type##s[i].props;     \
+			drmModeFreeObjectProperties(p->props);                  \
+			free(p->props_info);                                    \
+			free(p->index);                                         \
 		}                                                               \
 	} while (0)
 
 	if (res->res) {
 		free_properties(res, res, crtc);
+		free_properties(res, res, connector);
 
 		free_resource(res, res, crtc, Crtc);
 		free_resource(res, res, encoder, Encoder);
 
-		for (i = 0; i < res->res->count_connectors; i++)
+		for (i = 0; res->connectors &&
+		     i < (unsigned int)res->res->count_connectors; i++)
 			free(res->connectors[i].name);
 
 		free_resource(res, res, connector, Connector);
-		free_resource(res, res, fb, FB);
 
 		drmModeFreeResources(res->res);
 	}
@@ -104,13 +106,18 @@ void drm_free_resources(struct resources *res)
 		drmModeFreePlaneResources(res->plane_res);
 	}
 
+	/* the property infos are owned by the cache */
+	for (i = 0; i < res->cache.size; i++)
+		drmModeFreeProperty(res->cache.slots[i]);
+	free(res->cache.slots);
+
 	free(res);
 }
 
+/* only the object ids, the objects are fetched by the accessors below */
 struct resources *drm_get_resources(struct device *dev)
 {
 	struct resources *res;
-	int i;
 
 	res = calloc(1, sizeof(*res));
 	if (res == 0)
@@ -130,73 +137,10 @@ struct resources *drm_get_resources(struct device *dev)
 		calloc(res->res->count_encoders, sizeof(*res->encoders));
 	res->connectors =
 		calloc(res->res->count_connectors, sizeof(*res->connectors));
-	res->fbs = calloc(res->res->count_fbs, sizeof(*res->fbs));
 
-	if (!res->crtcs || !res->encoders || !res->connectors || !res->fbs)
+	if (!res->crtcs || !res->encoders || !res->connectors)
 		goto error;
 
-#define get_resource(_res, __res, type, Type)                                   \
-	do {                                                                    \
-		for (i = 0; i < (int)(_res)->__res->count_##type##s; ++i) {     \
-			(_res)->type##s[i].type =                               \
-				drmModeGet##Type(dev->fd, (_res)->__res->type##s[i]); \
-			if (!(_res)->type##s[i].type)                           \
-				fprintf(stderr, "could not get %s %i: %s\n",    \
-					#type, (_res)->__res->type##s[i],       \
-					strerror(errno));                       \
-		}                                                               \
-	} while (0)
-
-	get_resource(res, res, crtc, Crtc);
-	get_resource(res, res, encoder, Encoder);
-	get_resource(res, res, connector, Connector);
-	get_resource(res, res, fb, FB);
-
-	/* Set the name of all connectors based on the type name and the per-type ID. */
-	for (i = 0; i < res->res->count_connectors; i++) {
-		struct connector *connector = &res->connectors[i];
-		drmModeConnector *conn = connector->connector;
-		int num;
-
-		num = asprintf(&connector->name, "%s-%u",
-			       drm_lookup_connector_type_name(conn->
-							      connector_type),
-			       conn->connector_type_id);
-		if (num < 0)
-			goto error;
-	}
-
-#define get_properties(_res, __res, type, Type)                                 \
-	do {                                                                    \
-		for (i = 0; i < (int)(_res)->__res->count_##type##s; ++i) {     \
-			struct type *obj = &res->type##s[i];                    \
-			unsigned int j;                                         \
-			obj->props =                                            \
-				drmModeObjectGetProperties(dev->fd, obj->type->type##_id, \
-							   DRM_MODE_OBJECT_##Type); \
-			if (!obj->props) {                                      \
-				fprintf(stderr,                                 \
-					"could not get %s %i properties: %s\n", \
-					#type, obj->type->type##_id,            \
-					strerror(errno));                       \
-				continue;                                       \
-			}                                                       \
-			obj->props_info = calloc(obj->props->count_props,       \
-						 sizeof(*obj->props_info));     \
-			if (!obj->props_info)                                   \
-				continue;                                       \
-			for (j = 0; j < obj->props->count_props; ++j)           \
-				obj->props_info[j] =                            \
-					drmModeGetProperty(dev->fd, obj->props->props[j]); \
-		}                                                               \
-	} while (0)
-
-	get_properties(res, res, crtc, CRTC);
-	get_properties(res, res, connector, CONNECTOR);
-
-	for (i = 0; i < res->res->count_crtcs; ++i)
-		res->crtcs[i].mode = &res->crtcs[i].crtc->mode;
-
 	res->plane_res = drmModeGetPlaneResources(dev->fd);
 	if (!res->plane_res) {
 		fprintf(stderr, "drmModeGetPlaneResources failed: %s\n",
@@ -209,9 +153,6 @@ struct resources *drm_get_resources(struct device *dev)
 	if (!res->planes)
 		goto error;
 
-	get_resource(res, plane_res, plane, Plane);
-	get_properties(res, plane_res, plane, PLANE);
-
 	return res;
 
 error:
@@ -219,12 +160,207 @@ error:
 	return NULL;
 }
 
-void drm_set_property(struct device *dev, struct property_arg *p)
+#define get_object(_dev, __res, type, get, index)                               \
+	do {                                                                    \
+		struct resources *_res = (_dev)->resources;                     \
+		if (!_res->__res || index < 0 ||                                \
+		    index >= (int)_res->__res->count_##type##s)                 \
+			return NULL;                                            \
+		obj = &_res->type##s[index];                                    \
+		if (obj->type)                                                  \
+			return obj;                                             \
+		obj->type = get((_dev)->fd, _res->__res->type##s[index]);       \
+		if (!obj->type) {                                               \
+			fprintf(stderr, "could not get %s %i: %s\n",            \
+				#type, _res->__res->type##s[index],             \
+				strerror(errno));                               \
+			return NULL;                                            \
+		}                                                               \
+	} while (0)
+
+struct crtc *drm_crtc(struct device *dev, int index)
 {
-	drmModeObjectProperties *props = NULL;
-	drmModePropertyRes **props_info = NULL;
-	const char *obj_type;
-	int ret;
+	struct crtc *obj;
+
+	get_object(dev, res, crtc, drmModeGetCrtc, index);
+	obj->mode = &obj->crtc->mode;
+
+	return obj;
+}
+
+struct encoder *drm_encoder(struct device *dev, int index)
+{
+	struct encoder *obj;
+
+	get_object(dev, res, encoder, drmModeGetEncoder, index);
+
+	return obj;
+}
+
+/* the current state, the connector is probed only when it has no modes */
+static drmModeConnector *drm_get_connector(int fd, uint32_t id)
+{
+	drmModeConnector *connector;
+
+	connector = drmModeGetConnectorCurrent(fd, id);
+	if (connector && connector->count_modes)
+		return connector;
+
+	drmModeFreeConnector(connector);
+
+	return drmModeGetConnector(fd, id);
+}
+
+struct connector *drm_connector(struct device *dev, int index)
+{
+	struct connector *obj;
+	drmModeConnector *conn;
+
+	get_object(dev, res, connector, drm_get_connector, index);
+
+	/* the name is based on the type name and the per-type ID */
+	conn = obj->connector;
+	if (asprintf(&obj->name, "%s-%u",
+		     drm_lookup_connector_type_name(conn->connector_type),
+		     conn->connector_type_id) < 0)
+		obj->name = NULL;
+
+	return obj;
+}
+
+struct plane *drm_plane(struct device *dev, int index)
+{
+	struct plane *obj;
+
+	get_object(dev, plane_res, plane, drmModeGetPlane, index);
+
+	return obj;
+}
+
+static unsigned int drm_hash_name(const char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static unsigned int drm_hash_id(uint32_t id)
+{
+	return id * 2654435761u;
+}
+
+static int drm_cache_grow(struct props_cache *c)
+{
+	drmModePropertyRes **slots;
+	unsigned int size = c->size ? c->size * 2 : 64;
+	unsigned int i, j;
+
+	slots = calloc(size, sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+
+	for (i = 0; i < c->size; i++) {
+		if (!c->slots[i])
+			continue;
+		j = drm_hash_id(c->slots[i]->prop_id) & (size - 1);
+		while (slots[j])
+			j = (j + 1) & (size - 1);
+		slots[j] = c->slots[i];
+	}
+
+	free(c->slots);
+	c->slots = slots;
+	c->size = size;
+
+	return 0;
+}
+
+/* objects of a type share their properties, get each of them once */
+static drmModePropertyRes *drm_cache_property(struct device *dev, uint32_t id)
+{
+	struct props_cache *c = &dev->resources->cache;
+	drmModePropertyRes *info;
+	unsigned int i;
+
+	if (c->count * 2 >= c->size && drm_cache_grow(c))
+		return NULL;
+
+	for (i = drm_hash_id(id) & (c->size - 1); c->slots[i];
+	     i = (i + 1) & (c->size - 1))
+		if (c->slots[i]->prop_id == id)
+			return c->slots[i];
+
+	info = drmModeGetProperty(dev->fd, id);
+	if (!info)
+		return NULL;
+
+	c->slots[i] = info;
+	c->count++;
+
+	return info;
+}
+
+static int drm_load_properties(struct device *dev, uint32_t obj_id,
+			       uint32_t obj_type, const char *type_name,
+			       struct object_props *p)
+{
+	drmModePropertyRes *info;
+	unsigned int count, size, slot, i;
+
+	if (p->props)
+		return 0;
+
+	p->props = drmModeObjectGetProperties(dev->fd, obj_id, obj_type);
+	if (!p->props) {
+		fprintf(stderr, "could not get %s %i properties: %s\n",
+			type_name, obj_id, strerror(errno));
+		return -errno;
+	}
+
+	count = p->props->count_props;
+	for (size = 8; size < count * 2; size <<= 1)
+		;
+
+	p->props_info = calloc(count + 1, sizeof(*p->props_info));
+	p->index = malloc(size * sizeof(*p->index));
+	if (!p->props_info || !p->index) {
+		drmModeFreeObjectProperties(p->props);
+		free(p->props_info);
+		free(p->index);
+		memset(p, 0, sizeof(*p));
+		return -ENOMEM;
+	}
+
+	p->mask = size - 1;
+	for (i = 0; i < size; i++)
+		p->index[i] = -1;
+
+	for (i = 0; i < count; i++) {
+		info = drm_cache_property(dev, p->props->props[i]);
+		p->props_info[i] = info;
+		if (!info)
+			continue;
+
+		slot = drm_hash_name(info->name) & p->mask;
+		while (p->index[slot] >= 0)
+			slot = (slot + 1) & p->mask;
+		p->index[slot] = i;
+	}
+
+	return 0;
+}
+
+static struct object_props *drm_find_object(struct device *dev,
+					    struct property_arg *p,
+					    const char **obj_type)
+{
+	struct resources *res = dev->resources;
+	struct object_props *props = NULL;
 	int i;
 
 	p->obj_type = 0;
@@ -233,21 +369,51 @@ void drm_set_property(struct device *dev, struct property_arg *p)
 #define find_object(_res, __res, type, Type)                                    \
 	do {                                                                    \
 		for (i = 0; i < (int)(_res)->__res->count_##type##s; ++i) {     \
-			struct type *obj = &(_res)->type##s[i];                 \
-			if (obj->type->type##_id != p->obj_id)                  \
+			if ((_res)->__res->type##s[i] != p->obj_id)             \
 				continue;                                       \
 			p->obj_type = DRM_MODE_OBJECT_##Type;                   \
-			obj_type = #Type;                                       \
-			props = obj->props;                                     \
-			props_info = obj->props_info;                           \
+			*obj_type = #Type;                                      \
+			props = &(_res)->type##s[i].props;                      \
+			break;                                                  \
 		}                                                               \
 	} while(0)                                                              \
 
-	find_object(dev->resources, res, crtc, CRTC);
+	find_object(res, res, crtc, CRTC);
 	if (p->obj_type == 0)
-		find_object(dev->resources, res, connector, CONNECTOR);
-	if (p->obj_type == 0)
-		find_object(dev->resources, plane_res, plane, PLANE);
+		find_object(res, res, connector, CONNECTOR);
+	if (p->obj_type == 0 && res->plane_res)
+		find_object(res, plane_res, plane, PLANE);
+
+	if (!props || drm_load_properties(dev, p->obj_id, p->obj_type,
+					  *obj_type, props))
+		return NULL;
+
+	return props;
+}
+
+static int drm_find_property(struct object_props *p, const char *name)
+{
+	unsigned int slot;
+	int i;
+
+	for (slot = drm_hash_name(name) & p->mask; p->index[slot] >= 0;
+	     slot = (slot + 1) & p->mask) {
+		i = p->index[slot];
+		if (strcmp(p->props_info[i]->name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+void drm_set_property(struct device *dev, struct property_arg *p)
+{
+	struct object_props *props;
+	const char *obj_type = NULL;
+	int ret;
+	int i;
+
+	props = drm_find_object(dev, p, &obj_type);
 	if (p->obj_type == 0) {
 		fprintf(stderr, "Object %i not found, can't set property\n",
 			p->obj_id);
@@ -260,20 +426,14 @@ void drm_set_property(struct device *dev, struct property_arg *p)
 		return;
 	}
 
-	for (i = 0; i < (int)props->count_props; ++i) {
-		if (!props_info[i])
-			continue;
-		if (strcmp(props_info[i]->name, p->name) == 0)
-			break;
-	}
-
-	if (i == (int)props->count_props) {
+	i = drm_find_property(props, p->name);
+	if (i < 0) {
 		fprintf(stderr, "%s %i has no %s property\n",
 			obj_type, p->obj_id, p->name);
 		return;
 	}
 
-	p->prop_id = props->props[i];
+	p->prop_id = props->props->props[i];
 
 	if (!dev->use_atomic)
 		ret = drmModeObjectSetProperty(dev->fd, p->obj_id, p->obj_type,
@@ -289,6 +449,44 @@ void drm_set_property(struct device *dev, struct property_arg *p)
 			strerror(errno));
 }
 
+/* the value is the one when the object properties were first fetched */
+int drm_get_property(struct device *dev, struct property_arg *p)
+{
+	struct object_props *props;
+	const char *obj_type = NULL;
+	int i;
+
+	props = drm_find_object(dev, p, &obj_type);
+	if (!props)
+		return -ENOENT;
+
+	i = drm_find_property(props, p->name);
+	if (i < 0)
+		return -ENOENT;
+
+	p->prop_id = props->props->props[i];
+	p->value = props->props->prop_values[i];
+
+	return 0;
+}
+
+int drm_atomic_add_property(struct device *dev, uint32_t obj_id,
+			    const char *name, uint64_t value)
+{
+	struct property_arg p;
+	int ret;
+
+	memset(&p, 0, sizeof(p));
+	p.obj_id = obj_id;
+	strncpy(p.name, name, DRM_PROP_NAME_LEN);
+
+	ret = drm_get_property(dev, &p);
+	if (ret)
+		return ret;
+
+	return drmModeAtomicAddProperty(dev->req, obj_id, p.prop_id, value);
+}
+
 int drm_format_support(const drmModePlanePtr ovr, uint32_t fmt)
 {
 	unsigned int i;
@@ -371,13 +569,14 @@ const char *drm_lookup_connector_type_name(unsigned int type)
 
 drmModeEncoder *drm_encoder_get_by_id(struct device *dev, uint32_t id)
 {
-	drmModeEncoder *encoder;
+	struct encoder *encoder;
 	int i;
 
 	for (i = 0; i < dev->resources->res->count_encoders; i++) {
-		encoder = dev->resources->encoders[i].encoder;
-		if (encoder && (encoder->encoder_id == id))
-			return encoder;
+		if (dev->resources->res->encoders[i] != id)
+			continue;
+		encoder = drm_encoder(dev, i);
+		return encoder ? encoder->encoder : NULL;
 	}
 
 	return NULL;
@@ -385,13 +584,14 @@ drmModeEncoder *drm_encoder_get_by_id(struct device *dev, uint32_t id)
 
 drmModeConnector *drm_connector_get_by_id(struct device *dev, uint32_t id)
 {
-	drmModeConnector *connector;
+	struct connector *connector;
 	int i;
 
 	for (i = 0; i < dev->resources->res->count_connectors; i++) {
-		connector = dev->resources->connectors[i].connector;
-		if (connector && (connector->connector_id == id))
-			return connector;
+		if (dev->resources->res->connectors[i] != id)
+			continue;
+		connector = drm_connector(dev, i);
+		return connector ? connector->connector : NULL;
 	}
 
 	return NULL;
@@ -29,10 +29,20 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-struct crtc {
-	drmModeCrtc *crtc;
+/*
+ * Objects and their properties are fetched on first use, the property
+ * names of an object are indexed by a hash.
+ */
+struct object_props {
 	drmModeObjectProperties *props;
 	drmModePropertyRes **props_info;
+	short *index;		/* name hash -> props slot, -1 is empty */
+	unsigned int mask;
+};
+
+struct crtc {
+	drmModeCrtc *crtc;
+	struct object_props props;
 	drmModeModeInfo *mode;
 };
 
@@ -42,19 +52,19 @@ struct encoder {
 
 struct connector {
 	drmModeConnector *connector;
-	drmModeObjectProperties *props;
-	drmModePropertyRes **props_info;
+	struct object_props props;
 	char *name;
 };
 
-struct fb {
-	drmModeFB *fb;
-};
-
 struct plane {
 	drmModePlane *plane;
-	drmModeObjectProperties *props;
-	drmModePropertyRes **props_info;
+	struct object_props props;
+};
+
+/* property infos shared by all the objects, hashed by id */
+struct props_cache {
+	drmModePropertyRes **slots;
+	unsigned int size, count;
 };
 
 struct resources {
@@ -64,8 +74,8 @@ struct resources {
 	struct crtc *crtcs;
 	struct encoder *encoders;
 	struct connector *connectors;
-	struct fb *fbs;
 	struct plane *planes;
+	struct props_cache cache;
 };
 
 struct device {
@@ -103,7 +113,14 @@ drmModeModeInfo *drm_connector_find_mode(struct device *dev, uint32_t con_id, in
 
 void drm_free_resources(struct resources *res);
 struct resources *drm_get_resources(struct device *dev);
+struct crtc *drm_crtc(struct device *dev, int index);
+struct encoder *drm_encoder(struct device *dev, int index);
+struct connector *drm_connector(struct device *dev, int index);
+struct plane *drm_plane(struct device *dev, int index);
 int drm_format_support(const drmModePlanePtr ovr, uint32_t fmt);
 void drm_set_property(struct device *dev, struct property_arg *p);
+int drm_get_property(struct device *dev, struct property_arg *p);
+int drm_atomic_add_property(struct device *dev, uint32_t obj_id,
+			    const char *name, uint64_t value);
 
 #endif /* UTIL_KMS_H */
@@ -1,10 +1,16 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
+#include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 #include "mlc.h"
 #include "io.h"
 
+/* bounds the re-reads of a snapshot while the driver updates the layers */
+#define MLC_SNAPSHOT_RETRIES	4
+
 struct mlc_base {
 	const void *phys;
 	void *virt;
@@ -15,14 +21,242 @@ static struct mlc_base __mlc[NUMBER_OF_MLC_MODULE] = {
 	[1] = { (const void *)PHY_BASEADDR_MLC1, NULL },
 };
 
-void hw_reg_dump(int module, struct mlc_reg *mlc)
+struct format_name {
+	unsigned int format;
+	const char *name;
+};
+
+static const struct format_name mlc_format_name[] = {
+	/* rgb */
+	{ mlc_rgbfmt_r5g6b5, "R5G6B5" },
+	{ mlc_rgbfmt_b5g6r5, "B5G6R5" },
+	{ mlc_rgbfmt_x1r5g5b5, "X1R5G5B5" },
+	{ mlc_rgbfmt_x1b5g5r5, "X1B5G5R5" },
+	{ mlc_rgbfmt_x4r4g4b4, "X4R4G4B4" },
+	{ mlc_rgbfmt_x4b4g4r4, "X4B4G4R4" },
+	{ mlc_rgbfmt_x8r3g3b2, "X8R3G3B2" },
+	{ mlc_rgbfmt_x8b3g3r2, "X8B3G3R2" },
+	{ mlc_rgbfmt_a1r5g5b5, "A1R5G5B5" },
+	{ mlc_rgbfmt_a1b5g5r5, "A1B5G5R5" },
+	{ mlc_rgbfmt_a4r4g4b4, "A4R4G4B4" },
+	{ mlc_rgbfmt_a4b4g4r4, "A4B4G4R4" },
+	{ mlc_rgbfmt_a8r3g3b2, "A8R3G3B2" },
+	{ mlc_rgbfmt_a8b3g3r2, "A8B3G3R2" },
+	{ mlc_rgbfmt_r8g8b8, "R8G8B8"   },
+	{ mlc_rgbfmt_b8g8r8, "B8G8R8"   },
+	{ mlc_rgbfmt_x8r8g8b8, "X8R8G8B8" },
+	{ mlc_rgbfmt_x8b8g8r8, "X8B8G8R8" },
+	{ mlc_rgbfmt_a8r8g8b8, "A8R8G8B8" },
+	{ mlc_rgbfmt_a8b8g8r8, "A8B8G8R8" },
+	/* video */
+	{ mlc_yuvfmt_420, "YUV420"   },
+	{ mlc_yuvfmt_422, "YUV422"   },
+	{ mlc_yuvfmt_444, "YUV444"   },
+	{ mlc_yuvfmt_yuyv, "YUYV"     },
+};
+
+/* the registers in words, without the reserved holes */
+static const struct {
+	unsigned short start, end;
+} mlc_ranges[] = {
+	{ MLC_REG(mlccontrolt), MLC_REG(rgb[0].__reserved0) },
+	{ MLC_REG(rgb[1]), MLC_REG(rgb[1].__reserved0) },
+	/* the dimming ram data ports are left, a read may move them */
+	{ MLC_REG(yuv), MLC_REG(dimram0rddata) },
+	{ MLC_REG(mlcclkenb), MLC_REG(mlcclkenb) + 1 },
+};
+
+#define MLC_RGB_LAYOUT(_l)						\
+	MLC_REG(_l.mlcleftright), MLC_REG(_l.mlctopbottom),		\
+	MLC_REG(_l.mlccontrol), MLC_REG(_l.mlchstride),			\
+	MLC_REG(_l.mlcvstride), MLC_REG(_l.mlcaddress)
+
+/* what a frame is scanned out with, a snapshot must have it consistent */
+static const unsigned short mlc_layout[] = {
+	MLC_REG(mlccontrolt), MLC_REG(mlcscreensize),
+	MLC_RGB_LAYOUT(rgb[0]),
+	MLC_RGB_LAYOUT(rgb[1]),
+	MLC_RGB_LAYOUT(rgb2),
+	MLC_REG(yuv.mlcleftright), MLC_REG(yuv.mlctopbottom),
+	MLC_REG(yuv.mlccontrol), MLC_REG(yuv.mlcvstride),
+	MLC_REG(yuv.mlcaddress), MLC_REG(yuv.mlcaddresscb),
+	MLC_REG(yuv.mlcaddresscr), MLC_REG(yuv.mlcvstridecb),
+	MLC_REG(yuv.mlcvstridecr), MLC_REG(yuv.mlchscale),
+	MLC_REG(yuv.mlcvscale),
+};
+
+/*
+ * Reads the registers word by word, then the layout ones again until two
+ * reads in a row agree. Returns -EAGAIN if they still change after the
+ * retries, the snapshot has the last values then.
+ */
+int hw_reg_snapshot(int module, struct mlc_reg *mlc,
+		    struct mlc_snapshot *stat)
 {
-	struct mlc_reg *reg;
+	const volatile uint32_t *reg;
+	uint32_t *dst = (void *)mlc;
+	struct timespec t0, t1;
+	unsigned int reads = 0, i, n;
+	int retries = 0;
+	bool stable = false;
 
 	assert(__mlc[module].virt);
-	reg = (struct mlc_reg *)__mlc[module].virt;
+	reg = __mlc[module].virt;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	memset(mlc, 0, sizeof(*mlc));
+
+	for (i = 0; i < ARRAY_SIZE(mlc_ranges); i++) {
+		for (n = mlc_ranges[i].start; n < mlc_ranges[i].end; n++)
+			dst[n] = reg[n];
+		reads += mlc_ranges[i].end - mlc_ranges[i].start;
+	}
+
+	while (!stable && retries < MLC_SNAPSHOT_RETRIES) {
+		stable = true;
+		for (i = 0; i < ARRAY_SIZE(mlc_layout); i++) {
+			uint32_t v = reg[mlc_layout[i]];
+
+			if (v != dst[mlc_layout[i]]) {
+				dst[mlc_layout[i]] = v;
+				stable = false;
+			}
+		}
+		reads += ARRAY_SIZE(mlc_layout);
+		retries++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (stat) {
+		stat->ns = (t1.tv_sec - t0.tv_sec) * 1000000000ll +
+			   t1.tv_nsec - t0.tv_nsec;
+		stat->reads = reads;
+		stat->retries = retries - 1;
+	}
+
+	return stable ? 0 : -EAGAIN;
+}
+
+static int hw_reg_entry(struct mlc_writes *w, unsigned int word)
+{
+	unsigned int i;
+
+	for (i = 0; i < w->count; i++)
+		if (w->w[i].word == word)
+			return i;
+
+	if (w->count == MLC_WRITES_MAX) {
+		w->error = -ENOSPC;
+		return -1;
+	}
+
+	memset(&w->w[w->count], 0, sizeof(w->w[0]));
+	w->w[w->count].word = word;
+
+	return w->count++;
+}
+
+/* queues bits [pos, pos + width) of a register, later ones win */
+void hw_reg_write(struct mlc_writes *w, unsigned int word,
+		  uint32_t value, int pos, int width)
+{
+	uint32_t mask = width >= 32 ? ~0u : ((1u << width) - 1) << pos;
+	int i = hw_reg_entry(w, word);
+
+	w->queued++;
+	if (i < 0)
+		return;
+
+	w->w[i].mask |= mask;
+	w->w[i].value = (w->w[i].value & ~mask) | ((value << pos) & mask);
+}
 
-	memcpy(mlc, reg, sizeof(struct mlc_reg));
+void hw_reg_dirty(struct mlc_writes *w, unsigned int word, int bit)
+{
+	int i = hw_reg_entry(w, word);
+
+	w->queued++;
+	if (i >= 0)
+		w->w[i].dirty |= 1u << bit;
+}
+
+/*
+ * Stores the queued writes, the registers without a dirty bit first, and
+ * empties the list. Only the bits of a partial write are read back.
+ * -ENODEV when the module is not mapped.
+ */
+int hw_reg_apply(int module, struct mlc_writes *w, struct mlc_burst *stat)
+{
+	volatile uint32_t *reg;
+	struct timespec t0, t1;
+	unsigned int i, writes = 0;
+	int pass, ret = w->error;
+
+	reg = __mlc[module].virt;
+	if (!ret && !reg) {
+		fprintf(stderr, "mlc.%d is not mapped\n", module);
+		ret = -ENODEV;
+	}
+
+	if (ret)
+		goto __exit_apply;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < w->count; i++) {
+			uint32_t v = w->w[i].value;
+
+			if (!w->w[i].dirty != !pass)
+				continue;
+
+			if (w->w[i].mask != ~0u)
+				v |= reg[w->w[i].word] & ~w->w[i].mask;
+			reg[w->w[i].word] = v | w->w[i].dirty;
+			writes++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (stat) {
+		stat->ns = (t1.tv_sec - t0.tv_sec) * 1000000000ll +
+			   t1.tv_nsec - t0.tv_nsec;
+		stat->writes = writes;
+	}
+
+__exit_apply:
+	w->count = 0;
+	w->queued = 0;
+	w->error = 0;
+
+	return ret;
+}
+
+const char *hw_format_name(unsigned int format, int bpp)
+{
+	int i;
+
+	if (bpp == 32) {
+		if (format == mlc_rgbfmt_r8g8b8)
+			format = mlc_rgbfmt_x8r8g8b8;
+
+		if (format == mlc_rgbfmt_r8g8b8)
+			format = mlc_rgbfmt_x8r8g8b8;
+	}
+
+	for (i = 0; i < (int)ARRAY_SIZE(mlc_format_name); i++)
+		if (format == mlc_format_name[i].format)
+			return mlc_format_name[i].name;
+
+	return NULL;
+}
+
+void hw_reg_dump(int module, struct mlc_reg *mlc)
+{
+	hw_reg_snapshot(module, mlc, NULL);
 }
 
 int hw_reg_get_module_num(void)
@@ -51,6 +285,14 @@ const void *hw_reg_get_base(int module)
 	return __mlc[module].phys;
 }
 
+void *hw_reg_get_mem(int module)
+{
+	if (module >= NUMBER_OF_MLC_MODULE)
+		return NULL;
+
+	return __mlc[module].virt;
+}
+
 int hw_reg_set_base(int module, void *base)
 {
 	if (module >= NUMBER_OF_MLC_MODULE)
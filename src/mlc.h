@@ -2,12 +2,17 @@
 #define __MLC_REG_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define NUMBER_OF_MLC_MODULE            2
 #define NUMBER_OF_MLC_LAYER		3
 #define PHY_BASEADDR_MLC0               0xC0102000
 #define PHY_BASEADDR_MLC1               0xC0102400
 #define MLC_YUV_SCALE_CONSTANT          2048
+#define MLC_WRITES_MAX			32
+
+/* word index of a register */
+#define MLC_REG(_f)			(offsetof(struct mlc_reg, _f) / 4)
 
 struct mlc_reg {
 	uint32_t mlccontrolt;
@@ -130,13 +135,49 @@ enum mlc_layer {
 	mlc_layer_unknown,
 };
 
+struct mlc_snapshot {
+	long long ns;		/* time taken */
+	unsigned int reads;	/* register reads */
+	int retries;		/* re-reads of a changing layout */
+};
+
+/*
+ * Register writes collected to be applied in one burst, one store per
+ * register. The dirty bits are stored last, after all the others.
+ */
+struct mlc_writes {
+	unsigned int count;
+	unsigned int queued;	/* writes before coalescing */
+	int error;
+	struct {
+		unsigned short word;
+		uint32_t mask;
+		uint32_t value;
+		uint32_t dirty;
+	} w[MLC_WRITES_MAX];
+};
+
+struct mlc_burst {
+	long long ns;		/* time taken */
+	unsigned int writes;	/* register stores */
+};
+
 int hw_reg_set_base(int module, void *base);
 const void *hw_reg_get_base(int module);
+void *hw_reg_get_mem(int module);
 unsigned int hw_reg_get_length(int module);
 int hw_reg_get_module_num(void);
 int hw_reg_get_layer_num(int module);
 
+const char *hw_format_name(unsigned int format, int bpp);
 void hw_reg_dump(int dev, struct mlc_reg *mlc);
+int hw_reg_snapshot(int module, struct mlc_reg *mlc,
+		    struct mlc_snapshot *stat);
+
+void hw_reg_write(struct mlc_writes *w, unsigned int word,
+		  uint32_t value, int pos, int width);
+void hw_reg_dirty(struct mlc_writes *w, unsigned int word, int bit);
+int hw_reg_apply(int module, struct mlc_writes *w, struct mlc_burst *stat);
 
 
 #endif
@@ -0,0 +1,326 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+#ifndef PERF_FLAG_FD_CLOEXEC
+#define PERF_FLAG_FD_CLOEXEC	(1UL << 3)
+#endif
+
+enum perf_source {
+	perf_source_none,
+	perf_source_pmu,
+	perf_source_kernel,	/* kernel software counter */
+	perf_source_os,		/* thread cpu clock and rusage */
+};
+
+static const char * const perf_source_name[] = {
+	[perf_source_none] = "none",
+	[perf_source_pmu] = "pmu",
+	[perf_source_kernel] = "kernel",
+	[perf_source_os] = "rusage",
+};
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} perf_events[perf_counter_max] = {
+	[perf_cycles] = {
+		"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[perf_instructions] = {
+		"instructions", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_INSTRUCTIONS },
+	[perf_cache_refs] = {
+		"cache-refs", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_CACHE_REFERENCES },
+	[perf_cache_misses] = {
+		"cache-misses", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_CACHE_MISSES },
+	[perf_bus_cycles] = {
+		"bus-cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BUS_CYCLES },
+	[perf_task_clock] = {
+		"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	[perf_page_faults] = {
+		"page-faults", PERF_TYPE_SOFTWARE,
+		PERF_COUNT_SW_PAGE_FAULTS },
+	[perf_context_switches] = {
+		"context-switches", PERF_TYPE_SOFTWARE,
+		PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+struct perf_thread {
+	int fd[perf_counter_max];
+	uint64_t start[perf_counter_max];
+	int stage;
+	struct perf_thread *next;
+};
+
+struct perf_stage {
+	const char *name;
+	unsigned int runs;
+	uint64_t sum[perf_counter_max];
+	uint64_t max[perf_counter_max];
+};
+
+struct perf {
+	unsigned int id;
+	enum perf_source source[perf_counter_max];
+	struct perf_stage stages[PERF_MAX_STAGES];
+	int count;
+	struct perf_thread *threads;
+	pthread_mutex_t lock;
+};
+
+/* the counters of this thread, for the perf of 'perf_self_id' */
+static __thread struct perf_thread *perf_self;
+static __thread unsigned int perf_self_id;
+static unsigned int perf_ids;
+
+static int perf_open(enum perf_counter counter)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_events[counter].type;
+	attr.config = perf_events[counter].config;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	/* the copy loops are user space, and so is what a user may count */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+		       PERF_FLAG_FD_CLOEXEC);
+}
+
+struct perf *perf_create(const char * const *stages, int count)
+{
+	struct perf *p;
+	int i, fd, err = 0;
+
+	if (count > PERF_MAX_STAGES)
+		return NULL;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	p->id = ++perf_ids;
+	p->count = count;
+	for (i = 0; i < count; i++)
+		p->stages[i].name = stages[i];
+	pthread_mutex_init(&p->lock, NULL);
+
+	for (i = 0; i < perf_counter_max; i++) {
+		fd = perf_open(i);
+		if (fd >= 0) {
+			p->source[i] = perf_events[i].type == PERF_TYPE_HARDWARE ?
+				       perf_source_pmu : perf_source_kernel;
+			close(fd);
+		} else if (perf_events[i].type == PERF_TYPE_SOFTWARE) {
+			p->source[i] = perf_source_os;
+		} else if (!err) {
+			err = errno;
+		}
+	}
+
+	if (p->source[perf_cycles] != perf_source_pmu)
+		fprintf(stderr, "no pmu counters (%s), software counters only\n",
+			strerror(err));
+
+	return p;
+}
+
+void perf_destroy(struct perf *p)
+{
+	struct perf_thread *t, *next;
+	int i;
+
+	if (!p)
+		return;
+
+	for (t = p->threads; t; t = next) {
+		next = t->next;
+		for (i = 0; i < perf_counter_max; i++)
+			if (t->fd[i] >= 0)
+				close(t->fd[i]);
+		free(t);
+	}
+
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+/* counters open on the first stage of a thread */
+static struct perf_thread *perf_thread(struct perf *p)
+{
+	struct perf_thread *t;
+	int i;
+
+	if (perf_self_id == p->id)
+		return perf_self;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	for (i = 0; i < perf_counter_max; i++) {
+		t->fd[i] = -1;
+		if (p->source[i] == perf_source_pmu ||
+		    p->source[i] == perf_source_kernel)
+			t->fd[i] = perf_open(i);
+	}
+	t->stage = -1;
+
+	pthread_mutex_lock(&p->lock);
+	t->next = p->threads;
+	p->threads = t;
+	pthread_mutex_unlock(&p->lock);
+
+	perf_self = t;
+	perf_self_id = p->id;
+
+	return t;
+}
+
+static void perf_read(struct perf *p, struct perf_thread *t,
+		      uint64_t value[perf_counter_max])
+{
+	struct rusage ru;
+	struct timespec ts;
+	uint64_t rf[3];
+	int i;
+
+	if (getrusage(RUSAGE_THREAD, &ru))
+		memset(&ru, 0, sizeof(ru));
+
+	for (i = 0; i < perf_counter_max; i++) {
+		value[i] = 0;
+
+		switch (p->source[i]) {
+		case perf_source_pmu:
+		case perf_source_kernel:
+			if (t->fd[i] < 0 ||
+			    read(t->fd[i], rf, sizeof(rf)) != sizeof(rf))
+				break;
+			/* scaled up for the time it was multiplexed out */
+			value[i] = rf[2] && rf[2] < rf[1] ?
+				   (uint64_t)((double)rf[0] * rf[1] / rf[2]) :
+				   rf[0];
+			break;
+		case perf_source_os:
+			if (i == perf_task_clock) {
+				clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+				value[i] = (uint64_t)ts.tv_sec * 1000000000ull +
+					   ts.tv_nsec;
+			} else if (i == perf_page_faults) {
+				value[i] = ru.ru_minflt + ru.ru_majflt;
+			} else if (i == perf_context_switches) {
+				value[i] = ru.ru_nvcsw + ru.ru_nivcsw;
+			}
+			break;
+		case perf_source_none:
+		default:
+			break;
+		}
+	}
+}
+
+void perf_begin(struct perf *p, int stage)
+{
+	struct perf_thread *t;
+
+	if (!p || stage < 0 || stage >= p->count)
+		return;
+
+	t = perf_thread(p);
+	if (!t)
+		return;
+
+	t->stage = stage;
+	perf_read(p, t, t->start);
+}
+
+void perf_end(struct perf *p, int stage)
+{
+	uint64_t value[perf_counter_max];
+	struct perf_stage *s;
+	struct perf_thread *t;
+	int i;
+
+	if (!p || perf_self_id != p->id)
+		return;
+
+	t = perf_self;
+	if (t->stage != stage)
+		return;
+
+	perf_read(p, t, value);
+	t->stage = -1;
+
+	s = &p->stages[stage];
+
+	pthread_mutex_lock(&p->lock);
+	for (i = 0; i < perf_counter_max; i++) {
+		uint64_t d = value[i] - t->start[i];
+
+		s->sum[i] += d;
+		if (d > s->max[i])
+			s->max[i] = d;
+	}
+	s->runs++;
+	pthread_mutex_unlock(&p->lock);
+}
+
+void perf_report(struct perf *p, FILE *fp)
+{
+	int i, n;
+
+	if (!p)
+		return;
+
+	fprintf(fp, "perf counters:");
+	for (i = 0; i < perf_counter_max; i++)
+		fprintf(fp, " %s(%s)", perf_events[i].name,
+			perf_source_name[p->source[i]]);
+	fprintf(fp, "\n");
+
+	pthread_mutex_lock(&p->lock);
+
+	for (n = 0; n < p->count; n++) {
+		struct perf_stage *s = &p->stages[n];
+
+		if (!s->runs)
+			continue;
+
+		fprintf(fp, " %-8s %u runs, a run:", s->name, s->runs);
+		for (i = 0; i < perf_counter_max; i++)
+			if (p->source[i] != perf_source_none)
+				fprintf(fp, " %s %llu (max %llu)",
+					perf_events[i].name,
+					(unsigned long long)(s->sum[i] / s->runs),
+					(unsigned long long)s->max[i]);
+		if (s->sum[perf_cycles])
+			fprintf(fp, ", ipc %.2f",
+				(double)s->sum[perf_instructions] /
+				s->sum[perf_cycles]);
+		if (s->sum[perf_cache_refs])
+			fprintf(fp, ", cache miss %.1f%%",
+				s->sum[perf_cache_misses] * 100.0 /
+				s->sum[perf_cache_refs]);
+		fprintf(fp, "\n");
+	}
+
+	pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,39 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Counters around the stages of a thread, summed per stage over the
+ * threads. The PMU counters are left out where the PMU is not there or
+ * not allowed, the kernel software counters stand in for them and the
+ * thread cpu clock and rusage for those.
+ */
+enum perf_counter {
+	perf_cycles,
+	perf_instructions,
+	perf_cache_refs,
+	perf_cache_misses,
+	perf_bus_cycles,
+	perf_task_clock,	/* nsec */
+	perf_page_faults,
+	perf_context_switches,
+	perf_counter_max,
+};
+
+#define PERF_MAX_STAGES		8
+
+struct perf;
+
+struct perf *perf_create(const char * const *stages, int count);
+void perf_destroy(struct perf *p);
+
+/* stages of a thread don't nest, a NULL 'p' counts nothing */
+void perf_begin(struct perf *p, int stage);
+void perf_end(struct perf *p, int stage);
+
+/* per stage, the counts of a run of it */
+void perf_report(struct perf *p, FILE *fp);
+
+#endif
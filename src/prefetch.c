@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "prefetch.h"
+
+struct prefetch_slot {
+	void *buffer;
+	int64_t index;
+};
+
+struct prefetch {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	prefetch_load_t load;
+	void *data;
+
+	/* free buffers */
+	void **free;
+	int nr_free;
+
+	/* loaded buffers in index order, bounded by the buffer count */
+	struct prefetch_slot *ready;
+	int head, nr_ready, size;
+
+	int64_t next, end;
+	unsigned int generation;
+	int error;
+	bool quit;
+};
+
+static void *prefetch_thread(void *arg)
+{
+	struct prefetch *pf = arg;
+	unsigned int generation;
+	int64_t index;
+	void *buffer;
+	int ret;
+
+	pthread_mutex_lock(&pf->lock);
+
+	while (!pf->quit) {
+		if (!pf->nr_free || pf->next >= pf->end || pf->error) {
+			pthread_cond_wait(&pf->cond, &pf->lock);
+			continue;
+		}
+
+		buffer = pf->free[--pf->nr_free];
+		index = pf->next++;
+		generation = pf->generation;
+
+		/* never hold the lock while on the storage */
+		pthread_mutex_unlock(&pf->lock);
+		ret = pf->load(buffer, index, pf->data);
+		pthread_mutex_lock(&pf->lock);
+
+		if (ret || generation != pf->generation) {
+			pf->free[pf->nr_free++] = buffer;
+			if (ret && generation == pf->generation) {
+				pf->error = ret;
+				pthread_cond_broadcast(&pf->cond);
+			}
+			continue;
+		}
+
+		pf->ready[(pf->head + pf->nr_ready) % pf->size].buffer = buffer;
+		pf->ready[(pf->head + pf->nr_ready) % pf->size].index = index;
+		pf->nr_ready++;
+		pthread_cond_broadcast(&pf->cond);
+	}
+
+	pthread_mutex_unlock(&pf->lock);
+
+	return NULL;
+}
+
+struct prefetch *prefetch_create(void **buffers, int count,
+				 int64_t start, int64_t end,
+				 prefetch_load_t load, void *data)
+{
+	struct prefetch *pf;
+
+	pf = calloc(1, sizeof(*pf));
+	if (!pf)
+		return NULL;
+
+	pf->free = calloc(count, sizeof(*pf->free));
+	pf->ready = calloc(count, sizeof(*pf->ready));
+	if (!pf->free || !pf->ready)
+		goto __exit_create;
+
+	memcpy(pf->free, buffers, count * sizeof(*buffers));
+	pf->nr_free = count;
+	pf->size = count;
+	pf->next = start;
+	pf->end = end;
+	pf->load = load;
+	pf->data = data;
+
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->cond, NULL);
+
+	if (pthread_create(&pf->thread, NULL, prefetch_thread, pf)) {
+		fprintf(stderr, "failed to create prefetch thread\n");
+		pthread_cond_destroy(&pf->cond);
+		pthread_mutex_destroy(&pf->lock);
+		goto __exit_create;
+	}
+
+	return pf;
+
+__exit_create:
+	free(pf->ready);
+	free(pf->free);
+	free(pf);
+
+	return NULL;
+}
+
+void prefetch_destroy(struct prefetch *pf)
+{
+	if (!pf)
+		return;
+
+	pthread_mutex_lock(&pf->lock);
+	pf->quit = true;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->lock);
+
+	pthread_join(pf->thread, NULL);
+
+	pthread_cond_destroy(&pf->cond);
+	pthread_mutex_destroy(&pf->lock);
+	free(pf->ready);
+	free(pf->free);
+	free(pf);
+}
+
+/*
+ * Returns the latest loaded buffer not after 'due', older ones are given
+ * back to the loader. NULL when the loader has nothing for 'due' yet.
+ */
+void *prefetch_get(struct prefetch *pf, int64_t due, int64_t *index)
+{
+	struct prefetch_slot *slot;
+	void *buffer = NULL;
+
+	pthread_mutex_lock(&pf->lock);
+
+	while (pf->nr_ready) {
+		slot = &pf->ready[pf->head];
+		if (slot->index > due)
+			break;
+
+		if (buffer)
+			pf->free[pf->nr_free++] = buffer;
+
+		buffer = slot->buffer;
+		*index = slot->index;
+		pf->head = (pf->head + 1) % pf->size;
+		pf->nr_ready--;
+	}
+
+	if (buffer)
+		pthread_cond_broadcast(&pf->cond);
+
+	pthread_mutex_unlock(&pf->lock);
+
+	return buffer;
+}
+
+/* blocks until the next buffer is loaded, only for start up */
+void *prefetch_wait(struct prefetch *pf, int64_t *index)
+{
+	void *buffer = NULL;
+
+	pthread_mutex_lock(&pf->lock);
+
+	while (!pf->nr_ready && !pf->error)
+		pthread_cond_wait(&pf->cond, &pf->lock);
+
+	if (pf->nr_ready) {
+		buffer = pf->ready[pf->head].buffer;
+		*index = pf->ready[pf->head].index;
+		pf->head = (pf->head + 1) % pf->size;
+		pf->nr_ready--;
+		pthread_cond_broadcast(&pf->cond);
+	}
+
+	pthread_mutex_unlock(&pf->lock);
+
+	return buffer;
+}
+
+void prefetch_put(struct prefetch *pf, void *buffer)
+{
+	pthread_mutex_lock(&pf->lock);
+	pf->free[pf->nr_free++] = buffer;
+	pthread_cond_broadcast(&pf->cond);
+	pthread_mutex_unlock(&pf->lock);
+}
+
+/* drop the loaded buffers and restart loading at 'index' */
+void prefetch_seek(struct prefetch *pf, int64_t index)
+{
+	pthread_mutex_lock(&pf->lock);
+
+	while (pf->nr_ready) {
+		pf->free[pf->nr_free++] = pf->ready[pf->head].buffer;
+		pf->head = (pf->head + 1) % pf->size;
+		pf->nr_ready--;
+	}
+
+	pf->next = index;
+	pf->generation++;
+	pf->error = 0;
+	pthread_cond_broadcast(&pf->cond);
+
+	pthread_mutex_unlock(&pf->lock);
+}
+
+int prefetch_error(struct prefetch *pf)
+{
+	int error;
+
+	pthread_mutex_lock(&pf->lock);
+	error = pf->error;
+	pthread_mutex_unlock(&pf->lock);
+
+	return error;
+}
@@ -0,0 +1,27 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <stdint.h>
+
+/*
+ * Background loader over a fixed set of buffers.
+ * The loader thread fills free buffers with the next indexes in order and
+ * queues them; the consumer takes a ready buffer without ever waiting for
+ * the storage and hands it back when done with it.
+ */
+struct prefetch;
+
+typedef int (*prefetch_load_t)(void *buffer, int64_t index, void *data);
+
+struct prefetch *prefetch_create(void **buffers, int count,
+				 int64_t start, int64_t end,
+				 prefetch_load_t load, void *data);
+void prefetch_destroy(struct prefetch *pf);
+
+void *prefetch_get(struct prefetch *pf, int64_t due, int64_t *index);
+void *prefetch_wait(struct prefetch *pf, int64_t *index);
+void prefetch_put(struct prefetch *pf, void *buffer);
+void prefetch_seek(struct prefetch *pf, int64_t index);
+int prefetch_error(struct prefetch *pf);
+
+#endif
@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "regtrace.h"
+#include "evloop.h"
+#include "mlc.h"
+#include "io.h"
+
+#define REGTRACE_BUF_SIZE	(64 * 1024)
+/* dt varint, index and value varint */
+#define REGTRACE_RECORD_MAX	(10 + 1 + 5)
+
+struct regtrace_reg {
+	const char *name;
+	unsigned short word;
+	bool layout;		/* traced for a whole module */
+};
+
+#define REGTRACE_RGB(_n, _l)						\
+	{ _n ".leftright", MLC_REG(_l.mlcleftright), true },		\
+	{ _n ".topbottom", MLC_REG(_l.mlctopbottom), true },		\
+	{ _n ".control", MLC_REG(_l.mlccontrol), true },		\
+	{ _n ".hstride", MLC_REG(_l.mlchstride), true },		\
+	{ _n ".vstride", MLC_REG(_l.mlcvstride), true },		\
+	{ _n ".tpcolor", MLC_REG(_l.mlctpcolor), false },		\
+	{ _n ".invcolor", MLC_REG(_l.mlcinvcolor), false },		\
+	{ _n ".address", MLC_REG(_l.mlcaddress), true }
+
+static const struct regtrace_reg regtrace_regs[] = {
+	{ "controlt", MLC_REG(mlccontrolt), true },
+	{ "screensize", MLC_REG(mlcscreensize), true },
+	{ "bgcolor", MLC_REG(mlcbgcolor), false },
+	REGTRACE_RGB("rgb0", rgb[0]),
+	REGTRACE_RGB("rgb1", rgb[1]),
+	REGTRACE_RGB("rgb2", rgb2),
+	{ "yuv.leftright", MLC_REG(yuv.mlcleftright), true },
+	{ "yuv.topbottom", MLC_REG(yuv.mlctopbottom), true },
+	{ "yuv.control", MLC_REG(yuv.mlccontrol), true },
+	{ "yuv.vstride", MLC_REG(yuv.mlcvstride), true },
+	{ "yuv.tpcolor", MLC_REG(yuv.mlctpcolor), false },
+	{ "yuv.invcolor", MLC_REG(yuv.mlcinvcolor), false },
+	{ "yuv.address", MLC_REG(yuv.mlcaddress), true },
+	{ "yuv.addresscb", MLC_REG(yuv.mlcaddresscb), true },
+	{ "yuv.addresscr", MLC_REG(yuv.mlcaddresscr), true },
+	{ "yuv.vstridecb", MLC_REG(yuv.mlcvstridecb), true },
+	{ "yuv.vstridecr", MLC_REG(yuv.mlcvstridecr), true },
+	{ "yuv.hscale", MLC_REG(yuv.mlchscale), true },
+	{ "yuv.vscale", MLC_REG(yuv.mlcvscale), true },
+	{ "yuv.luenh", MLC_REG(yuv.mlcluenh), false },
+	{ "gammacont", MLC_REG(mlcgammacont), false },
+	{ "dimctrl", MLC_REG(dimctrl), false },
+	{ "clkenb", MLC_REG(mlcclkenb), false },
+};
+
+struct regtrace {
+	unsigned int rate;
+	struct regtrace_file_header header;
+	struct regtrace_file_field fields[REGTRACE_MAX_FIELDS];
+	const volatile uint32_t *regs[REGTRACE_MAX_FIELDS];
+	uint32_t values[REGTRACE_MAX_FIELDS];
+	int count;
+
+	/* changes since the last flush to the log */
+	uint8_t *buf;
+	size_t len;
+	int fd;
+	int error;
+
+	uint64_t last;		/* usec of the last record */
+	unsigned int changes;
+	size_t written;
+	struct evloop *loop;
+};
+
+static uint64_t regtrace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct regtrace *regtrace_create(unsigned int rate)
+{
+	struct regtrace *t;
+
+	if (!rate || rate > REGTRACE_MAX_RATE)
+		return NULL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->buf = malloc(REGTRACE_BUF_SIZE);
+	if (!t->buf) {
+		free(t);
+		return NULL;
+	}
+
+	t->rate = rate;
+	t->fd = -1;
+
+	return t;
+}
+
+void regtrace_destroy(struct regtrace *t)
+{
+	if (!t)
+		return;
+
+	free(t->buf);
+	free(t);
+}
+
+static int regtrace_add_reg(struct regtrace *t, int module,
+			    const struct regtrace_reg *reg)
+{
+	struct regtrace_file_field *f = &t->fields[t->count];
+	const volatile uint32_t *mem = hw_reg_get_mem(module);
+
+	if (t->count == REGTRACE_MAX_FIELDS) {
+		fprintf(stderr, "over %d registers to trace\n",
+			REGTRACE_MAX_FIELDS);
+		return -ENOSPC;
+	}
+
+	snprintf(f->name, sizeof(f->name), "mlc%d.%s", module, reg->name);
+	f->module = module;
+	f->word = reg->word;
+	t->regs[t->count++] = mem + reg->word;
+
+	return 0;
+}
+
+int regtrace_add(struct regtrace *t, const char *name)
+{
+	unsigned int i;
+	char *end;
+	int module, ret;
+
+	if (strncmp(name, "mlc", 3))
+		goto __exit_name;
+
+	module = strtoul(name + 3, &end, 10);
+	if (end == name + 3 || module >= hw_reg_get_module_num() ||
+	    !hw_reg_get_mem(module))
+		goto __exit_name;
+
+	if (*end == '\0') {
+		for (i = 0; i < ARRAY_SIZE(regtrace_regs); i++) {
+			if (!regtrace_regs[i].layout)
+				continue;
+
+			ret = regtrace_add_reg(t, module, &regtrace_regs[i]);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	if (*end++ != '.')
+		goto __exit_name;
+
+	for (i = 0; i < ARRAY_SIZE(regtrace_regs); i++)
+		if (!strcmp(end, regtrace_regs[i].name))
+			return regtrace_add_reg(t, module, &regtrace_regs[i]);
+
+__exit_name:
+	fprintf(stderr, "unknown register %s\n", name);
+	return -EINVAL;
+}
+
+static int regtrace_write(int fd, const void *buf, size_t size)
+{
+	while (size) {
+		ssize_t ret = write(fd, buf, size);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			fprintf(stderr, "failed to write trace: %s\n",
+				strerror(errno));
+			return -errno;
+		}
+
+		buf += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+static int regtrace_flush(struct regtrace *t)
+{
+	int ret;
+
+	ret = regtrace_write(t->fd, t->buf, t->len);
+	t->written += t->len;
+	t->len = 0;
+
+	return ret;
+}
+
+static size_t regtrace_varint(uint8_t *p, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+
+	return n;
+}
+
+/* only the sampling loop is on the registers, a log write is rare */
+static void regtrace_sample(int fd, uint32_t expirations, void *data)
+{
+	struct regtrace *t = data;
+	uint64_t now = regtrace_now();
+	int i;
+
+	t->header.samples++;
+	t->header.overruns += expirations - 1;
+
+	for (i = 0; i < t->count; i++) {
+		uint32_t v = *t->regs[i];
+
+		if (v == t->values[i])
+			continue;
+
+		t->len += regtrace_varint(t->buf + t->len, now - t->last);
+		t->buf[t->len++] = i;
+		t->len += regtrace_varint(t->buf + t->len, v ^ t->values[i]);
+		t->values[i] = v;
+		t->last = now;
+		t->changes++;
+	}
+
+	if (t->len + t->count * REGTRACE_RECORD_MAX > REGTRACE_BUF_SIZE) {
+		t->error = regtrace_flush(t);
+		if (t->error)
+			evloop_quit(t->loop);
+	}
+}
+
+static void regtrace_stop(int fd, uint32_t events, void *data)
+{
+	struct regtrace *t = data;
+
+	evloop_quit(t->loop);
+}
+
+int regtrace_run(struct regtrace *t, const char *file, unsigned int msec)
+{
+	const struct regtrace_file_header header = {
+		.magic = REGTRACE_MAGIC,
+		.version = REGTRACE_VERSION,
+	};
+	const int signals[] = { SIGINT, SIGTERM };
+	struct timespec ts;
+	int i, ret;
+
+	if (!t->count)
+		return -EINVAL;
+
+	t->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (t->fd < 0) {
+		fprintf(stderr, "Error file %s\n", file);
+		perror("- error");
+		return -errno;
+	}
+
+	t->loop = evloop_create();
+	if (!t->loop) {
+		ret = -ENOMEM;
+		goto __exit_file;
+	}
+
+	ret = evloop_add_signal(t->loop, signals, ARRAY_SIZE(signals),
+				regtrace_stop, t);
+	if (ret >= 0 && msec)
+		ret = evloop_add_timer(t->loop, msec, 0, regtrace_stop, t);
+	if (ret >= 0)
+		ret = evloop_add_timer_ns(t->loop, 1000000000ull / t->rate, 1,
+					  regtrace_sample, t);
+	if (ret < 0)
+		goto __exit_loop;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	t->header = header;
+	t->header.fields = t->count;
+	t->header.rate = t->rate;
+	t->header.start_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	for (i = 0; i < t->count; i++)
+		t->values[i] = t->fields[i].value = *t->regs[i];
+	t->last = regtrace_now();
+
+	ret = regtrace_write(t->fd, &t->header, sizeof(t->header));
+	if (!ret)
+		ret = regtrace_write(t->fd, t->fields,
+				     t->count * sizeof(t->fields[0]));
+	if (ret)
+		goto __exit_loop;
+
+	fprintf(stdout, "trace %d registers at %u Hz to %s\n",
+		t->count, t->rate, file);
+
+	ret = evloop_run(t->loop);
+	if (!ret)
+		ret = t->error;
+	if (!ret)
+		ret = regtrace_flush(t);
+
+	/* the sample counts are known now */
+	if (pwrite(t->fd, &t->header, sizeof(t->header), 0) < 0)
+		ret = -errno;
+
+	fprintf(stdout,
+		"traced %u samples, %u missed, %u changes in %zu bytes\n",
+		t->header.samples, t->header.overruns, t->changes,
+		t->written);
+
+__exit_loop:
+	evloop_destroy(t->loop);
+	t->loop = NULL;
+
+__exit_file:
+	close(t->fd);
+	t->fd = -1;
+
+	return ret;
+}
+
+static int regtrace_read_varint(FILE *fp, uint64_t *v)
+{
+	int c, shift = 0;
+
+	*v = 0;
+	do {
+		c = getc(fp);
+		if (c == EOF || shift > 63)
+			return -1;
+
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+/* a reference name without the hierarchy dots */
+static void regtrace_vcd_ref(char *ref, const char *name)
+{
+	for (; *name; name++, ref++)
+		*ref = *name == '.' ? '_' : *name;
+	*ref = '\0';
+}
+
+static void regtrace_vcd_value(FILE *fp, int id, uint32_t v)
+{
+	int bit = 31;
+
+	while (bit > 0 && !(v & (1u << bit)))
+		bit--;
+
+	putc('b', fp);
+	for (; bit >= 0; bit--)
+		putc(v & (1u << bit) ? '1' : '0', fp);
+	fprintf(fp, " %c\n", '!' + id);
+}
+
+static void regtrace_vcd_header(FILE *fp,
+				const struct regtrace_file_header *h,
+				const struct regtrace_file_field *fields)
+{
+	char ref[sizeof(fields[0].name)];
+	time_t start = h->start_ns / 1000000000;
+	int module = -1;
+	int i;
+
+	fprintf(fp, "$date %.24s $end\n", ctime(&start));
+	fprintf(fp, "$version capture-display register trace $end\n");
+	fprintf(fp, "$timescale 1us $end\n");
+
+	for (i = 0; i < h->fields; i++) {
+		if (fields[i].module != module) {
+			if (module >= 0)
+				fprintf(fp, "$upscope $end\n");
+			module = fields[i].module;
+			fprintf(fp, "$scope module mlc%d $end\n", module);
+		}
+
+		/* the module is the scope */
+		regtrace_vcd_ref(ref, strchr(fields[i].name, '.') + 1);
+		fprintf(fp, "$var wire 32 %c %s $end\n", '!' + i, ref);
+	}
+	if (module >= 0)
+		fprintf(fp, "$upscope $end\n");
+
+	fprintf(fp, "$enddefinitions $end\n#0\n$dumpvars\n");
+	for (i = 0; i < h->fields; i++)
+		regtrace_vcd_value(fp, i, fields[i].value);
+	fprintf(fp, "$end\n");
+}
+
+int regtrace_export(const char *log, const char *out)
+{
+	const char magic[4] = REGTRACE_MAGIC;
+	struct regtrace_file_header h;
+	struct regtrace_file_field fields[REGTRACE_MAX_FIELDS];
+	uint32_t values[REGTRACE_MAX_FIELDS];
+	const char *ext = strrchr(out, '.');
+	FILE *in, *fp = NULL;
+	uint64_t now = 0, last = 0, dt, x;
+	bool vcd;
+	int i, c, ret = -EINVAL;
+
+	if (!ext || (strcmp(ext, ".vcd") && strcmp(ext, ".csv"))) {
+		fprintf(stderr, "export to .vcd or .csv, not %s\n", out);
+		return -EINVAL;
+	}
+	vcd = !strcmp(ext, ".vcd");
+
+	in = fopen(log, "rb");
+	if (!in) {
+		fprintf(stderr, "Error file %s\n", log);
+		perror("- error");
+		return -errno;
+	}
+
+	if (fread(&h, sizeof(h), 1, in) != 1 ||
+	    memcmp(h.magic, magic, sizeof(magic)) ||
+	    h.version != REGTRACE_VERSION ||
+	    h.fields > REGTRACE_MAX_FIELDS ||
+	    fread(fields, sizeof(fields[0]), h.fields, in) != h.fields) {
+		fprintf(stderr, "%s is not a register trace\n", log);
+		goto __exit_export;
+	}
+
+	fp = fopen(out, "w");
+	if (!fp) {
+		fprintf(stderr, "Error file %s\n", out);
+		perror("- error");
+		ret = -errno;
+		goto __exit_export;
+	}
+
+	for (i = 0; i < h.fields; i++) {
+		fields[i].name[sizeof(fields[i].name) - 1] = '\0';
+		values[i] = fields[i].value;
+	}
+
+	if (vcd) {
+		regtrace_vcd_header(fp, &h, fields);
+	} else {
+		fprintf(fp, "time_us,register,value\n");
+		for (i = 0; i < h.fields; i++)
+			fprintf(fp, "0,%s,0x%08x\n", fields[i].name, values[i]);
+	}
+
+	/* a record cut short at the end is the trace being killed */
+	while (!regtrace_read_varint(in, &dt)) {
+		c = getc(in);
+		if (c == EOF || c >= h.fields || regtrace_read_varint(in, &x))
+			break;
+
+		now += dt;
+		values[c] ^= x;
+
+		if (!vcd) {
+			fprintf(fp, "%llu,%s,0x%08x\n", (unsigned long long)now,
+				fields[c].name, values[c]);
+			continue;
+		}
+
+		if (now != last)
+			fprintf(fp, "#%llu\n", (unsigned long long)now);
+		last = now;
+		regtrace_vcd_value(fp, c, values[c]);
+	}
+
+	fprintf(stdout, "%u samples at %u Hz, %u missed, exported to %s\n",
+		h.samples, h.rate, h.overruns, out);
+	ret = 0;
+
+	if (fclose(fp))
+		ret = -errno;
+
+__exit_export:
+	fclose(in);
+
+	return ret;
+}
@@ -0,0 +1,54 @@
+#ifndef __REGTRACE_H__
+#define __REGTRACE_H__
+
+#include <stdint.h>
+
+/*
+ * Samples mlc registers at a fixed rate and logs only their changes.
+ *
+ * Log layout, host endian:
+ *   struct regtrace_file_header
+ *   struct regtrace_file_field, 'fields' times
+ *   records to the end of the file, one per changed register:
+ *     varint  usec since the previous record
+ *     uint8   field index
+ *     varint  value xor the previous value of the field
+ */
+#define REGTRACE_MAGIC		{ 'M', 'L', 'C', 'T' }
+#define REGTRACE_VERSION	1
+#define REGTRACE_MAX_FIELDS	64
+/* the records are in usec, a shorter interval is no finer */
+#define REGTRACE_MAX_RATE	1000000
+
+struct regtrace_file_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t fields;
+	uint32_t rate;		/* samples per second */
+	uint32_t samples;
+	uint32_t overruns;	/* samples missed */
+	uint32_t reserved;
+	uint64_t start_ns;	/* CLOCK_REALTIME */
+};
+
+struct regtrace_file_field {
+	char name[24];
+	uint8_t module;
+	uint8_t reserved;
+	uint16_t word;		/* register offset in words */
+	uint32_t value;		/* at the start */
+};
+
+struct regtrace;
+
+struct regtrace *regtrace_create(unsigned int rate);
+void regtrace_destroy(struct regtrace *t);
+
+/* "mlc<m>.<register>" or "mlc<m>" for the layout registers of a module */
+int regtrace_add(struct regtrace *t, const char *name);
+int regtrace_run(struct regtrace *t, const char *file, unsigned int msec);
+
+/* to a .vcd waveform or .csv table by the extension of 'out' */
+int regtrace_export(const char *log, const char *out);
+
+#endif
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "status.h"
+#include "io.h"
+
+static const char * const status_layer_name[] = {
+	[mlc_layer_rgb0] = "rgb0",
+	[mlc_layer_rgb1] = "rgb1",
+	[mlc_layer_video] = "video",
+};
+
+struct status_buf {
+	char *buf;
+	size_t size, len;
+	bool full;
+};
+
+static void status_decode_module(const struct status_snapshot *s,
+				 struct status_module *m)
+{
+	const struct mlc_reg *r = &s->mlc;
+
+	memset(m, 0, sizeof(*m));
+	m->module = s->module;
+	m->layers = hw_reg_get_layer_num(s->module);
+	m->power = _getbits(r->mlccontrolt, 10, 2) == 0x3;
+	m->priority = _getbits(r->mlccontrolt, 8, 2);
+	m->enabled = _getbits(r->mlccontrolt, 1, 1);
+	m->interlace = _getbits(r->mlccontrolt, 0, 1);
+	m->screen_w = _getbits(r->mlcscreensize, 0, 12) + 1;
+	m->screen_h = _getbits(r->mlcscreensize, 16, 12) + 1;
+	m->bgcolor = _getbits(r->mlcbgcolor, 0, 24);
+
+	m->gamma = r->mlcgammacont;
+	m->gamma_r = _getbits(r->mlcgammacont, 2, 2) == 3;
+	m->gamma_g = _getbits(r->mlcgammacont, 8, 2) == 3;
+	m->gamma_b = _getbits(r->mlcgammacont, 10, 2) == 3;
+	m->gamma_alpha_yuv = _getbits(r->mlcgammacont, 5, 1);
+	m->gamma_yuv = _getbits(r->mlcgammacont, 4, 1);
+	m->gamma_rgb = _getbits(r->mlcgammacont, 1, 1);
+	m->dither = _getbits(r->mlcgammacont, 0, 1);
+	m->snapshot_retries = s->retries;
+}
+
+static void status_decode_rect(struct status_layer *l,
+			       uint32_t leftright, uint32_t topbottom)
+{
+	l->left = _getbits(leftright, 16, 11);
+	l->top = _getbits(topbottom, 16, 11);
+	l->width = _getbits(leftright, 0, 11) - l->left + 1;
+	l->height = _getbits(topbottom, 0, 11) - l->top + 1;
+}
+
+static void status_decode_layer(const struct status_snapshot *s,
+				enum mlc_layer layer, struct status_layer *l)
+{
+	const struct mlc_reg *r = &s->mlc;
+	uint32_t control;
+
+	memset(l, 0, sizeof(*l));
+	l->layer = layer;
+
+	switch (layer) {
+	case mlc_layer_rgb0:
+	case mlc_layer_rgb1:
+		control = r->rgb[layer].mlccontrol;
+		status_decode_rect(l, r->rgb[layer].mlcleftright,
+				   r->rgb[layer].mlctopbottom);
+		l->src_w = l->width;
+		l->src_h = l->height;
+		l->format = control & _maskbit(16, 16);
+		l->hstride = r->rgb[layer].mlchstride;
+		l->vstride = r->rgb[layer].mlcvstride;
+		l->bpp = r->rgb[layer].mlchstride * 8;
+		l->address[0] = r->rgb[layer].mlcaddress;
+		l->tpcolor_value = r->rgb[layer].mlctpcolor;
+		l->invcolor_value = r->rgb[layer].mlcinvcolor;
+		break;
+	case mlc_layer_video:
+		control = r->yuv.mlccontrol;
+		status_decode_rect(l, r->yuv.mlcleftright,
+				   r->yuv.mlctopbottom);
+		l->format = control & _maskbit(16, 16);
+		l->vstride = r->yuv.mlcvstride;
+		l->stride_cb = r->yuv.mlcvstridecb;
+		l->stride_cr = r->yuv.mlcvstridecr;
+		l->bpp = 8;
+		l->address[0] = r->yuv.mlcaddress;
+		l->address[1] = r->yuv.mlcaddresscb;
+		l->address[2] = r->yuv.mlcaddresscr;
+		l->hscale = _getbits(r->yuv.mlchscale, 0, 23);
+		l->vscale = _getbits(r->yuv.mlcvscale, 0, 23);
+		l->src_w = l->hscale * l->width / MLC_YUV_SCALE_CONSTANT;
+		l->src_h = l->vscale * l->height / MLC_YUV_SCALE_CONSTANT;
+		l->hfilter = _getbits(r->yuv.mlchscale, 28, 2) == 0x3;
+		l->vfilter = _getbits(r->yuv.mlcvscale, 28, 2) == 0x3;
+		l->tpcolor_value = r->yuv.mlctpcolor;
+		l->invcolor_value = r->yuv.mlcinvcolor;
+		l->contrast = _getbits(r->yuv.mlcluenh, 0, 3);
+		l->bright = _getbits(r->yuv.mlcluenh, 8, 8);
+		memcpy(l->chenh, r->yuv.mlcchenh, sizeof(l->chenh));
+		break;
+	case mlc_layer_unknown:
+	default:
+		return;
+	}
+
+	l->enabled = _getbits(control, 5, 1);
+	l->blend = _getbits(control, 2, 1);
+	l->invcolor = _getbits(control, 1, 1);
+	l->tpcolor = _getbits(control, 0, 1);
+}
+
+static void status_add(struct status_buf *b, const void *data, size_t len)
+{
+	if (b->full || b->len + len > b->size) {
+		b->full = true;
+		return;
+	}
+
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+}
+
+static void status_printf(struct status_buf *b, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void status_printf(struct status_buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (b->full)
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(b->buf + b->len, b->size - b->len, fmt, ap);
+	va_end(ap);
+
+	if (n < 0 || (size_t)n >= b->size - b->len)
+		b->full = true;
+	else
+		b->len += n;
+}
+
+static const char *status_bool(int v)
+{
+	return v ? "true" : "false";
+}
+
+static void status_json_layer(struct status_buf *b, struct status_layer *l)
+{
+	const char *name = hw_format_name(l->layer == mlc_layer_video ?
+					  l->format & _maskbit(16, 2) :
+					  l->format, l->bpp);
+
+	status_printf(b,
+		"{\"layer\":\"%s\",\"enabled\":%s,"
+		"\"rect\":{\"left\":%d,\"top\":%d,\"width\":%u,\"height\":%u},"
+		"\"source\":{\"width\":%u,\"height\":%u},",
+		status_layer_name[l->layer], status_bool(l->enabled),
+		l->left, l->top, l->width, l->height, l->src_w, l->src_h);
+
+	if (name)
+		status_printf(b, "\"format\":\"%s\",", name);
+	else
+		status_printf(b, "\"format\":null,");
+
+	status_printf(b,
+		"\"format_code\":\"0x%08x\",\"bpp\":%u,"
+		"\"stride\":{\"h\":%d,\"v\":%d,\"cb\":%d,\"cr\":%d},"
+		"\"address\":[\"0x%08x\",\"0x%08x\",\"0x%08x\"],"
+		"\"scale\":{\"h\":%u,\"v\":%u,\"hfilter\":%s,\"vfilter\":%s},"
+		"\"blend\":%s,\"invcolor\":%s,\"tpcolor\":%s,"
+		"\"invcolor_value\":\"0x%06x\",\"tpcolor_value\":\"0x%06x\"",
+		l->format, l->bpp,
+		l->hstride, l->vstride, l->stride_cb, l->stride_cr,
+		l->address[0], l->address[1], l->address[2],
+		l->hscale, l->vscale,
+		status_bool(l->hfilter), status_bool(l->vfilter),
+		status_bool(l->blend), status_bool(l->invcolor),
+		status_bool(l->tpcolor),
+		l->invcolor_value, l->tpcolor_value);
+
+	if (l->layer == mlc_layer_video)
+		status_printf(b,
+			",\"enhance\":{\"contrast\":%u,\"bright\":%u,"
+			"\"chroma\":[\"0x%08x\",\"0x%08x\",\"0x%08x\",\"0x%08x\"]}",
+			l->contrast, l->bright, l->chenh[0], l->chenh[1],
+			l->chenh[2], l->chenh[3]);
+
+	status_printf(b, "}");
+}
+
+static void status_json_module(struct status_buf *b, struct status_module *m)
+{
+	status_printf(b,
+		"{\"module\":%u,\"power\":%s,\"enabled\":%s,"
+		"\"interlace\":%s,\"priority\":%u,"
+		"\"screen\":{\"width\":%u,\"height\":%u},"
+		"\"bgcolor\":\"0x%06x\","
+		"\"gamma\":{\"control\":\"0x%08x\",\"r\":%s,\"g\":%s,\"b\":%s,"
+		"\"alpha\":\"%s\",\"yuv\":%s,\"rgb\":%s,\"dither\":%s},"
+		"\"snapshot_retries\":%u,\"layers\":[",
+		m->module, status_bool(m->power), status_bool(m->enabled),
+		status_bool(m->interlace), m->priority,
+		m->screen_w, m->screen_h, m->bgcolor, m->gamma,
+		status_bool(m->gamma_r), status_bool(m->gamma_g),
+		status_bool(m->gamma_b), m->gamma_alpha_yuv ? "yuv" : "rgb",
+		status_bool(m->gamma_yuv), status_bool(m->gamma_rgb),
+		status_bool(m->dither), m->snapshot_retries);
+}
+
+ssize_t status_format(enum status_format format,
+		      const struct status_snapshot *modules, int count,
+		      char *buf, size_t size)
+{
+	const struct status_header magic = { .magic = STATUS_MAGIC };
+	struct status_buf b = { .buf = buf, .size = size };
+	struct status_header header = magic;
+	struct status_module m;
+	struct status_layer l;
+	struct timespec ts;
+	uint64_t now;
+	int i, n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+	switch (format) {
+	case status_format_json:
+		status_printf(&b, "{\"version\":%d,\"time_ns\":%llu,\"modules\":[",
+			      STATUS_VERSION, (unsigned long long)now);
+		break;
+	case status_format_binary:
+		header.version = STATUS_VERSION;
+		header.modules = count;
+		header.module_size = sizeof(m);
+		header.layer_size = sizeof(l);
+		header.time_ns = now;
+		status_add(&b, &header, sizeof(header));
+		break;
+	case status_format_none:
+	default:
+		return -EINVAL;
+	}
+
+	for (i = 0; i < count; i++) {
+		status_decode_module(&modules[i], &m);
+
+		if (format == status_format_json)
+			status_json_module(&b, &m);
+		else
+			status_add(&b, &m, sizeof(m));
+
+		for (n = 0; n < m.layers; n++) {
+			status_decode_layer(&modules[i], n, &l);
+
+			if (format == status_format_binary) {
+				status_add(&b, &l, sizeof(l));
+				continue;
+			}
+
+			if (n)
+				status_printf(&b, ",");
+			status_json_layer(&b, &l);
+		}
+
+		if (format == status_format_json)
+			status_printf(&b, "]}%s", i + 1 < count ? "," : "");
+	}
+
+	if (format == status_format_json)
+		status_printf(&b, "]}\n");
+
+	return b.full ? -ENOSPC : (ssize_t)b.len;
+}
+
+ssize_t status_get(enum status_format format, char *buf, size_t size)
+{
+	struct status_snapshot *modules;
+	struct mlc_snapshot stat;
+	ssize_t len;
+	int i, count = 0;
+
+	modules = calloc(NUMBER_OF_MLC_MODULE, sizeof(*modules));
+	if (!modules)
+		return -ENOMEM;
+
+	for (i = 0; i < hw_reg_get_module_num(); i++) {
+		if (!hw_reg_get_mem(i))
+			continue;
+
+		modules[count].module = i;
+		hw_reg_snapshot(i, &modules[count].mlc, &stat);
+		modules[count].retries = stat.retries;
+		count++;
+	}
+
+	len = status_format(format, modules, count, buf, size);
+	free(modules);
+
+	return len;
+}
+
+int status_write(int fd, enum status_format format)
+{
+	char *buf;
+	ssize_t len;
+	int ret = 0;
+
+	buf = malloc(STATUS_BUF_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	len = status_get(format, buf, STATUS_BUF_SIZE);
+	if (len < 0) {
+		ret = len;
+		goto __exit_status;
+	}
+
+	if (write(fd, buf, len) != len) {
+		fprintf(stderr, "failed to write status: %s\n",
+			strerror(errno));
+		ret = -EIO;
+	}
+
+__exit_status:
+	free(buf);
+
+	return ret;
+}
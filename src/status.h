@@ -0,0 +1,90 @@
+#ifndef __STATUS_H__
+#define __STATUS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mlc.h"
+
+/*
+ * The decoded state of the modules for scraping. The binary is a
+ * status_header, then per module a status_module and its layers as
+ * status_layer, in the byte order of the device.
+ */
+#define STATUS_MAGIC		{ 'M', 'L', 'C', 'B' }
+#define STATUS_VERSION		1
+/* a few kbytes a module, the buffer is written at once */
+#define STATUS_BUF_SIZE		(32 * 1024)
+
+enum status_format {
+	status_format_none,
+	status_format_json,
+	status_format_binary,
+};
+
+struct status_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t modules;
+	uint16_t module_size;	/* sizeof(struct status_module) */
+	uint16_t layer_size;	/* sizeof(struct status_layer) */
+	uint32_t __reserved;
+	uint64_t time_ns;	/* realtime of the snapshot */
+};
+
+struct status_module {
+	uint8_t module;
+	uint8_t layers;
+	uint8_t power;
+	uint8_t enabled;
+	uint8_t interlace;
+	uint8_t priority;
+	uint16_t screen_w, screen_h;
+	uint8_t __reserved[2];
+	uint32_t bgcolor;
+	/* gamma */
+	uint32_t gamma;
+	uint8_t gamma_r, gamma_g, gamma_b;
+	uint8_t gamma_alpha_yuv;	/* alpha blends in yuv, else rgb */
+	uint8_t gamma_yuv, gamma_rgb;
+	uint8_t dither;
+	uint8_t snapshot_retries;
+};
+
+struct status_layer {
+	uint8_t layer;
+	uint8_t enabled;
+	uint8_t blend, invcolor, tpcolor;
+	uint8_t hfilter, vfilter;
+	uint8_t bpp;
+	int16_t left, top;
+	uint16_t width, height;
+	uint16_t src_w, src_h;		/* before the video scaler */
+	uint32_t format;
+	int32_t hstride, vstride;
+	int32_t stride_cb, stride_cr;
+	uint32_t address[3];
+	uint32_t hscale, vscale;
+	uint32_t tpcolor_value, invcolor_value;
+	/* video enhancement */
+	uint8_t contrast, bright;
+	uint8_t __reserved[2];
+	uint32_t chenh[4];
+};
+
+struct status_snapshot {
+	int module;
+	struct mlc_reg mlc;
+	int retries;
+};
+
+/* serializes the modules into 'buf', returns the length or -ENOSPC */
+ssize_t status_format(enum status_format format,
+		      const struct status_snapshot *modules, int count,
+		      char *buf, size_t size);
+/* snapshots the mapped modules into 'buf', returns the length */
+ssize_t status_get(enum status_format format, char *buf, size_t size);
+/* snapshots the mapped modules and writes them with a single write */
+int status_write(int fd, enum status_format format);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "stream.h"
+#include "iomap.h"
+#include "timeline.h"
+
+/* mapped at once, the chunks of a window copied and written in turn */
+#define STREAM_WINDOW		(2 << 20)
+
+struct stream {
+	void *chunk;
+	size_t size;
+	size_t window;		/* a multiple of the chunk */
+	uint64_t bytes;
+	unsigned int planes;
+	long start_rss;		/* KB, before the first plane */
+};
+
+static long stream_peak_rss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+	return ru.ru_maxrss;
+}
+
+struct stream *stream_create(size_t chunk)
+{
+	struct stream *s;
+
+	if (!chunk)
+		return NULL;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->size = (chunk + IO_MMAP_ALIGN - 1) & ~((size_t)IO_MMAP_ALIGN - 1);
+	if (posix_memalign(&s->chunk, IO_MMAP_ALIGN, s->size)) {
+		fprintf(stderr, "failed to allocate the %zu byte chunk\n",
+			s->size);
+		free(s);
+		return NULL;
+	}
+	s->window = (STREAM_WINDOW + s->size - 1) / s->size * s->size;
+
+	/* faulted in now, not on the first frame */
+	memset(s->chunk, 0, s->size);
+
+	return s;
+}
+
+void stream_destroy(struct stream *s)
+{
+	if (!s)
+		return;
+
+	free(s->chunk);
+	free(s);
+}
+
+static int stream_write(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int stream_plane(struct stream *s, int fd, uint32_t addr, size_t size)
+{
+	void *mem, *mapped;
+	size_t window, offset, end, len;
+	uint64_t ts;
+	int ret = 0;
+
+	if (!s->planes++)
+		s->start_rss = stream_peak_rss();
+
+	ts = timeline_begin();
+
+	for (window = 0; window < size && !ret; window += s->window) {
+		end = size - window < s->window ? size - window : s->window;
+
+		mem = iomem_map((void *)(size_t)(addr + window), end, &mapped);
+		if (!mem) {
+			fprintf(stderr, "Fail, map 0x%zx\n",
+				(size_t)addr + window);
+			ret = -EINVAL;
+			break;
+		}
+
+		for (offset = 0; offset < end && !ret; offset += len) {
+			len = end - offset < s->size ? end - offset : s->size;
+
+			memcpy(s->chunk, mem + offset, len);
+			ret = stream_write(fd, s->chunk, len);
+		}
+
+		iomem_free(mapped, end);
+	}
+
+	timeline_end("capture", "stream", ts);
+
+	if (!ret)
+		s->bytes += size;
+
+	return ret;
+}
+
+void stream_report(struct stream *s, FILE *fp)
+{
+	if (!s || !s->planes)
+		return;
+
+	fprintf(fp,
+		"streamed %u planes, %llu bytes through a %zu byte chunk, peak rss %ldKB (%ldKB before)\n",
+		s->planes, (unsigned long long)s->bytes, s->size,
+		stream_peak_rss(), s->start_rss);
+}
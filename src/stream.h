@@ -0,0 +1,26 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Streams planes from the device to a file through one chunk buffer,
+ * allocated up front: a window of a few MB of the plane is mapped, copied
+ * to the chunk and written a chunk at a time, then unmapped. Nothing is
+ * allocated or left mapped per frame, the working set is the chunk and a
+ * window at most whatever the frame size.
+ */
+struct stream;
+
+/* 'chunk' is rounded up to pages */
+struct stream *stream_create(size_t chunk);
+void stream_destroy(struct stream *s);
+
+/* the 'size' bytes at device address 'addr' to 'fd' */
+int stream_plane(struct stream *s, int fd, uint32_t addr, size_t size);
+/* the bytes streamed and the peak rss */
+void stream_report(struct stream *s, FILE *fp);
+
+#endif
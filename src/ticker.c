@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "ticker.h"
+#include "timeline.h"
+
+/* log2 of the skew in usec */
+#define TICKER_BUCKETS		24
+
+struct ticker {
+	int fd, sigfd;
+	sigset_t mask, old;
+	uint64_t period, start;	/* nsec */
+	uint64_t index;		/* of the next deadline */
+	unsigned int ticks;
+	uint64_t missed;
+	uint64_t min, max, sum;
+	double sum2;
+	unsigned int buckets[TICKER_BUCKETS];
+};
+
+static uint64_t ticker_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct ticker *ticker_create(uint64_t period_ns)
+{
+	struct itimerspec its;
+	struct ticker *t;
+
+	if (!period_ns)
+		return NULL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->period = period_ns;
+	t->sigfd = -1;
+	t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (t->fd < 0)
+		goto __exit_create;
+
+	sigemptyset(&t->mask);
+	sigaddset(&t->mask, SIGINT);
+	sigaddset(&t->mask, SIGTERM);
+	errno = pthread_sigmask(SIG_BLOCK, &t->mask, &t->old);
+	if (errno)
+		goto __exit_create;
+	t->sigfd = signalfd(-1, &t->mask, SFD_CLOEXEC);
+	if (t->sigfd < 0)
+		goto __exit_create;
+
+	/* the first deadline is now, the others on the grid from it */
+	t->start = ticker_now();
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = t->start / 1000000000ull;
+	its.it_value.tv_nsec = t->start % 1000000000ull;
+	its.it_interval.tv_sec = period_ns / 1000000000ull;
+	its.it_interval.tv_nsec = period_ns % 1000000000ull;
+	if (timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &its, NULL))
+		goto __exit_create;
+
+	return t;
+
+__exit_create:
+	fprintf(stderr, "failed to create the ticker: %s\n", strerror(errno));
+	ticker_destroy(t);
+
+	return NULL;
+}
+
+void ticker_destroy(struct ticker *t)
+{
+	if (!t)
+		return;
+
+	if (t->sigfd >= 0) {
+		close(t->sigfd);
+		pthread_sigmask(SIG_SETMASK, &t->old, NULL);
+	}
+	if (t->fd >= 0)
+		close(t->fd);
+	free(t);
+}
+
+int ticker_wait(struct ticker *t)
+{
+	struct pollfd fds[2] = {
+		{ .fd = t->fd, .events = POLLIN },
+		{ .fd = t->sigfd, .events = POLLIN },
+	};
+	struct signalfd_siginfo si;
+	uint64_t expirations, deadline, now, skew;
+	int bucket;
+
+	while (poll(fds, 2, -1) < 0)
+		if (errno != EINTR)
+			return -errno;
+
+	/* read, not left pending to kill the process once unblocked */
+	if (fds[1].revents) {
+		if (read(t->sigfd, &si, sizeof(si)) != sizeof(si))
+			return -errno;
+		fprintf(stdout, "%s, stop\n", strsignal(si.ssi_signo));
+		return -EINTR;
+	}
+
+	if (read(t->fd, &expirations, sizeof(expirations)) !=
+	    sizeof(expirations))
+		return -errno;
+	now = ticker_now();
+
+	/* the latest deadline passed, the ones before it are missed */
+	t->index += expirations;
+	t->missed += expirations - 1;
+	deadline = t->start + (t->index - 1) * t->period;
+	skew = now > deadline ? now - deadline : 0;
+
+	if (!t->ticks || skew < t->min)
+		t->min = skew;
+	if (skew > t->max)
+		t->max = skew;
+	t->sum += skew;
+	t->sum2 += (double)skew * skew;
+	t->ticks++;
+
+	for (bucket = 0; bucket < TICKER_BUCKETS - 1 &&
+	     (skew / 1000) >> bucket; bucket++)
+		;
+	t->buckets[bucket]++;
+
+	timeline_instant("schedule", "tick", skew);
+
+	return 0;
+}
+
+/* the upper bound of the bucket 'p' of the ticks fall in */
+static uint64_t ticker_percentile(struct ticker *t, double p)
+{
+	unsigned int count = 0;
+	int i;
+
+	for (i = 0; i < TICKER_BUCKETS; i++) {
+		count += t->buckets[i];
+		if (count >= p * t->ticks)
+			break;
+	}
+
+	return i ? 1ull << i : 1;
+}
+
+void ticker_report(struct ticker *t, FILE *fp)
+{
+	double mean;
+
+	if (!t || !t->ticks)
+		return;
+
+	mean = (double)t->sum / t->ticks;
+	fprintf(fp,
+		"schedule %.3fms, %u ticks, %llu missed deadlines, skew min %lluus, mean %.1fus, max %lluus, jitter %.1fus, p99 < %lluus\n",
+		t->period / 1000000.0, t->ticks,
+		(unsigned long long)t->missed,
+		(unsigned long long)t->min / 1000, mean / 1000,
+		(unsigned long long)t->max / 1000,
+		sqrt(fabs(t->sum2 / t->ticks - mean * mean)) / 1000,
+		(unsigned long long)ticker_percentile(t, 0.99));
+}
+
+int ticker_realtime(int prio, int cpu, bool lock)
+{
+	struct sched_param param;
+	cpu_set_t set;
+	int ret = 0;
+
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			ret = -errno;
+			fprintf(stderr, "failed to run on cpu %d: %s\n", cpu,
+				strerror(-ret));
+		}
+	}
+
+	if (prio) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+			ret = -errno;
+			fprintf(stderr, "failed to set SCHED_FIFO %d: %s\n",
+				prio, strerror(-ret));
+		}
+	}
+
+	/* no page fault in the way of a deadline */
+	if (lock && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		ret = -errno;
+		fprintf(stderr, "failed to lock memory: %s\n", strerror(-ret));
+	}
+
+	return ret;
+}
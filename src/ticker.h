@@ -0,0 +1,29 @@
+#ifndef __TICKER_H__
+#define __TICKER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Ticks on absolute deadlines of a monotonic timerfd, a late tick does
+ * not shift the ones after it. The deadlines a tick was too late for are
+ * counted as missed, not run late one after the other.
+ */
+struct ticker;
+
+struct ticker *ticker_create(uint64_t period_ns);
+void ticker_destroy(struct ticker *t);
+
+/* blocks to the next deadline, -EINTR on SIGINT or SIGTERM */
+int ticker_wait(struct ticker *t);
+/* the skew and missed deadlines of the ticks */
+void ticker_report(struct ticker *t, FILE *fp);
+
+/*
+ * SCHED_FIFO at 'prio' when not 0, on 'cpu' when not -1, locked memory.
+ * A negative errno when any of them failed.
+ */
+int ticker_realtime(int prio, int cpu, bool lock);
+
+#endif
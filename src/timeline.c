@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "timeline.h"
+
+#define TIMELINE_CHUNK_EVENTS	4096
+
+struct timeline_event {
+	const char *cat;
+	const char *name;
+	uint64_t ts;		/* nsec */
+	uint64_t dur;		/* nsec, of a span */
+	uint64_t arg;		/* of an instant */
+	bool instant;
+};
+
+struct timeline_chunk {
+	struct timeline_chunk *next;
+	unsigned int count;
+	struct timeline_event events[TIMELINE_CHUNK_EVENTS];
+};
+
+struct timeline_thread {
+	struct timeline_thread *next;
+	pid_t tid;
+	struct timeline_chunk *first, *last;
+};
+
+static char *timeline_file;
+static struct timeline_thread *timeline_threads;
+static __thread struct timeline_thread *timeline_self;
+
+static uint64_t timeline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* the buffers of this thread, on the list of all with a compare and swap */
+static struct timeline_thread *timeline_thread(void)
+{
+	struct timeline_thread *t = timeline_self;
+
+	if (t)
+		return t;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->tid = syscall(SYS_gettid);
+	t->next = __atomic_load_n(&timeline_threads, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&timeline_threads, &t->next, t,
+					    true, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+
+	timeline_self = t;
+
+	return t;
+}
+
+static struct timeline_event *timeline_event(void)
+{
+	struct timeline_thread *t = timeline_thread();
+	struct timeline_chunk *c;
+
+	if (!t)
+		return NULL;
+
+	c = t->last;
+	if (!c || c->count == TIMELINE_CHUNK_EVENTS) {
+		c = malloc(sizeof(*c));
+		if (!c)
+			return NULL;
+		c->next = NULL;
+		c->count = 0;
+		if (t->last)
+			t->last->next = c;
+		else
+			t->first = c;
+		t->last = c;
+	}
+
+	return &c->events[c->count++];
+}
+
+uint64_t timeline_begin(void)
+{
+	return timeline_file ? timeline_now() : 0;
+}
+
+void timeline_end(const char *cat, const char *name, uint64_t begin)
+{
+	struct timeline_event *e;
+
+	if (!begin || !timeline_file)
+		return;
+
+	e = timeline_event();
+	if (!e)
+		return;
+
+	e->cat = cat;
+	e->name = name;
+	e->ts = begin;
+	e->dur = timeline_now() - begin;
+	e->instant = false;
+}
+
+void timeline_instant(const char *cat, const char *name, uint64_t arg)
+{
+	struct timeline_event *e;
+
+	if (!timeline_file)
+		return;
+
+	e = timeline_event();
+	if (!e)
+		return;
+
+	e->cat = cat;
+	e->name = name;
+	e->ts = timeline_now();
+	e->arg = arg;
+	e->instant = true;
+}
+
+int timeline_open(const char *file)
+{
+	FILE *fp;
+
+	/* fails early on a file it could not write at the close */
+	fp = fopen(file, "w");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %s\n", file,
+			strerror(errno));
+		return -errno;
+	}
+	fclose(fp);
+
+	free(timeline_file);
+	timeline_file = strdup(file);
+
+	return timeline_file ? 0 : -ENOMEM;
+}
+
+static void timeline_write(FILE *fp, pid_t pid)
+{
+	struct timeline_thread *t;
+	struct timeline_chunk *c;
+	unsigned int i;
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp,
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"capture-display\"}}",
+		pid, pid);
+
+	for (t = timeline_threads; t; t = t->next) {
+		for (c = t->first; c; c = c->next) {
+			for (i = 0; i < c->count; i++) {
+				struct timeline_event *e = &c->events[i];
+
+				fprintf(fp,
+					",\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%llu.%03u",
+					e->name, e->cat, pid, t->tid,
+					(unsigned long long)(e->ts / 1000),
+					(unsigned int)(e->ts % 1000));
+				if (e->instant)
+					fprintf(fp,
+						",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"value\":%llu}}",
+						(unsigned long long)e->arg);
+				else
+					fprintf(fp,
+						",\"ph\":\"X\",\"dur\":%llu.%03u}",
+						(unsigned long long)(e->dur / 1000),
+						(unsigned int)(e->dur % 1000));
+			}
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+}
+
+void timeline_close(void)
+{
+	struct timeline_thread *t, *next;
+	struct timeline_chunk *c, *n;
+	FILE *fp;
+
+	if (!timeline_file)
+		return;
+
+	fp = fopen(timeline_file, "w");
+	if (fp) {
+		timeline_write(fp, getpid());
+		fclose(fp);
+	} else {
+		fprintf(stderr, "failed to write %s: %s\n", timeline_file,
+			strerror(errno));
+	}
+
+	for (t = timeline_threads; t; t = next) {
+		next = t->next;
+		for (c = t->first; c; c = n) {
+			n = c->next;
+			free(c);
+		}
+		free(t);
+	}
+
+	timeline_threads = NULL;
+	timeline_self = NULL;
+	free(timeline_file);
+	timeline_file = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+#include <stdint.h>
+
+/*
+ * Events of the capture and replay paths in the chrome trace event json,
+ * for chrome://tracing or perfetto. A thread records to buffers of its
+ * own without a lock, they are written out on the close after the other
+ * threads are gone. Times are CLOCK_MONOTONIC like the traces of the
+ * other processes of the system.
+ * 'cat' and 'name' must be static strings, nothing records until opened.
+ */
+int timeline_open(const char *file);
+void timeline_close(void);
+
+/* the start of a span, 0 when closed */
+uint64_t timeline_begin(void);
+void timeline_end(const char *cat, const char *name, uint64_t begin);
+/* a point in time with a value, e.g. a vblank and its sequence */
+void timeline_instant(const char *cat, const char *name, uint64_t arg);
+
+#endif
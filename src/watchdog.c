@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "watchdog.h"
+#include "evloop.h"
+#include "iomap.h"
+#include "mlc.h"
+#include "io.h"
+
+/* the rows hashed of a layer, spread over its height */
+#define WATCHDOG_ROWS		64
+/* the offsets the rows go through, a check each */
+#define WATCHDOG_PHASES		16
+#define WATCHDOG_CLIENTS	8
+
+/* 4 lanes of 32 bit, NEON on arm and SSE on x86 */
+typedef uint32_t watchdog_u32 __attribute__((vector_size(16)));
+
+/* a frame buffer of a layer, mapped until its address or size changes */
+struct watchdog_map {
+	uint32_t address;
+	size_t size;
+	void *mem, *mapped;
+};
+
+struct watchdog_layer {
+	enum mlc_layer layer;
+	uint32_t *control, *address, *leftright, *topbottom;
+	uint32_t *hstride, *vstride;
+	uint32_t *vscale;	/* of the video layer, NULL else */
+	struct watchdog_map maps[2];	/* the front and back of a flip */
+	int map;		/* the last one used */
+	bool enabled, frozen;
+	uint32_t hashes[WATCHDOG_PHASES], sampled;	/* a bit a phase */
+	unsigned int phase;
+	uint32_t last_address;
+	uint64_t changed_us;	/* of the last content change */
+	unsigned int flips;	/* of the address since then */
+};
+
+struct watchdog_module {
+	int module;
+	struct watchdog_layer layers[NUMBER_OF_MLC_LAYER];
+};
+
+struct watchdog {
+	unsigned int frozen_ms, check_ms, phases;
+	bool json, stop_frozen;
+	struct watchdog_module modules[NUMBER_OF_MLC_MODULE];
+	int count;
+	struct evloop *loop;
+	int clients[WATCHDOG_CLIENTS];
+	unsigned int freezes, checks;
+	uint64_t check_ns;
+};
+
+static const char * const watchdog_layer_name[] = {
+	[mlc_layer_rgb0] = "rgb0",
+	[mlc_layer_rgb1] = "rgb1",
+	[mlc_layer_video] = "video",
+};
+
+static uint64_t watchdog_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void watchdog_layer_init(struct watchdog_layer *l, struct mlc_reg *r,
+				enum mlc_layer layer)
+{
+	l->layer = layer;
+
+	/* the luma of the video layer */
+	if (layer == mlc_layer_video) {
+		l->control = &r->yuv.mlccontrol;
+		l->address = &r->yuv.mlcaddress;
+		l->leftright = &r->yuv.mlcleftright;
+		l->topbottom = &r->yuv.mlctopbottom;
+		l->vstride = &r->yuv.mlcvstride;
+		l->vscale = &r->yuv.mlcvscale;
+	} else {
+		l->control = &r->rgb[layer].mlccontrol;
+		l->address = &r->rgb[layer].mlcaddress;
+		l->leftright = &r->rgb[layer].mlcleftright;
+		l->topbottom = &r->rgb[layer].mlctopbottom;
+		l->hstride = (uint32_t *)&r->rgb[layer].mlchstride;
+		l->vstride = (uint32_t *)&r->rgb[layer].mlcvstride;
+	}
+}
+
+struct watchdog *watchdog_create(unsigned int frozen, unsigned int check)
+{
+	struct watchdog *w;
+	int i, n;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->frozen_ms = frozen ? frozen : 1000;
+	w->check_ms = check ? check : w->frozen_ms / 10;
+	if (w->check_ms < 10)
+		w->check_ms = 10;
+	/* every phase is seen twice before a layer is frozen */
+	w->phases = w->frozen_ms / w->check_ms / 2;
+	if (w->phases > WATCHDOG_PHASES)
+		w->phases = WATCHDOG_PHASES;
+	if (!w->phases)
+		w->phases = 1;
+	for (i = 0; i < WATCHDOG_CLIENTS; i++)
+		w->clients[i] = -1;
+
+	for (i = 0; i < hw_reg_get_module_num(); i++) {
+		struct watchdog_module *wm = &w->modules[w->count];
+		struct mlc_reg *r = hw_reg_get_mem(i);
+
+		if (!r)
+			continue;
+
+		wm->module = i;
+		for (n = 0; n < hw_reg_get_layer_num(i); n++)
+			watchdog_layer_init(&wm->layers[n], r, n);
+		w->count++;
+	}
+
+	if (!w->count) {
+		fprintf(stderr, "no mapped module to watch\n");
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+void watchdog_destroy(struct watchdog *w)
+{
+	struct watchdog_layer *l;
+	int i, n;
+
+	if (!w)
+		return;
+
+	for (i = 0; i < w->count; i++)
+		for (n = 0; n < NUMBER_OF_MLC_LAYER; n++) {
+			l = &w->modules[i].layers[n];
+			iomem_free(l->maps[0].mapped, l->maps[0].size);
+			iomem_free(l->maps[1].mapped, l->maps[1].size);
+		}
+	free(w);
+}
+
+/* 4 streams of 32 bit words, folded at the end */
+static uint32_t watchdog_hash(uint32_t h, const uint8_t *p, size_t len)
+{
+	watchdog_u32 acc = { h, h ^ 0x85ebca6b, h ^ 0xc2b2ae35,
+			     h ^ 0x27d4eb2f };
+	watchdog_u32 v;
+	int l;
+
+	for (; len >= sizeof(v); len -= sizeof(v), p += sizeof(v)) {
+		memcpy(&v, p, sizeof(v));
+		acc = (acc ^ v) * 0x9e3779b1;
+		acc ^= acc >> 15;
+	}
+
+	for (l = 0; l < 4; l++)
+		h = (h ^ acc[l]) * 0x01000193;
+	while (len--)
+		h = (h ^ *p++) * 0x01000193;
+
+	return h;
+}
+
+/* the mapping of the frame at 'address', of an earlier check if it has one */
+static void *watchdog_layer_map(struct watchdog_layer *l, uint32_t address,
+				size_t size)
+{
+	struct watchdog_map *m;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		m = &l->maps[i];
+		if (m->mem && m->address == address && m->size == size) {
+			l->map = i;
+			return m->mem;
+		}
+	}
+
+	/* the one not used last */
+	l->map = !l->map;
+	m = &l->maps[l->map];
+	iomem_free(m->mapped, m->size);
+	memset(m, 0, sizeof(*m));
+
+	m->mem = iomem_map((void *)(size_t)address, size, &m->mapped);
+	if (!m->mem)
+		return NULL;
+	m->address = address;
+	m->size = size;
+
+	return m->mem;
+}
+
+/*
+ * The sampled rows of the layer's visible region, moved down by 'phase'
+ * of the 'phases' steps between two rows.
+ */
+static int watchdog_layer_hash(struct watchdog_layer *l, uint32_t address,
+			       unsigned int phase, unsigned int phases,
+			       uint32_t *hash)
+{
+	unsigned int width, height, stride, bpp, rows, i;
+	size_t size;
+	void *mem;
+	uint32_t h;
+
+	width = _getbits(readl(l->leftright), 0, 11) -
+		_getbits(readl(l->leftright), 16, 11) + 1;
+	height = _getbits(readl(l->topbottom), 0, 11) -
+		 _getbits(readl(l->topbottom), 16, 11) + 1;
+	stride = readl(l->vstride);
+
+	if (l->vscale) {
+		height = _getbits(readl(l->vscale), 0, 23) * height /
+			 MLC_YUV_SCALE_CONSTANT;
+		bpp = 1;
+		width = stride;
+	} else {
+		bpp = readl(l->hstride);
+	}
+
+	if (!height || !stride || !bpp || width * bpp > stride)
+		return -EINVAL;
+
+	size = (size_t)stride * height;
+	mem = watchdog_layer_map(l, address, size);
+	if (!mem)
+		return -ENOMEM;
+
+	rows = height < WATCHDOG_ROWS ? height : WATCHDOG_ROWS;
+	for (i = 0, h = 2166136261u; i < rows; i++) {
+		unsigned int y = ((uint64_t)i * phases + phase) * height /
+				 ((uint64_t)rows * phases);
+
+		h = watchdog_hash(h, mem + (size_t)stride * y, width * bpp);
+	}
+
+	*hash = h;
+
+	return 0;
+}
+
+static void watchdog_event(struct watchdog *w, struct watchdog_module *wm,
+			   struct watchdog_layer *l, const char *event,
+			   uint64_t now)
+{
+	unsigned int ms = (now - l->changed_us) / 1000;
+	char line[256];
+	int i, len;
+
+	if (w->json)
+		len = snprintf(line, sizeof(line),
+			       "{\"event\":\"%s\",\"module\":%d,\"layer\":\"%s\",\"unchanged_ms\":%u,\"flips\":%u,\"address\":\"0x%08x\"}\n",
+			       event, wm->module, watchdog_layer_name[l->layer],
+			       ms, l->flips, l->last_address);
+	else
+		len = snprintf(line, sizeof(line),
+			       "mlc.%d %s %s, unchanged for %u ms, %u flips, address 0x%08x\n",
+			       wm->module, watchdog_layer_name[l->layer], event,
+			       ms, l->flips, l->last_address);
+
+	fputs(line, stdout);
+	fflush(stdout);
+
+	for (i = 0; i < WATCHDOG_CLIENTS; i++)
+		if (w->clients[i] >= 0 &&
+		    evloop_send(w->clients[i], line, len, -1) < 0)
+			w->clients[i] = -1;
+}
+
+static void watchdog_check_layer(struct watchdog *w, struct watchdog_module *wm,
+				 struct watchdog_layer *l, uint64_t now)
+{
+	unsigned int phase = l->phase;
+	uint32_t address, hash;
+	bool changed;
+
+	if (!_getbits(readl(l->control), 5, 1)) {
+		l->enabled = false;
+		return;
+	}
+
+	/* a failed sample neither freezes nor thaws the layer */
+	address = readl(l->address);
+	l->phase = (phase + 1) % w->phases;
+	if (watchdog_layer_hash(l, address, phase, w->phases, &hash))
+		return;
+
+	/* the first check of an enabled layer is its start */
+	if (!l->enabled) {
+		l->enabled = true;
+		l->frozen = false;
+		l->hashes[phase] = hash;
+		l->sampled = 1u << phase;
+		l->last_address = address;
+		l->changed_us = now;
+		l->flips = 0;
+		return;
+	}
+
+	if (address != l->last_address)
+		l->flips++;
+	l->last_address = address;
+
+	/* against the rows of the phase the last time round */
+	changed = (l->sampled & (1u << phase)) && hash != l->hashes[phase];
+	l->hashes[phase] = hash;
+	l->sampled |= 1u << phase;
+
+	if (changed) {
+		if (l->frozen)
+			watchdog_event(w, wm, l, "thawed", now);
+		l->changed_us = now;
+		l->flips = 0;
+		l->frozen = false;
+		return;
+	}
+
+	if (!l->frozen && now - l->changed_us >= w->frozen_ms * 1000ull) {
+		l->frozen = true;
+		w->freezes++;
+		watchdog_event(w, wm, l, "frozen", now);
+		if (w->stop_frozen)
+			evloop_quit(w->loop);
+	}
+}
+
+static void watchdog_timer(int fd, uint32_t events, void *data)
+{
+	struct watchdog *w = data;
+	uint64_t start = watchdog_now_ns();
+	int i, n;
+
+	for (i = 0; i < w->count; i++) {
+		struct watchdog_module *wm = &w->modules[i];
+
+		for (n = 0; n < hw_reg_get_layer_num(wm->module); n++)
+			watchdog_check_layer(w, wm, &wm->layers[n],
+					     start / 1000);
+	}
+
+	w->check_ns += watchdog_now_ns() - start;
+	w->checks++;
+}
+
+/* a client gets the events from its first line on */
+static void watchdog_client(char *line, int client, void *data)
+{
+	struct watchdog *w = data;
+	int i, slot = -1;
+
+	for (i = 0; i < WATCHDOG_CLIENTS; i++) {
+		if (w->clients[i] == client) {
+			if (!line)
+				w->clients[i] = -1;
+			return;
+		}
+		if (w->clients[i] < 0 && slot < 0)
+			slot = i;
+	}
+
+	if (line && slot >= 0)
+		w->clients[slot] = client;
+}
+
+static void watchdog_stop(int fd, uint32_t events, void *data)
+{
+	struct watchdog *w = data;
+
+	evloop_quit(w->loop);
+}
+
+int watchdog_run(struct watchdog *w, const char *socket, unsigned int msec,
+		 bool json)
+{
+	const int signals[] = { SIGINT, SIGTERM };
+	int ret;
+
+	w->json = json;
+	w->stop_frozen = !socket;
+
+	w->loop = evloop_create();
+	if (!w->loop)
+		return -ENOMEM;
+
+	ret = evloop_add_signal(w->loop, signals, ARRAY_SIZE(signals),
+				watchdog_stop, w);
+	if (ret >= 0 && socket)
+		ret = evloop_add_server(w->loop, socket, watchdog_client, w);
+	if (ret >= 0 && msec)
+		ret = evloop_add_timer(w->loop, msec, 0, watchdog_stop, w);
+	if (ret >= 0)
+		ret = evloop_add_timer(w->loop, w->check_ms, 1,
+				       watchdog_timer, w);
+	if (ret < 0)
+		goto __exit_run;
+
+	/* the start of every enabled layer */
+	watchdog_timer(-1, 0, w);
+
+	ret = evloop_run(w->loop);
+	if (!ret && !json)
+		fprintf(stdout,
+			"watchdog %u checks every %u ms, %lluns a check, %u freezes\n",
+			w->checks, w->check_ms,
+			(unsigned long long)(w->checks ? w->check_ns / w->checks : 0),
+			w->freezes);
+
+__exit_run:
+	evloop_destroy(w->loop);
+	w->loop = NULL;
+
+	if (ret < 0)
+		return ret;
+
+	return w->freezes ? 1 : 0;
+}
@@ -0,0 +1,26 @@
+#ifndef __WATCHDOG_H__
+#define __WATCHDOG_H__
+
+#include <stdbool.h>
+
+/*
+ * Frozen display watchdog: hashes sampled rows of every enabled layer of
+ * the mapped modules straight from device memory every 'check' msec, the
+ * rows a little lower on every check to go round the whole frame. A
+ * layer whose content has not changed for 'frozen' msec is frozen, with
+ * or without flips of its address. The events are logged and sent to
+ * the socket clients, a json line each with 'json'.
+ */
+struct watchdog;
+
+struct watchdog *watchdog_create(unsigned int frozen, unsigned int check);
+void watchdog_destroy(struct watchdog *w);
+
+/*
+ * Until a signal or 'msec', and without a 'socket' until the first
+ * freeze. Returns 1 when a layer froze, else 0 or a negative errno.
+ */
+int watchdog_run(struct watchdog *w, const char *socket, unsigned int msec,
+		 bool json);
+
+#endif